@@ -0,0 +1,347 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks for the trace parser and the request path. Run with ‘make bench’.
+ *
+ * A synthetic trace is generated with a configurable number of messages, headers per message and response body size, and is used to time:
+ *  • parse-text: parsing every message from the text trace in memory;
+ *  • parse-binary: the same, from the trace compiled to the binary format;
+ *  • parse-all-text, parse-all-binary: parsing every message with uhm_trace_load_all(), which parses large traces in parallel, so
+ *    comparing these with parse-text and parse-binary gives the speedup from doing so;
+ *  • load: uhm_server_load_trace() on the text trace written to disk, with preloading enabled so that the whole trace is parsed;
+ *  • requests: sending a request for every message in the trace to a running server, one after another, using a #SoupSession.
+ *
+ * Results are printed to stdout as JSON, one object per line, so they can be collected and compared between runs.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <locale.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "uhm-server.h"
+#include "uhm-trace.h"
+
+static gint n_entries = 1000;
+static gint n_headers = 10;
+static gint body_size = 1024;
+
+static const GOptionEntry option_entries[] = {
+	{ "entries", 'n', 0, G_OPTION_ARG_INT, &n_entries, "Number of messages in the generated trace", "N" },
+	{ "headers", 'H', 0, G_OPTION_ARG_INT, &n_headers, "Number of extra headers in each request and response", "N" },
+	{ "body-size", 'b', 0, G_OPTION_ARG_INT, &body_size, "Size of each response body, in bytes", "BYTES" },
+	{ NULL }
+};
+
+/* Generate a text trace of n_entries GET requests for /bench/<i>, each answered with a 200 response with a body of body_size bytes. */
+static GBytes *
+generate_trace (void)
+{
+	GString *trace;
+	gsize length;
+	gint i, j;
+
+	trace = g_string_new (NULL);
+
+	for (i = 0; i < n_entries; i++) {
+		g_string_append_printf (trace, "> GET /bench/%d HTTP/1.1\n", i);
+		g_string_append (trace, "> Host: example.com\n");
+
+		for (j = 0; j < n_headers; j++) {
+			g_string_append_printf (trace, "> X-Bench-Header-%d: request value %d\n", j, j);
+		}
+
+		g_string_append (trace, "> \n  \n");
+		g_string_append (trace, "< HTTP/1.1 200 OK\n");
+		g_string_append_printf (trace, "< Content-Length: %d\n", body_size);
+
+		for (j = 0; j < n_headers; j++) {
+			g_string_append_printf (trace, "< X-Bench-Header-%d: response value %d\n", j, j);
+		}
+
+		g_string_append (trace, "< \n");
+
+		/* The parser appends a newline to each body line, which makes up the last byte of the body. */
+		if (body_size > 0) {
+			g_string_append (trace, "< ");
+			for (j = 0; j < body_size - 1; j++) {
+				g_string_append_c (trace, 'a' + j % 26);
+			}
+			g_string_append_c (trace, '\n');
+		}
+
+		g_string_append (trace, "  \n");
+	}
+
+	length = trace->len;
+
+	return g_bytes_new_take (g_string_free (trace, FALSE), length);
+}
+
+/* Get the resident set size of the process, in bytes, or -1 if it isn't known. */
+static gint64
+get_resident_memory (void)
+{
+	gchar *contents = NULL;
+	const gchar *line;
+	gint64 rss = -1;
+
+	if (g_file_get_contents ("/proc/self/status", &contents, NULL, NULL) == FALSE) {
+		return -1;
+	}
+
+	line = strstr (contents, "VmRSS:");
+	if (line != NULL) {
+		rss = g_ascii_strtoll (line + strlen ("VmRSS:"), NULL, 10) * 1024;
+	}
+
+	g_free (contents);
+
+	return rss;
+}
+
+static void
+print_result (const gchar *benchmark, gint64 elapsed, guint n_items, gsize n_bytes, gint64 memory)
+{
+	gdouble seconds = elapsed / (gdouble) G_USEC_PER_SEC;
+
+	g_print ("{\"benchmark\": \"%s\", \"entries\": %d, \"headers\": %d, \"body_size\": %d, \"seconds\": %.6f, "
+	         "\"items_per_second\": %.1f, \"bytes_per_second\": %.1f",
+	         benchmark, n_entries, n_headers, body_size, seconds,
+	         (seconds > 0.0) ? n_items / seconds : 0.0, (seconds > 0.0) ? n_bytes / seconds : 0.0);
+
+	if (memory >= 0) {
+		g_print (", \"memory_bytes\": %" G_GINT64_FORMAT, memory);
+	}
+
+	g_print ("}\n");
+}
+
+/* Parse every message in @bytes, returning the time taken in microseconds. */
+static gint64
+time_parse (GBytes *bytes, SoupURI *base_uri)
+{
+	UhmTrace *trace;
+	SoupMessage *message;
+	gsize offset = 0;
+	guint n_messages = 0;
+	gint64 start_time, elapsed;
+	GError *error = NULL;
+
+	start_time = g_get_monotonic_time ();
+
+	trace = uhm_trace_new_from_bytes (bytes, &error);
+	g_assert_no_error (error);
+
+	while ((message = uhm_trace_next_message (trace, &offset, base_uri)) != NULL) {
+		n_messages++;
+		g_object_unref (message);
+	}
+
+	elapsed = g_get_monotonic_time () - start_time;
+
+	g_assert_cmpuint (n_messages, ==, n_entries);
+	uhm_trace_unref (trace);
+
+	return elapsed;
+}
+
+/* Parse every message in @bytes using uhm_trace_load_all(), returning the time taken in microseconds. */
+static gint64
+time_load_all (GBytes *bytes, SoupURI *base_uri)
+{
+	UhmTrace *trace;
+	GPtrArray *messages;
+	gsize offset = 0;
+	gint64 start_time, elapsed;
+	GError *error = NULL;
+
+	start_time = g_get_monotonic_time ();
+
+	trace = uhm_trace_new_from_bytes (bytes, &error);
+	g_assert_no_error (error);
+
+	messages = uhm_trace_load_all (trace, &offset, base_uri, NULL, &error);
+	g_assert_no_error (error);
+
+	elapsed = g_get_monotonic_time () - start_time;
+
+	g_assert_cmpuint (messages->len, ==, n_entries);
+	g_ptr_array_unref (messages);
+	uhm_trace_unref (trace);
+
+	return elapsed;
+}
+
+static GBytes *
+compile_trace (GBytes *text_bytes)
+{
+	UhmTrace *trace;
+	GOutputStream *output_stream;
+	GBytes *bytes;
+	GError *error = NULL;
+
+	trace = uhm_trace_new_from_bytes (text_bytes, &error);
+	g_assert_no_error (error);
+
+	output_stream = g_memory_output_stream_new (NULL, 0, g_realloc, g_free);
+	uhm_trace_compile (trace, output_stream, NULL, &error);
+	g_assert_no_error (error);
+	g_output_stream_close (output_stream, NULL, &error);
+	g_assert_no_error (error);
+
+	bytes = g_bytes_new (g_memory_output_stream_get_data (G_MEMORY_OUTPUT_STREAM (output_stream)),
+	                     g_memory_output_stream_get_data_size (G_MEMORY_OUTPUT_STREAM (output_stream)));
+
+	g_object_unref (output_stream);
+	uhm_trace_unref (trace);
+
+	return bytes;
+}
+
+static void
+bench_requests (UhmServer *server)
+{
+	SoupSession *session;
+	SoupURI *uri;
+	gint i;
+	gint64 start_time, elapsed;
+
+	session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+
+	uri = soup_uri_new ("https://example.com/");
+	soup_uri_set_port (uri, uhm_server_get_port (server));
+
+	start_time = g_get_monotonic_time ();
+
+	for (i = 0; i < n_entries; i++) {
+		SoupMessage *message;
+		gchar *path;
+
+		path = g_strdup_printf ("/bench/%d", i);
+		soup_uri_set_path (uri, path);
+		g_free (path);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+		g_assert_cmpint (message->response_body->length, ==, body_size);
+		g_object_unref (message);
+	}
+
+	elapsed = g_get_monotonic_time () - start_time;
+
+	print_result ("requests", elapsed, n_entries, (gsize) n_entries * body_size, -1);
+
+	soup_uri_free (uri);
+	g_object_unref (session);
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GBytes *text_bytes, *binary_bytes;
+	SoupURI *base_uri;
+	UhmServer *server;
+	GFile *trace_file;
+	GFileIOStream *io_stream;
+	gint64 start_time, elapsed, memory_before;
+	GError *error = NULL;
+
+	setlocale (LC_ALL, "");
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	context = g_option_context_new (NULL);
+	g_option_context_set_summary (context, "Benchmark the uhttpmock trace parser and request path.");
+	g_option_context_add_main_entries (context, option_entries, NULL);
+
+	if (g_option_context_parse (context, &argc, &argv, &error) == FALSE) {
+		g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+		g_error_free (error);
+		g_option_context_free (context);
+
+		return 1;
+	} else if (n_entries < 1 || n_headers < 0 || body_size < 1) {
+		g_printerr ("%s: There must be at least one entry, and bodies must be at least one byte.\n", g_get_prgname ());
+		g_option_context_free (context);
+
+		return 1;
+	}
+
+	g_option_context_free (context);
+
+	/* Parsing. */
+	text_bytes = generate_trace ();
+	binary_bytes = compile_trace (text_bytes);
+	base_uri = soup_uri_new ("https://127.0.0.1:443");
+
+	print_result ("parse-text", time_parse (text_bytes, base_uri), n_entries, g_bytes_get_size (text_bytes), -1);
+	print_result ("parse-binary", time_parse (binary_bytes, base_uri), n_entries, g_bytes_get_size (binary_bytes), -1);
+	print_result ("parse-all-text", time_load_all (text_bytes, base_uri), n_entries, g_bytes_get_size (text_bytes), -1);
+	print_result ("parse-all-binary", time_load_all (binary_bytes, base_uri), n_entries, g_bytes_get_size (binary_bytes), -1);
+
+	soup_uri_free (base_uri);
+	g_bytes_unref (binary_bytes);
+
+	/* Loading. */
+	trace_file = g_file_new_tmp ("uhttpmock-bench-XXXXXX", &io_stream, &error);
+	g_assert_no_error (error);
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (io_stream)), g_bytes_get_data (text_bytes, NULL),
+	                           g_bytes_get_size (text_bytes), NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_io_stream_close (G_IO_STREAM (io_stream), NULL, &error);
+	g_assert_no_error (error);
+	g_object_unref (io_stream);
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_preloading (server, TRUE);
+	uhm_server_set_default_tls_certificate (server);
+	uhm_server_run (server);
+	uhm_resolver_add_A (uhm_server_get_resolver (server), "example.com", uhm_server_get_address (server));
+
+	memory_before = get_resident_memory ();
+	start_time = g_get_monotonic_time ();
+
+	uhm_server_load_trace (server, trace_file, NULL, &error);
+	g_assert_no_error (error);
+
+	elapsed = g_get_monotonic_time () - start_time;
+
+	print_result ("load", elapsed, n_entries, g_bytes_get_size (text_bytes),
+	              (memory_before >= 0) ? get_resident_memory () - memory_before : -1);
+
+	/* Requests. */
+	bench_requests (server);
+
+	uhm_server_stop (server);
+	g_object_unref (server);
+
+	g_file_delete (trace_file, NULL, NULL);
+	g_object_unref (trace_file);
+	g_bytes_unref (text_bytes);
+
+	return 0;
+}
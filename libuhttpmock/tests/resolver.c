@@ -89,6 +89,101 @@ test_resolver_lookup_by_name (void)
 	g_object_unref (resolver);
 }
 
+/* Add several A records for one host name, and check they're all returned in order, and that host names are matched case-insensitively. */
+static void
+test_resolver_lookup_by_name_multiple (void)
+{
+	UhmResolver *resolver;
+	GError *child_error = NULL;
+	GList/*<GInetAddress>*/ *addresses = NULL;
+	gchar *address_string;
+
+	resolver = uhm_resolver_new ();
+
+	g_assert (uhm_resolver_add_A (resolver, "example.com", "127.0.0.1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "Example.COM", "10.0.0.1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "test.com", "10.0.0.2") == TRUE);
+
+	/* Invalid addresses should be rejected. */
+	g_assert (uhm_resolver_add_A (resolver, "example.com", "not an address") == FALSE);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "EXAMPLE.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (g_list_length (addresses), ==, 2);
+
+	address_string = g_inet_address_to_string (G_INET_ADDRESS (addresses->data));
+	g_assert_cmpstr (address_string, ==, "127.0.0.1");
+	g_free (address_string);
+
+	address_string = g_inet_address_to_string (G_INET_ADDRESS (addresses->next->data));
+	g_assert_cmpstr (address_string, ==, "10.0.0.1");
+	g_free (address_string);
+
+	g_resolver_free_addresses (addresses);
+
+	g_object_unref (resolver);
+}
+
+/* Add wildcard A records and check they match subdomains of any depth, with exact records and longer suffixes taking precedence. */
+static void
+test_resolver_lookup_by_name_wildcard (void)
+{
+	UhmResolver *resolver;
+	GError *child_error = NULL;
+	GList/*<GInetAddress>*/ *addresses = NULL;
+
+	resolver = uhm_resolver_new ();
+
+	g_assert (uhm_resolver_add_A (resolver, "*.example.com", "127.0.0.1") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "*.storage.example.com", "127.0.0.2") == TRUE);
+	g_assert (uhm_resolver_add_A (resolver, "special.storage.example.com", "127.0.0.3") == TRUE);
+
+	/* Invalid wildcards should be rejected. */
+	g_assert (uhm_resolver_add_A (resolver, "*.", "127.0.0.1") == FALSE);
+	g_assert (uhm_resolver_add_A (resolver, "foo.*.example.com", "127.0.0.1") == FALSE);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "www.example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "127.0.0.1");
+	g_resolver_free_addresses (addresses);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "a.b.Example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "127.0.0.1");
+	g_resolver_free_addresses (addresses);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "bucket-123.storage.example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "127.0.0.2");
+	g_resolver_free_addresses (addresses);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "special.storage.example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "127.0.0.3");
+	g_resolver_free_addresses (addresses);
+
+	/* The wildcard doesn't match the domain itself, or other domains. */
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "example.com", NULL, &child_error);
+	g_assert_error (child_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (addresses == NULL);
+	g_clear_error (&child_error);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "www.example.org", NULL, &child_error);
+	g_assert_error (child_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (addresses == NULL);
+	g_clear_error (&child_error);
+
+	/* Reset and check the wildcards have gone. */
+	uhm_resolver_reset (resolver);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (resolver), "www.example.com", NULL, &child_error);
+	g_assert_error (child_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (addresses == NULL);
+	g_clear_error (&child_error);
+
+	g_object_unref (resolver);
+}
+
 static void
 resolver_lookup_by_name_async_success_cb (GObject *source_object, GAsyncResult *result, AsyncData *data)
 {
@@ -117,6 +212,20 @@ resolver_lookup_by_name_async_failure_cb (GObject *source_object, GAsyncResult *
 	g_main_loop_quit (data->main_loop);
 }
 
+static void
+resolver_lookup_by_name_async_cancelled_cb (GObject *source_object, GAsyncResult *result, AsyncData *data)
+{
+	GList/*<GInetAddress>*/ *addresses;
+	GError *child_error = NULL;
+
+	addresses = g_resolver_lookup_by_name_finish (G_RESOLVER (data->resolver), result, &child_error);
+	g_assert_error (child_error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert (addresses == NULL);
+	g_clear_error (&child_error);
+
+	g_main_loop_quit (data->main_loop);
+}
+
 /* Add an A record and asynchronously query for existent and non-existent ones. Test that resolution fails after resetting the resolver. */
 static void
 test_resolver_lookup_by_name_async (void)
@@ -252,6 +361,97 @@ test_resolver_lookup_service_async (void)
 	g_main_loop_unref (data.main_loop);
 }
 
+/* Cancel an asynchronous lookup before it completes and check the cancellation is reported, even though the record exists. */
+static void
+test_resolver_lookup_by_name_async_cancelled (void)
+{
+	AsyncData data;
+	GCancellable *cancellable;
+
+	data.main_loop = g_main_loop_new (NULL, FALSE);
+	data.resolver = uhm_resolver_new ();
+	cancellable = g_cancellable_new ();
+
+	uhm_resolver_add_A (data.resolver, "example.com", "127.0.0.1");
+
+	g_cancellable_cancel (cancellable);
+	g_resolver_lookup_by_name_async (G_RESOLVER (data.resolver), "example.com", cancellable,
+	                                 (GAsyncReadyCallback) resolver_lookup_by_name_async_cancelled_cb, &data);
+	g_main_loop_run (data.main_loop);
+
+	g_object_unref (cancellable);
+	g_object_unref (data.resolver);
+	g_main_loop_unref (data.main_loop);
+}
+
+/* Add SRV records and query for them as generic DNS records. Other types of record are never found. */
+static void
+test_resolver_lookup_records (void)
+{
+	UhmResolver *resolver;
+	GError *child_error = NULL;
+	GList/*<GVariant>*/ *records = NULL;
+	guint16 priority, weight, port;
+	const gchar *target;
+
+	resolver = uhm_resolver_new ();
+
+	uhm_resolver_add_SRV (resolver, "ldap", "tcp", "example.com", "127.0.0.5", 666);
+
+	records = g_resolver_lookup_records (G_RESOLVER (resolver), "_ldap._tcp.example.com", G_RESOLVER_RECORD_SRV, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (g_list_length (records), ==, 1);
+
+	g_variant_get (records->data, "(qqq&s)", &priority, &weight, &port, &target);
+	g_assert_cmpuint (port, ==, 666);
+	g_assert_cmpstr (target, ==, "127.0.0.5");
+
+	g_list_free_full (records, (GDestroyNotify) g_variant_unref);
+
+	records = g_resolver_lookup_records (G_RESOLVER (resolver), "_ldap._tcp.example.com", G_RESOLVER_RECORD_MX, NULL, &child_error);
+	g_assert_error (child_error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND);
+	g_assert (records == NULL);
+	g_clear_error (&child_error);
+
+	g_object_unref (resolver);
+}
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+/* Add IPv4 and IPv6 addresses for a host name and check that lookups restricted to one family only return addresses in that family. */
+static void
+test_resolver_lookup_by_name_with_flags (void)
+{
+	UhmResolver *resolver;
+	GError *child_error = NULL;
+	GList/*<GInetAddress>*/ *addresses = NULL;
+
+	resolver = uhm_resolver_new ();
+
+	uhm_resolver_add_A (resolver, "example.com", "127.0.0.1");
+	uhm_resolver_add_A (resolver, "example.com", "::1");
+
+	addresses = g_resolver_lookup_by_name_with_flags (G_RESOLVER (resolver), "example.com", G_RESOLVER_NAME_LOOKUP_FLAGS_IPV4_ONLY, NULL,
+	                                                  &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "127.0.0.1");
+	g_resolver_free_addresses (addresses);
+
+	addresses = g_resolver_lookup_by_name_with_flags (G_RESOLVER (resolver), "example.com", G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY, NULL,
+	                                                  &child_error);
+	g_assert_no_error (child_error);
+	assert_single_address_result (addresses, "::1");
+	g_resolver_free_addresses (addresses);
+
+	addresses = g_resolver_lookup_by_name_with_flags (G_RESOLVER (resolver), "example.com", G_RESOLVER_NAME_LOOKUP_FLAGS_DEFAULT, NULL,
+	                                                  &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (g_list_length (addresses), ==, 2);
+	g_resolver_free_addresses (addresses);
+
+	g_object_unref (resolver);
+}
+#endif /* GLib ≥ 2.60.0 */
+
 int
 main (int argc, char *argv[])
 {
@@ -267,8 +467,15 @@ main (int argc, char *argv[])
 
 	g_test_add_func ("/resolver/lookup-by-name", test_resolver_lookup_by_name);
 	g_test_add_func ("/resolver/lookup-by-name/async", test_resolver_lookup_by_name_async);
+	g_test_add_func ("/resolver/lookup-by-name/async/cancelled", test_resolver_lookup_by_name_async_cancelled);
+	g_test_add_func ("/resolver/lookup-by-name/multiple", test_resolver_lookup_by_name_multiple);
+	g_test_add_func ("/resolver/lookup-by-name/wildcard", test_resolver_lookup_by_name_wildcard);
+#if GLIB_CHECK_VERSION (2, 60, 0)
+	g_test_add_func ("/resolver/lookup-by-name/with-flags", test_resolver_lookup_by_name_with_flags);
+#endif
 	g_test_add_func ("/resolver/lookup-service", test_resolver_lookup_service);
 	g_test_add_func ("/resolver/lookup-service/async", test_resolver_lookup_service_async);
+	g_test_add_func ("/resolver/lookup-records", test_resolver_lookup_records);
 
 	return g_test_run ();
 }
@@ -17,10 +17,18 @@
  * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <locale.h>
 #include <string.h>
 #include <libsoup/soup.h>
+/* The server only listens on Unix sockets if both of these are available; see #UhmServer:unix-socket-path. */
+#if defined(HAVE_LIBSOUP_2_47_3) && defined(HAVE_GIO_UNIX)
+#define ENABLE_UNIX_SOCKET 1
+#include <gio/gunixsocketaddress.h>
+#endif
 
 #include "uhm-server.h"
 
@@ -239,6 +247,357 @@ test_server_properties_enable_logging (void)
 	g_object_unref (server);
 }
 
+/* Test getting and setting UhmServer:enable-preloading property. */
+static void
+test_server_properties_enable_preloading (void)
+{
+	UhmServer *server;
+	gboolean enable_preloading;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-preloading", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_preloading (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-preloading", &enable_preloading, NULL);
+	g_assert (enable_preloading == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_preloading (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_preloading (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-preloading", &enable_preloading, NULL);
+	g_assert (enable_preloading == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-preloading", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_preloading (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-out-of-order-matching property. */
+static void
+test_server_properties_enable_out_of_order_matching (void)
+{
+	UhmServer *server;
+	gboolean enable_out_of_order_matching;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-out-of-order-matching", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_out_of_order_matching (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-out-of-order-matching", &enable_out_of_order_matching, NULL);
+	g_assert (enable_out_of_order_matching == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_out_of_order_matching (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_out_of_order_matching (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-out-of-order-matching", &enable_out_of_order_matching, NULL);
+	g_assert (enable_out_of_order_matching == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-out-of-order-matching", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_out_of_order_matching (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:n-threads property. */
+static void
+test_server_properties_n_threads (void)
+{
+	UhmServer *server;
+	guint n_threads;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::n-threads", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert_cmpuint (uhm_server_get_n_threads (server), ==, 1);
+	g_object_get (G_OBJECT (server), "n-threads", &n_threads, NULL);
+	g_assert_cmpuint (n_threads, ==, 1);
+
+	/* Change the value. */
+	uhm_server_set_n_threads (server, 4);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpuint (uhm_server_get_n_threads (server), ==, 4);
+	g_object_get (G_OBJECT (server), "n-threads", &n_threads, NULL);
+	g_assert_cmpuint (n_threads, ==, 4);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "n-threads", 1, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert_cmpuint (uhm_server_get_n_threads (server), ==, 1);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-background-logging property. */
+static void
+test_server_properties_enable_background_logging (void)
+{
+	UhmServer *server;
+	gboolean enable_background_logging;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-background-logging", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_background_logging (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-background-logging", &enable_background_logging, NULL);
+	g_assert (enable_background_logging == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_background_logging (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_background_logging (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-background-logging", &enable_background_logging, NULL);
+	g_assert (enable_background_logging == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-background-logging", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_background_logging (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:enable-replay-timing property. */
+static void
+test_server_properties_enable_replay_timing (void)
+{
+	UhmServer *server;
+	gboolean enable_replay_timing;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-replay-timing", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_replay_timing (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-replay-timing", &enable_replay_timing, NULL);
+	g_assert (enable_replay_timing == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_replay_timing (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_replay_timing (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-replay-timing", &enable_replay_timing, NULL);
+	g_assert (enable_replay_timing == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-replay-timing", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_replay_timing (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:replay-speed property. */
+static void
+test_server_properties_replay_speed (void)
+{
+	UhmServer *server;
+	gdouble replay_speed;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::replay-speed", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert_cmpfloat (uhm_server_get_replay_speed (server), ==, 1.0);
+	g_object_get (G_OBJECT (server), "replay-speed", &replay_speed, NULL);
+	g_assert_cmpfloat (replay_speed, ==, 1.0);
+
+	/* Change the value. */
+	uhm_server_set_replay_speed (server, 10.0);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpfloat (uhm_server_get_replay_speed (server), ==, 10.0);
+	g_object_get (G_OBJECT (server), "replay-speed", &replay_speed, NULL);
+	g_assert_cmpfloat (replay_speed, ==, 10.0);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "replay-speed", 1.0, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert_cmpfloat (uhm_server_get_replay_speed (server), ==, 1.0);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting UhmServer:bandwidth-limit property. */
+static void
+test_server_properties_bandwidth_limit (void)
+{
+	UhmServer *server;
+	guint bandwidth_limit;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::bandwidth-limit", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert_cmpuint (uhm_server_get_bandwidth_limit (server), ==, 0);
+	g_object_get (G_OBJECT (server), "bandwidth-limit", &bandwidth_limit, NULL);
+	g_assert_cmpuint (bandwidth_limit, ==, 0);
+
+	/* Change the value. */
+	uhm_server_set_bandwidth_limit (server, 1024);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpuint (uhm_server_get_bandwidth_limit (server), ==, 1024);
+	g_object_get (G_OBJECT (server), "bandwidth-limit", &bandwidth_limit, NULL);
+	g_assert_cmpuint (bandwidth_limit, ==, 1024);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "bandwidth-limit", 0, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert_cmpuint (uhm_server_get_bandwidth_limit (server), ==, 0);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting the UhmServer:enable-dual-stack property. */
+static void
+test_server_properties_enable_dual_stack (void)
+{
+	UhmServer *server;
+	gboolean enable_dual_stack;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::enable-dual-stack", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_enable_dual_stack (server) == FALSE);
+	g_object_get (G_OBJECT (server), "enable-dual-stack", &enable_dual_stack, NULL);
+	g_assert (enable_dual_stack == FALSE);
+
+	/* Toggle the value. */
+	uhm_server_set_enable_dual_stack (server, TRUE);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert (uhm_server_get_enable_dual_stack (server) == TRUE);
+	g_object_get (G_OBJECT (server), "enable-dual-stack", &enable_dual_stack, NULL);
+	g_assert (enable_dual_stack == TRUE);
+
+	/* Toggle the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "enable-dual-stack", FALSE, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_enable_dual_stack (server) == FALSE);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting the UhmServer:transport-mode property. */
+static void
+test_server_properties_transport_mode (void)
+{
+	UhmServer *server;
+	UhmServerTransportMode transport_mode;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::transport-mode", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert_cmpint (uhm_server_get_transport_mode (server), ==, UHM_SERVER_TRANSPORT_MODE_HTTPS);
+	g_object_get (G_OBJECT (server), "transport-mode", &transport_mode, NULL);
+	g_assert_cmpint (transport_mode, ==, UHM_SERVER_TRANSPORT_MODE_HTTPS);
+
+	/* Change the value. */
+	uhm_server_set_transport_mode (server, UHM_SERVER_TRANSPORT_MODE_HTTP);
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpint (uhm_server_get_transport_mode (server), ==, UHM_SERVER_TRANSPORT_MODE_HTTP);
+	g_object_get (G_OBJECT (server), "transport-mode", &transport_mode, NULL);
+	g_assert_cmpint (transport_mode, ==, UHM_SERVER_TRANSPORT_MODE_HTTP);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "transport-mode", UHM_SERVER_TRANSPORT_MODE_BOTH, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert_cmpint (uhm_server_get_transport_mode (server), ==, UHM_SERVER_TRANSPORT_MODE_BOTH);
+
+	g_object_unref (server);
+}
+
+/* Test getting and setting the UhmServer:unix-socket-path property. */
+static void
+test_server_properties_unix_socket_path (void)
+{
+	UhmServer *server;
+	gchar *unix_socket_path;
+	guint counter;
+
+	server = uhm_server_new ();
+
+	counter = 0;
+	g_signal_connect (G_OBJECT (server), "notify::unix-socket-path", (GCallback) notify_emitted_cb, &counter);
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_unix_socket_path (server) == NULL);
+	g_object_get (G_OBJECT (server), "unix-socket-path", &unix_socket_path, NULL);
+	g_assert (unix_socket_path == NULL);
+
+	/* Change the value. */
+	uhm_server_set_unix_socket_path (server, "@uhttpmock-test");
+	g_assert_cmpuint (counter, ==, 1);
+
+	/* Check the new value can be retrieved via the getter and as a property. */
+	g_assert_cmpstr (uhm_server_get_unix_socket_path (server), ==, "@uhttpmock-test");
+	g_object_get (G_OBJECT (server), "unix-socket-path", &unix_socket_path, NULL);
+	g_assert_cmpstr (unix_socket_path, ==, "@uhttpmock-test");
+	g_free (unix_socket_path);
+
+	/* Change the value again, this time using the GObject setter. */
+	g_object_set (G_OBJECT (server), "unix-socket-path", NULL, NULL);
+	g_assert_cmpuint (counter, ==, 2);
+	g_assert (uhm_server_get_unix_socket_path (server) == NULL);
+
+	g_object_unref (server);
+}
+
 /* Test getting the UhmServer:address property. */
 static void
 test_server_properties_address (void)
@@ -258,6 +617,25 @@ test_server_properties_address (void)
 	g_object_unref (server);
 }
 
+/* Test getting the UhmServer:http-port property. */
+static void
+test_server_properties_http_port (void)
+{
+	UhmServer *server;
+	guint http_port;
+
+	server = uhm_server_new ();
+
+	/* Check the default value. */
+	g_assert (uhm_server_get_http_port (server) == 0);
+	g_object_get (G_OBJECT (server), "http-port", &http_port, NULL);
+	g_assert (http_port == 0);
+
+	/* The port is set when the server is taken online, which is tested separately. */
+
+	g_object_unref (server);
+}
+
 /* Test getting the UhmServer:port property. */
 static void
 test_server_properties_port (void)
@@ -349,44 +727,175 @@ test_server_properties_tls_certificate (void)
 	g_object_unref (server);
 }
 
-typedef struct {
-	UhmServer *server;
-	SoupSession *session;
-	GMainLoop *main_loop;
-} LoggingData;
-
+/* Test that the default TLS certificate is shared between servers, rather than being constructed for each of them. */
 static void
-set_up_logging (LoggingData *data, gconstpointer user_data)
+test_server_default_tls_certificate (void)
 {
-	UhmResolver *resolver;
-
-	data->server = uhm_server_new ();
-	data->main_loop = g_main_loop_new (NULL, FALSE);
-
-	uhm_server_set_enable_logging (data->server, TRUE);
-	uhm_server_set_enable_online (data->server, TRUE);
-	uhm_server_set_default_tls_certificate (data->server);
+	UhmServer *server1, *server2;
+	GTlsCertificate *tls_certificate1, *tls_certificate2;
 
-	if (user_data != NULL) {
-		g_signal_connect (G_OBJECT (data->server), "handle-message", (GCallback) user_data, NULL);
-	}
+	server1 = uhm_server_new ();
+	server2 = uhm_server_new ();
 
-	uhm_server_run (data->server);
+	tls_certificate1 = uhm_server_set_default_tls_certificate (server1);
+	tls_certificate2 = uhm_server_set_default_tls_certificate (server2);
+	g_assert (G_IS_TLS_CERTIFICATE (tls_certificate1));
+	g_assert (tls_certificate1 == tls_certificate2);
 
-	resolver = uhm_server_get_resolver (data->server);
-	uhm_resolver_add_A (resolver, "example.com", uhm_server_get_address (data->server));
+	/* The certificate should stay alive after the servers are destroyed. */
+	g_object_unref (server2);
+	g_object_unref (server1);
 
-	data->session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+	server1 = uhm_server_new ();
+	g_assert (uhm_server_set_default_tls_certificate (server1) == tls_certificate1);
+	g_object_unref (server1);
 }
 
+/* Test that lines passed to uhm_server_received_message_chunk_with_direction() are logged verbatim, including any nul bytes. */
 static void
-tear_down_logging (LoggingData *data, gconstpointer user_data)
+test_server_received_message_chunk_nul_bytes (void)
 {
-	g_object_unref (data->session);
-	uhm_server_stop (data->server);
+	UhmServer *server;
+	GFile *trace_file;
+	GFileIOStream *io_stream;
+	gchar *contents;
+	gsize length;
+	GError *child_error = NULL;
+	const gchar expected_contents[] =
+		"> GET /test-file HTTP/1.1\n"
+		"> \n"
+		"  \n"
+		"< HTTP/1.1 200 OK\n"
+		"< \n"
+		"< a\0b\n"
+		"  \n";
+
+	trace_file = g_file_new_tmp ("uhttpmock-XXXXXX", &io_stream, &child_error);
+	g_assert_no_error (child_error);
+	g_object_unref (io_stream);
 
-	g_main_loop_unref (data->main_loop);
-	g_object_unref (data->server);
+	server = uhm_server_new ();
+	uhm_server_set_enable_logging (server, TRUE);
+	uhm_server_set_enable_online (server, TRUE);
+
+	uhm_server_start_trace_full (server, trace_file, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_received_message_chunk_with_direction (server, '>', "GET /test-file HTTP/1.1", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '>', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, ' ', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk (server, "< HTTP/1.1 200 OK", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '<', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '<', "a\0b", 3, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, ' ', "", 0, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_end_trace (server);
+
+	/* Check the trace file. */
+	g_file_load_contents (trace_file, NULL, &contents, &length, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (length, ==, sizeof (expected_contents) - 1);
+	g_assert (memcmp (contents, expected_contents, length) == 0);
+	g_free (contents);
+
+	g_file_delete (trace_file, NULL, NULL);
+
+	g_object_unref (server);
+	g_object_unref (trace_file);
+}
+
+/* Test that buffered trace data is written out if the server is disposed of while logging, without uhm_server_end_trace() being called. */
+static void
+test_server_received_message_chunk_dispose (void)
+{
+	UhmServer *server;
+	GFile *trace_file;
+	GFileIOStream *io_stream;
+	gchar *contents;
+	gsize length;
+	GError *child_error = NULL;
+	const gchar expected_contents[] =
+		"> GET /test-file HTTP/1.1\n"
+		"> \n"
+		"  \n";
+
+	trace_file = g_file_new_tmp ("uhttpmock-XXXXXX", &io_stream, &child_error);
+	g_assert_no_error (child_error);
+	g_object_unref (io_stream);
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_logging (server, TRUE);
+	uhm_server_set_enable_online (server, TRUE);
+
+	uhm_server_start_trace_full (server, trace_file, &child_error);
+	g_assert_no_error (child_error);
+
+	uhm_server_received_message_chunk_with_direction (server, '>', "GET /test-file HTTP/1.1", -1, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, '>', "", 0, &child_error);
+	g_assert_no_error (child_error);
+	uhm_server_received_message_chunk_with_direction (server, ' ', "", 0, &child_error);
+	g_assert_no_error (child_error);
+
+	g_object_unref (server);
+
+	/* Check the trace file. */
+	g_file_load_contents (trace_file, NULL, &contents, &length, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpuint (length, ==, sizeof (expected_contents) - 1);
+	g_assert (memcmp (contents, expected_contents, length) == 0);
+	g_free (contents);
+
+	g_file_delete (trace_file, NULL, NULL);
+
+	g_object_unref (trace_file);
+}
+
+typedef struct {
+	UhmServer *server;
+	SoupSession *session;
+	GMainLoop *main_loop;
+} LoggingData;
+
+static void
+set_up_logging (LoggingData *data, gconstpointer user_data)
+{
+	UhmResolver *resolver;
+
+	data->server = uhm_server_new ();
+	data->main_loop = g_main_loop_new (NULL, FALSE);
+
+	uhm_server_set_enable_logging (data->server, TRUE);
+	uhm_server_set_enable_online (data->server, TRUE);
+	uhm_server_set_default_tls_certificate (data->server);
+
+	if (user_data != NULL) {
+		g_signal_connect (G_OBJECT (data->server), "handle-message", (GCallback) user_data, NULL);
+	}
+
+	uhm_server_run (data->server);
+
+	resolver = uhm_server_get_resolver (data->server);
+	uhm_resolver_add_A (resolver, "example.com", uhm_server_get_address (data->server));
+
+	data->session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+}
+
+static void
+tear_down_logging (LoggingData *data, gconstpointer user_data)
+{
+	g_object_unref (data->session);
+	uhm_server_stop (data->server);
+
+	g_main_loop_unref (data->main_loop);
+	g_object_unref (data->server);
 }
 
 static gboolean
@@ -499,6 +1008,142 @@ test_server_logging_trace_success_normal (LoggingData *data, gconstpointer user_
 	g_main_loop_run (data->main_loop);
 }
 
+static gboolean
+server_logging_trace_success_replay_timing_cb (LoggingData *data)
+{
+	SoupMessage *message;
+	SoupURI *uri;
+	gint64 start_time;
+
+	/* Load the trace, in which the response was recorded two seconds after the request. Replay it at ten times the speed. */
+	uhm_server_set_enable_replay_timing (data->server, TRUE);
+	uhm_server_set_replay_speed (data->server, 10.0);
+	assert_server_load_trace (data->server, "server_logging_trace_success_replay-timing");
+
+	/* Dummy unit test code. */
+	uri = soup_uri_new ("https://example.com/test-file");
+	soup_uri_set_port (uri, uhm_server_get_port (data->server));
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	soup_uri_free (uri);
+
+	start_time = g_get_monotonic_time ();
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_OK);
+	g_assert_cmpint (g_get_monotonic_time () - start_time, >=, 200 * 1000);
+
+	g_object_unref (message);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode delaying a response by the latency recorded in the trace. */
+static void
+test_server_logging_trace_success_replay_timing (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_replay_timing_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_bandwidth_limit_cb (LoggingData *data)
+{
+	SoupMessage *message;
+	SoupURI *uri;
+	gint64 start_time;
+
+	/* Limit the server to 100 bytes per second, so the body of the response (over 30 bytes) takes at least 300ms to arrive. */
+	uhm_server_set_bandwidth_limit (data->server, 100);
+	assert_server_load_trace (data->server, "server_logging_trace_success_normal");
+
+	/* Dummy unit test code. */
+	uri = soup_uri_new ("https://example.com/test-file");
+	soup_uri_set_port (uri, uhm_server_get_port (data->server));
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	soup_uri_free (uri);
+
+	start_time = g_get_monotonic_time ();
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_NOT_FOUND);
+	g_assert_cmpint (g_get_monotonic_time () - start_time, >=, 300 * 1000);
+
+	/* Check the whole body arrived. */
+	g_assert (g_str_has_prefix (message->response_body->data, "The document was not found. Ha.") == TRUE);
+
+	g_object_unref (message);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode trickling out a response under a bandwidth limit. */
+static void
+test_server_logging_trace_success_bandwidth_limit (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_bandwidth_limit_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_statistics_cb (LoggingData *data)
+{
+	SoupMessage *message;
+	SoupURI *uri;
+	UhmServerStatistics *statistics;
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_normal");
+
+	/* Check the initial statistics. */
+	statistics = uhm_server_get_statistics (data->server);
+	g_assert_cmpuint (statistics->n_requests, ==, 0);
+	g_assert_cmpuint (uhm_server_statistics_get_latency (statistics, UHM_SERVER_PHASE_TOTAL, 100.0), ==, 0);
+	uhm_server_statistics_free (statistics);
+
+	/* Dummy unit test code. Send one expected request and one unexpected one. */
+	uri = soup_uri_new ("https://example.com/test-file");
+	soup_uri_set_port (uri, uhm_server_get_port (data->server));
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_NOT_FOUND);
+	g_object_unref (message);
+
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_BAD_REQUEST);
+	g_object_unref (message);
+
+	soup_uri_free (uri);
+
+	/* Check the statistics have been updated. */
+	g_object_get (G_OBJECT (data->server), "statistics", &statistics, NULL);
+	g_assert_cmpuint (statistics->n_requests, ==, 2);
+	g_assert_cmpuint (statistics->n_unexpected_requests, ==, 1);
+	g_assert_cmpuint (statistics->bytes_received, ==, 0);
+	g_assert_cmpuint (statistics->bytes_sent, >, 0);
+	g_assert_cmpuint (uhm_server_statistics_get_latency (statistics, UHM_SERVER_PHASE_TOTAL, 100.0), >=,
+	                  uhm_server_statistics_get_latency (statistics, UHM_SERVER_PHASE_TOTAL, 50.0));
+	uhm_server_statistics_free (statistics);
+
+	/* And reset them. */
+	uhm_server_reset_statistics (data->server);
+
+	statistics = uhm_server_get_statistics (data->server);
+	g_assert_cmpuint (statistics->n_requests, ==, 0);
+	g_assert_cmpuint (statistics->bytes_sent, ==, 0);
+	uhm_server_statistics_free (statistics);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test the statistics recorded by a server in onling/logging mode. */
+static void
+test_server_logging_trace_success_statistics (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_statistics_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
 static gboolean
 server_logging_trace_success_multiple_messages_cb (LoggingData *data)
 {
@@ -543,6 +1188,188 @@ test_server_logging_trace_success_multiple_messages (LoggingData *data, gconstpo
 	g_main_loop_run (data->main_loop);
 }
 
+static gboolean
+server_logging_trace_success_methods_cb (LoggingData *data)
+{
+	guint i;
+	const struct {
+		const gchar *method;
+		const gchar *path;
+		SoupStatus expected_status_code;
+	} requests[] = {
+		{ SOUP_METHOD_HEAD, "/test-file", SOUP_STATUS_OK },
+		{ SOUP_METHOD_OPTIONS, "/test-file", SOUP_STATUS_NO_CONTENT },
+		{ "PATCH", "/test-file", SOUP_STATUS_OK },
+		{ SOUP_METHOD_PROPFIND, "/collection/", SOUP_STATUS_MULTI_STATUS },
+	};
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_methods");
+
+	/* Dummy unit test code. Send a message with each method. */
+	for (i = 0; i < G_N_ELEMENTS (requests); i++) {
+		SoupMessage *message;
+		SoupURI *uri;
+
+		uri = soup_uri_new ("https://example.com/");
+		soup_uri_set_path (uri, requests[i].path);
+		soup_uri_set_port (uri, uhm_server_get_port (data->server));
+
+		message = soup_message_new_from_uri (requests[i].method, uri);
+		g_assert_cmpuint (soup_session_send_message (data->session, message), ==, requests[i].expected_status_code);
+
+		soup_uri_free (uri);
+		g_object_unref (message);
+	}
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning responses to requests with methods other than GET, including extension methods. */
+static void
+test_server_logging_trace_success_methods (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_methods_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_preloaded_cb (LoggingData *data)
+{
+	/* Parse the whole trace up front, then check the messages are still returned in order. */
+	uhm_server_set_enable_preloading (data->server, TRUE);
+
+	return server_logging_trace_success_multiple_messages_cb (data);
+}
+
+/* Test a server in onling/logging mode returning several responses from a multi-message trace which has been preloaded. */
+static void
+test_server_logging_trace_success_preloaded (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_preloaded_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_out_of_order_cb (LoggingData *data)
+{
+	SoupMessage *message;
+	SoupURI *uri;
+	guint i;
+	const guint request_order[] = { 2, 0, 1 };
+	SoupStatus expected_status_codes[] = {
+		SOUP_STATUS_OK,
+		SOUP_STATUS_OK,
+		SOUP_STATUS_NOT_FOUND,
+	};
+
+	/* Load the trace, indexing it so that it can be matched out of order. */
+	uhm_server_set_enable_out_of_order_matching (data->server, TRUE);
+	assert_server_load_trace (data->server, "server_logging_trace_success_multiple-messages");
+
+	/* Dummy unit test code. Send the three messages in a different order from the trace. */
+	for (i = 0; i < G_N_ELEMENTS (request_order); i++) {
+		gchar *uri_string;
+
+		uri_string = g_strdup_printf ("https://example.com/test-file%u", request_order[i]);
+		uri = soup_uri_new (uri_string);
+		soup_uri_set_port (uri, uhm_server_get_port (data->server));
+		g_free (uri_string);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_assert_cmpuint (soup_session_send_message (data->session, message), ==, expected_status_codes[request_order[i]]);
+
+		soup_uri_free (uri);
+		g_object_unref (message);
+	}
+
+	/* Each message in the trace may only be used once. */
+	uri = soup_uri_new ("https://example.com/test-file0");
+	soup_uri_set_port (uri, uhm_server_get_port (data->server));
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	soup_uri_free (uri);
+
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_BAD_REQUEST);
+	g_assert_cmpstr (message->response_body->data, ==, "Expected no more requests matching GET ‘/test-file0’.");
+
+	g_object_unref (message);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning several responses from a multi-message trace, requested out of order. */
+static void
+test_server_logging_trace_success_out_of_order (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_out_of_order_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_threaded_cb (LoggingData *data)
+{
+	UhmResolver *resolver;
+
+	/* Restart the server with several threads, then check the messages are still returned in order. */
+	uhm_server_stop (data->server);
+	uhm_server_set_n_threads (data->server, 4);
+	uhm_server_run (data->server);
+
+	resolver = uhm_server_get_resolver (data->server);
+	uhm_resolver_add_A (resolver, "example.com", uhm_server_get_address (data->server));
+
+	return server_logging_trace_success_multiple_messages_cb (data);
+}
+
+/* Test a server in onling/logging mode returning several responses from a multi-message trace, using several server threads. */
+static void
+test_server_logging_trace_success_threaded (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_threaded_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
+static gboolean
+server_logging_trace_success_binary_cb (LoggingData *data)
+{
+	SoupMessage *message;
+	SoupURI *uri;
+	const guint8 expected_body[] = "GIF89a\0\1\0\0binary\0data\377";
+
+	/* Load the trace. */
+	assert_server_load_trace (data->server, "server_logging_trace_success_binary");
+
+	/* Dummy unit test code. */
+	uri = soup_uri_new ("https://example.com/test-file");
+	soup_uri_set_port (uri, uhm_server_get_port (data->server));
+	message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+	soup_uri_free (uri);
+
+	g_assert_cmpuint (soup_session_send_message (data->session, message), ==, SOUP_STATUS_OK);
+
+	/* The body contains nul bytes, which must be returned exactly rather than zero-padded. */
+	g_assert_cmpint (message->response_body->length, ==, sizeof (expected_body) - 1);
+	g_assert (memcmp (message->response_body->data, expected_body, sizeof (expected_body) - 1) == 0);
+
+	g_object_unref (message);
+
+	g_main_loop_quit (data->main_loop);
+
+	return FALSE;
+}
+
+/* Test a server in onling/logging mode returning a binary response from a trace in the binary format. */
+static void
+test_server_logging_trace_success_binary (LoggingData *data, gconstpointer user_data)
+{
+	g_idle_add ((GSourceFunc) server_logging_trace_success_binary_cb, data);
+	g_main_loop_run (data->main_loop);
+}
+
 static gboolean
 server_logging_trace_failure_method_cb (LoggingData *data)
 {
@@ -660,6 +1487,377 @@ test_server_logging_trace_failure_unexpected_request (LoggingData *data, gconstp
 	g_main_loop_run (data->main_loop);
 }
 
+/* Test that a dual-stack server resolves its expected domain names to both loopback addresses, and that it can be reached over both. */
+static void
+test_server_dual_stack (void)
+{
+	UhmServer *server;
+	SoupSession *session;
+	GList/*<GInetAddress>*/ *addresses, *l;
+	const gchar * const domain_names[] = { "example.com", NULL };
+	GError *child_error = NULL;
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_dual_stack (server, TRUE);
+	uhm_server_set_default_tls_certificate (server);
+	uhm_server_set_expected_domain_names (server, domain_names);
+	g_signal_connect (G_OBJECT (server), "handle-message", (GCallback) server_logging_no_trace_success_handle_message_cb, NULL);
+
+	uhm_server_run (server);
+
+	addresses = g_resolver_lookup_by_name (G_RESOLVER (uhm_server_get_resolver (server)), "example.com", NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* There is only an IPv6 address if the system supports IPv6. */
+	g_assert_cmpuint (g_list_length (addresses), >=, 1);
+	g_assert_cmpuint (g_list_length (addresses), <=, 2);
+
+	session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+
+	for (l = addresses; l != NULL; l = l->next) {
+		SoupMessage *message;
+		SoupURI *uri;
+		gchar *address_string;
+
+		address_string = g_inet_address_to_string (G_INET_ADDRESS (l->data));
+
+		if (g_inet_address_get_family (G_INET_ADDRESS (l->data)) == G_SOCKET_FAMILY_IPV6) {
+			g_assert (l == addresses);
+			g_assert_cmpstr (address_string, ==, "::1");
+		} else {
+			g_assert_cmpstr (address_string, ==, uhm_server_get_address (server));
+		}
+
+		/* Make a request to the address directly. */
+		uri = soup_uri_new ("https://example.com/test-file");
+		soup_uri_set_host (uri, address_string);
+		soup_uri_set_port (uri, uhm_server_get_port (server));
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		soup_uri_free (uri);
+
+		g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+
+		g_object_unref (message);
+		g_free (address_string);
+	}
+
+	g_resolver_free_addresses (addresses);
+	g_object_unref (session);
+
+	uhm_server_stop (server);
+	g_object_unref (server);
+}
+
+typedef struct {
+	UhmServer *server;  /* owned */
+	SoupMessage *message;  /* owned */
+} DeferredMessageData;
+
+static gpointer
+server_handle_message_async_thread_cb (DeferredMessageData *data)
+{
+	/* Set the response from another thread, some time after the signal handler has returned. */
+	g_usleep (G_USEC_PER_SEC / 10);
+
+	server_logging_no_trace_success_handle_message_cb (data->server, data->message, NULL);
+	uhm_server_complete_message (data->server, data->message);
+
+	g_object_unref (data->message);
+	g_object_unref (data->server);
+	g_slice_free (DeferredMessageData, data);
+
+	return NULL;
+}
+
+static gboolean
+server_handle_message_async_cb (UhmServer *server, SoupMessage *message, SoupClientContext *client, guint *counter)
+{
+	DeferredMessageData *data;
+
+	(*counter)++;
+
+	/* Only take responsibility for some of the messages; the rest should fall back to UhmServer::handle-message. */
+	if (g_strcmp0 (soup_message_get_uri (message)->path, "/deferred") != 0) {
+		return FALSE;
+	}
+
+	data = g_slice_new (DeferredMessageData);
+	data->server = g_object_ref (server);
+	data->message = g_object_ref (message);
+	g_thread_unref (g_thread_new ("deferred-message", (GThreadFunc) server_handle_message_async_thread_cb, data));
+
+	return TRUE;
+}
+
+/* Test that UhmServer::handle-message-async handlers can complete messages later from another thread, and that messages they don't take
+ * responsibility for are handled by UhmServer::handle-message. */
+static void
+test_server_handle_message_async (void)
+{
+	UhmServer *server;
+	SoupSession *session;
+	const gchar * const domain_names[] = { "example.com", NULL };
+	const gchar * const paths[] = { "/deferred", "/immediate" };
+	guint counter = 0, i;
+
+	server = uhm_server_new ();
+	uhm_server_set_default_tls_certificate (server);
+	uhm_server_set_expected_domain_names (server, domain_names);
+	g_signal_connect (G_OBJECT (server), "handle-message-async", (GCallback) server_handle_message_async_cb, &counter);
+	g_signal_connect (G_OBJECT (server), "handle-message", (GCallback) server_logging_no_trace_success_handle_message_cb, NULL);
+
+	uhm_server_run (server);
+
+	session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS (paths); i++) {
+		SoupMessage *message;
+		SoupURI *uri;
+
+		uri = soup_uri_new ("https://example.com/");
+		soup_uri_set_path (uri, paths[i]);
+		soup_uri_set_port (uri, uhm_server_get_port (server));
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		soup_uri_free (uri);
+
+		g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+		g_assert_cmpstr (message->response_body->data, ==, "This is a success response.");
+
+		g_object_unref (message);
+	}
+
+	g_assert_cmpuint (counter, ==, 2);
+
+	g_object_unref (session);
+
+	uhm_server_stop (server);
+	g_object_unref (server);
+}
+
+/* Test that a trace large enough to be parsed in parallel when it's preloaded still has its messages returned in order. */
+static void
+test_server_preloaded_large_trace (void)
+{
+	UhmServer *server;
+	SoupSession *session;
+	GFile *trace_file;
+	GFileIOStream *io_stream;
+	GString *trace;
+	SoupURI *uri;
+	const gchar * const domain_names[] = { "example.com", NULL };
+	const guint n_messages = 1024;
+	guint i;
+	GError *child_error = NULL;
+
+	/* Write out the trace. */
+	trace = g_string_new (NULL);
+
+	for (i = 0; i < n_messages; i++) {
+		g_string_append_printf (trace,
+		                        "> GET /test-file%u HTTP/1.1\n"
+		                        "> Host: example.com\n"
+		                        "  \n"
+		                        "< HTTP/1.1 200 OK\n"
+		                        "< Content-Type: text/plain; charset=UTF-8\n"
+		                        "< Transfer-Encoding: chunked\n"
+		                        "< \n"
+		                        "< Document %u.\n"
+		                        "  \n", i, i);
+	}
+
+	trace_file = g_file_new_tmp ("uhttpmock-server-XXXXXX", &io_stream, &child_error);
+	g_assert_no_error (child_error);
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (io_stream)), trace->str, trace->len, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_io_stream_close (G_IO_STREAM (io_stream), NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_object_unref (io_stream);
+	g_string_free (trace, TRUE);
+
+	server = uhm_server_new ();
+	uhm_server_set_enable_preloading (server, TRUE);
+	uhm_server_set_default_tls_certificate (server);
+	uhm_server_set_expected_domain_names (server, domain_names);
+
+	uhm_server_run (server);
+
+	uhm_server_load_trace (server, trace_file, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	/* Request every message in order. */
+	session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+	uri = soup_uri_new ("https://example.com/");
+	soup_uri_set_port (uri, uhm_server_get_port (server));
+
+	for (i = 0; i < n_messages; i++) {
+		SoupMessage *message;
+		gchar *path, *expected_body;
+
+		path = g_strdup_printf ("/test-file%u", i);
+		soup_uri_set_path (uri, path);
+		g_free (path);
+
+		message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+		g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+
+		expected_body = g_strdup_printf ("Document %u.\n", i);
+		g_assert_cmpstr (message->response_body->data, ==, expected_body);
+		g_free (expected_body);
+
+		g_object_unref (message);
+	}
+
+	soup_uri_free (uri);
+	g_object_unref (session);
+
+	uhm_server_stop (server);
+	g_object_unref (server);
+
+	g_file_delete (trace_file, NULL, NULL);
+	g_object_unref (trace_file);
+}
+
+/* Test making requests to a server in each transport mode, and that the ports and base URI reflect the mode. */
+static void
+test_server_transport_mode (void)
+{
+	const UhmServerTransportMode modes[] = {
+		UHM_SERVER_TRANSPORT_MODE_HTTPS,
+		UHM_SERVER_TRANSPORT_MODE_HTTP,
+		UHM_SERVER_TRANSPORT_MODE_BOTH,
+	};
+	const gchar * const domain_names[] = { "example.com", NULL };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (modes); i++) {
+		UhmServer *server;
+		SoupSession *session;
+		SoupMessage *message;
+		SoupURI *uri;
+		guint http_port;
+
+		server = uhm_server_new ();
+		uhm_server_set_transport_mode (server, modes[i]);
+		uhm_server_set_expected_domain_names (server, domain_names);
+		g_signal_connect (G_OBJECT (server), "handle-message", (GCallback) server_logging_no_trace_success_handle_message_cb, NULL);
+
+		/* A certificate is only needed if serving HTTPS. */
+		if (modes[i] != UHM_SERVER_TRANSPORT_MODE_HTTP) {
+			uhm_server_set_default_tls_certificate (server);
+		}
+
+		uhm_server_run (server);
+
+		g_assert_cmpuint (uhm_server_get_port (server), !=, 0);
+		http_port = uhm_server_get_http_port (server);
+
+		switch (modes[i]) {
+			case UHM_SERVER_TRANSPORT_MODE_HTTPS:
+				g_assert_cmpuint (http_port, ==, 0);
+				break;
+			case UHM_SERVER_TRANSPORT_MODE_HTTP:
+				g_assert_cmpuint (http_port, ==, uhm_server_get_port (server));
+				break;
+			case UHM_SERVER_TRANSPORT_MODE_BOTH:
+				g_assert_cmpuint (http_port, !=, uhm_server_get_port (server));
+				break;
+			default:
+				g_assert_not_reached ();
+		}
+
+		session = soup_session_new_with_options (SOUP_SESSION_SSL_STRICT, FALSE, NULL);
+
+		/* Make a request over whichever transports are being served. */
+		if (modes[i] != UHM_SERVER_TRANSPORT_MODE_HTTP) {
+			uri = soup_uri_new ("https://example.com/test-file");
+			soup_uri_set_port (uri, uhm_server_get_port (server));
+			message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+			soup_uri_free (uri);
+
+			g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+			g_object_unref (message);
+		}
+
+		/* http_port is 0 for HTTPS only, and with old versions of libsoup, which don't support serving both. */
+		if (http_port != 0) {
+			uri = soup_uri_new ("http://example.com/test-file");
+			soup_uri_set_port (uri, http_port);
+			message = soup_message_new_from_uri (SOUP_METHOD_GET, uri);
+			soup_uri_free (uri);
+
+			g_assert_cmpuint (soup_session_send_message (session, message), ==, SOUP_STATUS_OK);
+			g_object_unref (message);
+		}
+
+		g_object_unref (session);
+
+		uhm_server_stop (server);
+		g_assert_cmpuint (uhm_server_get_http_port (server), ==, 0);
+
+		g_object_unref (server);
+	}
+}
+
+#ifdef ENABLE_UNIX_SOCKET
+/* Test making a plain HTTP request to a server over a Unix socket on the file system, and that the socket is removed when the server stops. */
+static void
+test_server_unix_socket (void)
+{
+	UhmServer *server;
+	gchar *tmp_dir, *socket_path;
+	GSocketClient *client;
+	GSocketAddress *address;
+	GSocketConnection *connection;
+	GDataInputStream *input_stream;
+	gchar *status_line;
+	const gchar *request = "GET /test-file HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n\r\n";
+	GError *child_error = NULL;
+
+	tmp_dir = g_dir_make_tmp ("uhttpmock-server-XXXXXX", &child_error);
+	g_assert_no_error (child_error);
+	socket_path = g_build_filename (tmp_dir, "socket", NULL);
+
+	server = uhm_server_new ();
+	uhm_server_set_unix_socket_path (server, socket_path);
+	uhm_server_set_default_tls_certificate (server);
+	g_signal_connect (G_OBJECT (server), "handle-message", (GCallback) server_logging_no_trace_success_handle_message_cb, NULL);
+
+	uhm_server_run (server);
+	g_assert (g_file_test (socket_path, G_FILE_TEST_EXISTS) == TRUE);
+
+	/* Make a request. */
+	client = g_socket_client_new ();
+	address = g_unix_socket_address_new (socket_path);
+	connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (connection)), request, strlen (request), NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+
+	input_stream = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+	g_data_input_stream_set_newline_type (input_stream, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+	status_line = g_data_input_stream_read_line (input_stream, NULL, NULL, &child_error);
+	g_assert_no_error (child_error);
+	g_assert_cmpstr (status_line, ==, "HTTP/1.1 200 OK");
+	g_free (status_line);
+
+	g_object_unref (input_stream);
+	g_object_unref (connection);
+	g_object_unref (address);
+	g_object_unref (client);
+
+	/* Stopping the server should remove the socket. */
+	uhm_server_stop (server);
+	g_assert (g_file_test (socket_path, G_FILE_TEST_EXISTS) == FALSE);
+
+	g_object_unref (server);
+
+	g_rmdir (tmp_dir);
+	g_free (socket_path);
+	g_free (tmp_dir);
+}
+#endif
+
 int
 main (int argc, char *argv[])
 {
@@ -676,11 +1874,35 @@ main (int argc, char *argv[])
 	g_test_add_func ("/server/properties/trace-directory", test_server_properties_trace_directory);
 	g_test_add_func ("/server/properties/enable-online", test_server_properties_enable_online);
 	g_test_add_func ("/server/properties/enable-logging", test_server_properties_enable_logging);
+	g_test_add_func ("/server/properties/enable-preloading", test_server_properties_enable_preloading);
+	g_test_add_func ("/server/properties/enable-out-of-order-matching", test_server_properties_enable_out_of_order_matching);
+	g_test_add_func ("/server/properties/n-threads", test_server_properties_n_threads);
+	g_test_add_func ("/server/properties/enable-background-logging", test_server_properties_enable_background_logging);
+	g_test_add_func ("/server/properties/enable-replay-timing", test_server_properties_enable_replay_timing);
+	g_test_add_func ("/server/properties/replay-speed", test_server_properties_replay_speed);
+	g_test_add_func ("/server/properties/bandwidth-limit", test_server_properties_bandwidth_limit);
+	g_test_add_func ("/server/properties/enable-dual-stack", test_server_properties_enable_dual_stack);
+	g_test_add_func ("/server/properties/unix-socket-path", test_server_properties_unix_socket_path);
+	g_test_add_func ("/server/properties/transport-mode", test_server_properties_transport_mode);
 	g_test_add_func ("/server/properties/address", test_server_properties_address);
 	g_test_add_func ("/server/properties/port", test_server_properties_port);
+	g_test_add_func ("/server/properties/http-port", test_server_properties_http_port);
 	g_test_add_func ("/server/properties/resolver", test_server_properties_resolver);
 	g_test_add_func ("/server/properties/tls-certificate", test_server_properties_tls_certificate);
 
+	g_test_add_func ("/server/default-tls-certificate", test_server_default_tls_certificate);
+
+	g_test_add_func ("/server/received-message-chunk/nul-bytes", test_server_received_message_chunk_nul_bytes);
+	g_test_add_func ("/server/received-message-chunk/dispose", test_server_received_message_chunk_dispose);
+
+	g_test_add_func ("/server/dual-stack", test_server_dual_stack);
+	g_test_add_func ("/server/transport-mode", test_server_transport_mode);
+	g_test_add_func ("/server/preloaded-large-trace", test_server_preloaded_large_trace);
+	g_test_add_func ("/server/handle-message-async", test_server_handle_message_async);
+#ifdef ENABLE_UNIX_SOCKET
+	g_test_add_func ("/server/unix-socket", test_server_unix_socket);
+#endif
+
 	g_test_add ("/server/logging/no-trace/success", LoggingData, server_logging_no_trace_success_handle_message_cb,
 	            set_up_logging, test_server_logging_no_trace_success, tear_down_logging);
 	g_test_add ("/server/logging/no-trace/failure", LoggingData, server_logging_no_trace_failure_handle_message_cb,
@@ -689,6 +1911,22 @@ main (int argc, char *argv[])
 	            set_up_logging, test_server_logging_trace_success_normal, tear_down_logging);
 	g_test_add ("/server/logging/trace/success/multiple-messages", LoggingData, NULL,
 	            set_up_logging, test_server_logging_trace_success_multiple_messages, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/methods", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_methods, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/preloaded", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_preloaded, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/out-of-order", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_out_of_order, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/threaded", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_threaded, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/binary", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_binary, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/replay-timing", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_replay_timing, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/bandwidth-limit", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_bandwidth_limit, tear_down_logging);
+	g_test_add ("/server/logging/trace/success/statistics", LoggingData, NULL,
+	            set_up_logging, test_server_logging_trace_success_statistics, tear_down_logging);
 	g_test_add ("/server/logging/trace/failure/method", LoggingData, NULL,
 	            set_up_logging, test_server_logging_trace_failure_method, tear_down_logging);
 	g_test_add ("/server/logging/trace/failure/uri", LoggingData, NULL,
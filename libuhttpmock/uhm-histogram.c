@@ -0,0 +1,163 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Latency histograms.
+ *
+ * These are in the style of HdrHistogram: values are counted in buckets whose width grows with the magnitude of the value, so that every
+ * recorded value is reproduced to within a fixed relative precision, while the histogram has a small, fixed size. Values below
+ * SUB_BUCKET_COUNT get a bucket each. Above that, each power of two is divided into SUB_BUCKET_COUNT equal buckets, giving a precision of
+ * better than 1/SUB_BUCKET_COUNT (about 6%).
+ *
+ * Recording a value is a couple of shifts and an increment, so it's cheap enough to do for every request.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "uhm-histogram.h"
+
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_BITS)
+
+/* Values of 2^MAX_MAGNITUDE or more are counted in the last bucket. With microsecond values, that's about 12 days. */
+#define MAX_MAGNITUDE 40
+#define N_BUCKETS (SUB_BUCKET_COUNT + (MAX_MAGNITUDE - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT)
+
+struct _UhmHistogram {
+	guint64 count;
+	guint64 buckets[N_BUCKETS];
+};
+
+UhmHistogram *
+uhm_histogram_new (void)
+{
+	return g_slice_new0 (UhmHistogram);
+}
+
+UhmHistogram *
+uhm_histogram_copy (const UhmHistogram *self)
+{
+	g_return_val_if_fail (self != NULL, NULL);
+
+	return g_slice_dup (UhmHistogram, self);
+}
+
+void
+uhm_histogram_free (UhmHistogram *self)
+{
+	g_return_if_fail (self != NULL);
+
+	g_slice_free (UhmHistogram, self);
+}
+
+void
+uhm_histogram_reset (UhmHistogram *self)
+{
+	g_return_if_fail (self != NULL);
+
+	memset (self, 0, sizeof (*self));
+}
+
+static guint
+get_bucket_index (guint64 value)
+{
+	guint magnitude;
+
+	if (value < SUB_BUCKET_COUNT) {
+		return value;
+	} else if (value >= G_GUINT64_CONSTANT (1) << MAX_MAGNITUDE) {
+		return N_BUCKETS - 1;
+	}
+
+	/* Find the most significant bit, then use the SUB_BUCKET_BITS bits below it to pick the sub-bucket. g_bit_storage() takes a gulong,
+	 * which may only be 32 bits wide. */
+	if ((value >> 32) != 0) {
+		magnitude = 32 + g_bit_storage ((gulong) (value >> 32)) - 1;
+	} else {
+		magnitude = g_bit_storage ((gulong) value) - 1;
+	}
+
+	return SUB_BUCKET_COUNT + (magnitude - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT +
+	       ((value >> (magnitude - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT);
+}
+
+/* Get the largest value which is counted in the bucket at @index. */
+static guint64
+get_bucket_highest_value (guint index)
+{
+	guint shift, sub_bucket;
+
+	if (index < SUB_BUCKET_COUNT) {
+		return index;
+	}
+
+	shift = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_COUNT;
+	sub_bucket = (index - SUB_BUCKET_COUNT) % SUB_BUCKET_COUNT;
+
+	return (((guint64) SUB_BUCKET_COUNT + sub_bucket + 1) << shift) - 1;
+}
+
+void
+uhm_histogram_record (UhmHistogram *self, guint64 value)
+{
+	g_return_if_fail (self != NULL);
+
+	self->buckets[get_bucket_index (value)]++;
+	self->count++;
+}
+
+guint64
+uhm_histogram_get_count (const UhmHistogram *self)
+{
+	g_return_val_if_fail (self != NULL, 0);
+
+	return self->count;
+}
+
+/* Get the value below which @percentile percent of the recorded values lie, to within the precision of the histogram. Returns 0 if no
+ * values have been recorded. */
+guint64
+uhm_histogram_get_percentile (const UhmHistogram *self, gdouble percentile)
+{
+	guint64 target, total = 0;
+	guint i;
+
+	g_return_val_if_fail (self != NULL, 0);
+	g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+	if (self->count == 0) {
+		return 0;
+	}
+
+	/* The number of values which must lie at or below the result; always at least one. */
+	target = MAX ((guint64) (percentile / 100.0 * self->count + 0.5), 1);
+
+	for (i = 0; i < N_BUCKETS; i++) {
+		total += self->buckets[i];
+
+		if (total >= target) {
+			return get_bucket_highest_value (i);
+		}
+	}
+
+	g_assert_not_reached ();
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UHM_HISTOGRAM_H
+#define UHM_HISTOGRAM_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Private API for recording latency distributions. This is not installed. */
+
+typedef struct _UhmHistogram UhmHistogram;
+
+G_GNUC_INTERNAL UhmHistogram *uhm_histogram_new (void);
+G_GNUC_INTERNAL UhmHistogram *uhm_histogram_copy (const UhmHistogram *self);
+G_GNUC_INTERNAL void uhm_histogram_free (UhmHistogram *self);
+
+G_GNUC_INTERNAL void uhm_histogram_reset (UhmHistogram *self);
+G_GNUC_INTERNAL void uhm_histogram_record (UhmHistogram *self, guint64 value);
+
+G_GNUC_INTERNAL guint64 uhm_histogram_get_count (const UhmHistogram *self);
+G_GNUC_INTERNAL guint64 uhm_histogram_get_percentile (const UhmHistogram *self, gdouble percentile);
+
+G_END_DECLS
+
+#endif /* !UHM_HISTOGRAM_H */
@@ -39,6 +39,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 #include <gio/gio.h>
 
@@ -57,25 +58,60 @@ static void uhm_resolver_finalize (GObject *object);
 static GList *uhm_resolver_lookup_by_name (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GError **error);
 static void uhm_resolver_lookup_by_name_async (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 static GList *uhm_resolver_lookup_by_name_finish (GResolver *resolver, GAsyncResult *result, GError **error);
+#if GLIB_CHECK_VERSION (2, 60, 0)
+static GList *uhm_resolver_lookup_by_name_with_flags (GResolver *resolver, const gchar *hostname, GResolverNameLookupFlags flags,
+                                                      GCancellable *cancellable, GError **error);
+static void uhm_resolver_lookup_by_name_with_flags_async (GResolver *resolver, const gchar *hostname, GResolverNameLookupFlags flags,
+                                                          GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+static GList *uhm_resolver_lookup_by_name_with_flags_finish (GResolver *resolver, GAsyncResult *result, GError **error);
+#endif
 static GList *uhm_resolver_lookup_service (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GError **error);
 static void uhm_resolver_lookup_service_async (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
 static GList *uhm_resolver_lookup_service_finish (GResolver *resolver, GAsyncResult *result, GError **error);
-
-typedef struct {
-	gchar *key;
-	gchar *addr;
-} FakeHost;
-
-typedef struct {
-	char *key;
-	GSrvTarget *srv;
-} FakeService;
+static GList *uhm_resolver_lookup_records (GResolver *resolver, const gchar *rrname, GResolverRecordType record_type, GCancellable *cancellable,
+                                           GError **error);
+static void uhm_resolver_lookup_records_async (GResolver *resolver, const gchar *rrname, GResolverRecordType record_type, GCancellable *cancellable,
+                                               GAsyncReadyCallback callback, gpointer user_data);
+static GList *uhm_resolver_lookup_records_finish (GResolver *resolver, GAsyncResult *result, GError **error);
+
+/* A node in the trie of wildcard A records. The trie is keyed by the labels of the wildcard's suffix in reverse order, so the records for
+ * ‘*.bar.example.com’ are found at root → ‘com’ → ‘example’ → ‘bar’. Looking up a name takes time proportional to its number of labels,
+ * however many wildcards are registered. */
+typedef struct _WildcardNode WildcardNode;
+
+struct _WildcardNode {
+	GHashTable/*<owned gchar*, owned WildcardNode*>*/ *children;  /* NULL if the node has no children */
+	GPtrArray/*<owned GInetAddress>*/ *records;  /* records for ‘*.<suffix>’; NULL if there are none */
+};
 
 struct _UhmResolverPrivate {
-	GList *fake_A;
-	GList *fake_SRV;
+	/* Both tables are keyed by normalised name (see normalise_name()), so that additions and lookups are O(1) however many records
+	 * are registered. Addresses are parsed once when they're added, rather than on every lookup. */
+	GHashTable/*<owned gchar*, owned GPtrArray<owned GInetAddress>>*/ *fake_A;  /* both A and AAAA records */
+	GHashTable/*<owned gchar*, owned GPtrArray<owned GSrvTarget>>*/ *fake_SRV;
+	WildcardNode *wildcard_A;  /* owned; root of the trie of wildcard A and AAAA records */
 };
 
+static WildcardNode *
+wildcard_node_new (void)
+{
+	return g_slice_new0 (WildcardNode);
+}
+
+static void
+wildcard_node_free (WildcardNode *node)
+{
+	if (node->children != NULL) {
+		g_hash_table_unref (node->children);
+	}
+
+	if (node->records != NULL) {
+		g_ptr_array_unref (node->records);
+	}
+
+	g_slice_free (WildcardNode, node);
+}
+
 G_DEFINE_TYPE (UhmResolver, uhm_resolver, G_TYPE_RESOLVER)
 
 static void
@@ -94,45 +130,221 @@ uhm_resolver_class_init (UhmResolverClass *klass)
 	resolver_class->lookup_service = uhm_resolver_lookup_service;
 	resolver_class->lookup_service_async = uhm_resolver_lookup_service_async;
 	resolver_class->lookup_service_finish = uhm_resolver_lookup_service_finish;
+	resolver_class->lookup_records = uhm_resolver_lookup_records;
+	resolver_class->lookup_records_async = uhm_resolver_lookup_records_async;
+	resolver_class->lookup_records_finish = uhm_resolver_lookup_records_finish;
+#if GLIB_CHECK_VERSION (2, 60, 0)
+	resolver_class->lookup_by_name_with_flags = uhm_resolver_lookup_by_name_with_flags;
+	resolver_class->lookup_by_name_with_flags_async = uhm_resolver_lookup_by_name_with_flags_async;
+	resolver_class->lookup_by_name_with_flags_finish = uhm_resolver_lookup_by_name_with_flags_finish;
+#endif
 }
 
 static void
 uhm_resolver_init (UhmResolver *self)
 {
 	self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, UHM_TYPE_RESOLVER, UhmResolverPrivate);
+
+	self->priv->fake_A = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	self->priv->fake_SRV = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	self->priv->wildcard_A = wildcard_node_new ();
 }
 
 static void
 uhm_resolver_finalize (GObject *object)
 {
-	uhm_resolver_reset (UHM_RESOLVER (object));
+	UhmResolverPrivate *priv = UHM_RESOLVER (object)->priv;
+
+	wildcard_node_free (priv->wildcard_A);
+	g_hash_table_unref (priv->fake_SRV);
+	g_hash_table_unref (priv->fake_A);
 
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (uhm_resolver_parent_class)->finalize (object);
 }
 
+/* Convert a host name or SRV record name to the form used as a key in the record tables: ASCII-encoded and lower case, since DNS names are
+ * case-insensitive. Returns NULL if the name is invalid. */
+static gchar *
+normalise_name (const gchar *name)
+{
+	gchar *ascii_name, *normalised_name;
+
+	ascii_name = g_hostname_to_ascii (name);
+
+	if (ascii_name == NULL) {
+		return NULL;
+	}
+
+	normalised_name = g_ascii_strdown (ascii_name, -1);
+	g_free (ascii_name);
+
+	return normalised_name;
+}
+
 static gchar *
 _service_rrname (const char *service, const char *protocol, const char *domain)
 {
-	gchar *rrname, *ascii_domain;
+	gchar *rrname, *normalised_rrname;
 
-	ascii_domain = g_hostname_to_ascii (domain);
-	rrname = g_strdup_printf ("_%s._%s.%s", service, protocol, ascii_domain);
-	g_free (ascii_domain);
+	rrname = g_strdup_printf ("_%s._%s.%s", service, protocol, domain);
+	normalised_rrname = normalise_name (rrname);
+	g_free (rrname);
 
-	return rrname;
+	return normalised_rrname;
 }
 
+/* Add @record to the array of records for @key in @table, taking ownership of both. */
+static void
+add_record (GHashTable *table, gchar *key, gpointer record, GDestroyNotify record_free_func)
+{
+	GPtrArray *records;
+
+	records = g_hash_table_lookup (table, key);
+
+	if (records == NULL) {
+		records = g_ptr_array_new_with_free_func (record_free_func);
+		g_hash_table_insert (table, key, records);
+	} else {
+		g_free (key);
+	}
+
+	g_ptr_array_add (records, record);
+}
+
+/* Add @address to the trie of wildcard records for the wildcard ‘*.@suffix’, taking ownership of it. @suffix must be normalised, and is
+ * modified. */
+static void
+add_wildcard_record (UhmResolver *self, gchar *suffix, GInetAddress *address)
+{
+	WildcardNode *node = self->priv->wildcard_A;
+	gchar *label, *end;
+
+	end = suffix + strlen (suffix);
+
+	do {
+		WildcardNode *child = NULL;
+
+		for (label = end; label > suffix && label[-1] != '.'; label--);
+		*end = '\0';
+
+		if (node->children == NULL) {
+			node->children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) wildcard_node_free);
+		} else {
+			child = g_hash_table_lookup (node->children, label);
+		}
+
+		if (child == NULL) {
+			child = wildcard_node_new ();
+			g_hash_table_insert (node->children, g_strdup (label), child);
+		}
+
+		node = child;
+		end = label - 1;
+	} while (label > suffix);
+
+	if (node->records == NULL) {
+		node->records = g_ptr_array_new_with_free_func (g_object_unref);
+	}
+
+	g_ptr_array_add (node->records, address);
+}
+
+/* Find the wildcard records which match @name, preferring the wildcard with the longest suffix. The wildcard must match at least the leftmost
+ * label of @name, so ‘*.example.com’ matches ‘foo.example.com’ and ‘foo.bar.example.com’, but not ‘example.com’. @name must be normalised,
+ * and is modified. Returns NULL if no wildcards match. */
+static GPtrArray *
+find_wildcard_records (UhmResolver *self, gchar *name)
+{
+	WildcardNode *node = self->priv->wildcard_A;
+	GPtrArray *records = NULL;
+	gchar *label, *end;
+
+	end = name + strlen (name);
+
+	while (node->children != NULL) {
+		for (label = end; label > name && label[-1] != '.'; label--);
+
+		/* The leftmost label has to be matched by the wildcard itself. */
+		if (label == name) {
+			break;
+		}
+
+		*end = '\0';
+		node = g_hash_table_lookup (node->children, label);
+
+		if (node == NULL) {
+			break;
+		} else if (node->records != NULL) {
+			records = node->records;
+		}
+
+		end = label - 1;
+	}
+
+	return records;
+}
+
+/* Look up the A records for @name. Exact records take precedence over wildcard ones. Returns NULL if there are none. */
+static GPtrArray *
+get_host_records (UhmResolver *self, const gchar *name)
+{
+	gchar *key;
+	GPtrArray *records;
+
+	key = normalise_name (name);
+
+	if (key == NULL) {
+		return NULL;
+	}
+
+	records = g_hash_table_lookup (self->priv->fake_A, key);
+
+	if (records == NULL) {
+		records = find_wildcard_records (self, key);
+	}
+
+	g_free (key);
+
+	return records;
+}
+
+/* Look up the array of records for @name in @table. Returns NULL if there are none. */
+static GPtrArray *
+get_records (GHashTable *table, const gchar *name)
+{
+	gchar *key;
+	GPtrArray *records;
+
+	key = normalise_name (name);
+
+	if (key == NULL) {
+		return NULL;
+	}
+
+	records = g_hash_table_lookup (table, key);
+	g_free (key);
+
+	return records;
+}
+
+/* Returns a list of references to the cached addresses for @name, in the order they were added. If @family is not G_SOCKET_FAMILY_INVALID,
+ * only addresses in that family are returned. */
 static GList *
-find_fake_services (UhmResolver *self, const char *name)
+find_fake_hosts (UhmResolver *self, const char *name, GSocketFamily family)
 {
-	GList *fake = NULL;
+	GPtrArray *records;
 	GList *rval = NULL;
+	guint i;
+
+	records = get_host_records (self, name);
 
-	for (fake = self->priv->fake_SRV; fake != NULL; fake = g_list_next (fake)) {
-		FakeService *entry = fake->data;
-		if (entry != NULL && !g_strcmp0 (entry->key, name)) {
-			rval = g_list_append (rval, g_srv_target_copy (entry->srv));
+	for (i = (records != NULL) ? records->len : 0; i > 0; i--) {
+		GInetAddress *address = records->pdata[i - 1];
+
+		/* The addresses are immutable, so the cached ones can be returned directly. */
+		if (family == G_SOCKET_FAMILY_INVALID || g_inet_address_get_family (address) == family) {
+			rval = g_list_prepend (rval, g_object_ref (address));
 		}
 	}
 
@@ -140,112 +352,253 @@ find_fake_services (UhmResolver *self, const char *name)
 }
 
 static GList *
-find_fake_hosts (UhmResolver *self, const char *name)
+find_fake_services (UhmResolver *self, const char *name)
 {
-	GList *fake = NULL;
+	GPtrArray *records;
 	GList *rval = NULL;
+	guint i;
 
-	for (fake = self->priv->fake_A; fake != NULL; fake = g_list_next (fake)) {
-		FakeHost *entry = fake->data;
-		if (entry != NULL && !g_strcmp0 (entry->key, name)) {
-			rval = g_list_append (rval, g_inet_address_new_from_string (entry->addr));
-		}
+	records = get_records (self->priv->fake_SRV, name);
+
+	for (i = (records != NULL) ? records->len : 0; i > 0; i--) {
+		rval = g_list_prepend (rval, g_srv_target_copy (records->pdata[i - 1]));
 	}
 
 	return rval;
 }
 
+/* Returns a list of #GVariants for the records of type @record_type for @name, in the format documented for g_resolver_lookup_records(). Only
+ * SRV records can be added to the resolver, so lookups for any other type of record return nothing. */
 static GList *
-uhm_resolver_lookup_by_name (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GError **error)
+find_fake_records (UhmResolver *self, const char *name, GResolverRecordType record_type)
 {
-	GList *result;
+	GPtrArray *records;
+	GList *rval = NULL;
+	guint i;
 
-	result = find_fake_hosts (UHM_RESOLVER (resolver), hostname);
+	if (record_type != G_RESOLVER_RECORD_SRV) {
+		return NULL;
+	}
 
-	if (result == NULL) {
-		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake hostname record registered for ‘%s’.", hostname);
+	records = get_records (self->priv->fake_SRV, name);
+
+	for (i = (records != NULL) ? records->len : 0; i > 0; i--) {
+		GSrvTarget *target = records->pdata[i - 1];
+
+		rval = g_list_prepend (rval, g_variant_ref_sink (g_variant_new ("(qqqs)",
+		                                                                g_srv_target_get_priority (target),
+		                                                                g_srv_target_get_weight (target),
+		                                                                g_srv_target_get_port (target),
+		                                                                g_srv_target_get_hostname (target))));
 	}
 
-	return result;
+	return rval;
 }
 
 static void
-uhm_resolver_lookup_by_name_async (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+free_records (GList/*<owned GVariant>*/ *records)
 {
-	GSimpleAsyncResult *res;
-	GList *addr;
-	GError *error = NULL;
+	g_list_free_full (records, (GDestroyNotify) g_variant_unref);
+}
 
-	addr = uhm_resolver_lookup_by_name (resolver, hostname, NULL, &error);
-	res = g_simple_async_result_new (G_OBJECT (resolver), callback, user_data, NULL);
+static GList *
+lookup_hosts (UhmResolver *self, const gchar *hostname, GSocketFamily family, GCancellable *cancellable, GError **error)
+{
+	GList *result;
 
-	if (addr != NULL) {
-		g_simple_async_result_set_op_res_gpointer (res, addr, NULL);
-	} else {
-		g_simple_async_result_set_from_error (res, error);
-		g_error_free (error);
+	if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+		return NULL;
 	}
 
-	g_simple_async_result_complete_in_idle (res);
-	g_object_unref (res);
+	result = find_fake_hosts (self, hostname, family);
+
+	if (result == NULL) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake hostname record registered for ‘%s’.", hostname);
+	}
+
+	return result;
 }
 
 static GList *
-uhm_resolver_lookup_by_name_finish (GResolver *resolver, GAsyncResult *result, GError **error)
+lookup_services (UhmResolver *self, const gchar *rrname, GCancellable *cancellable, GError **error)
 {
-	GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+	GList *result;
 
-	if (g_simple_async_result_propagate_error (simple, error)) {
+	if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
 		return NULL;
 	}
 
-	return g_simple_async_result_get_op_res_gpointer (simple);
+	result = find_fake_services (self, rrname);
+
+	if (result == NULL) {
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake service records registered for ‘%s’.", rrname);
+	}
+
+	return result;
 }
 
 static GList *
-uhm_resolver_lookup_service (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GError **error)
+lookup_records (UhmResolver *self, const gchar *rrname, GResolverRecordType record_type, GCancellable *cancellable, GError **error)
 {
 	GList *result;
 
-	result = find_fake_services (UHM_RESOLVER (resolver), rrname);
+	if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+		return NULL;
+	}
+
+	result = find_fake_records (self, rrname, record_type);
 
 	if (result == NULL) {
-		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake service records registered for ‘%s’.", rrname);
+		g_set_error (error, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake DNS records of the requested type registered for ‘%s’.",
+		             rrname);
 	}
 
 	return result;
 }
 
+/* All lookups are answered from memory, so the asynchronous versions do the lookup straight away and return the result through a #GTask. The
+ * task's callback is invoked from the caller's thread-default main context, as required for #GAsyncResults. @result and @error are consumed,
+ * as is @task. */
 static void
-uhm_resolver_lookup_service_async (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+return_lookup_result (GTask *task, GList *result, GDestroyNotify result_free_func, GError *error)
 {
-	UhmResolver *self = UHM_RESOLVER (resolver);
-	GList *addr;
-	GSimpleAsyncResult *res;
+	if (result != NULL) {
+		g_task_return_pointer (task, result, result_free_func);
+	} else {
+		g_task_return_error (task, error);
+	}
+
+	g_object_unref (task);
+}
 
-	addr = find_fake_services (self, rrname);
-	res = g_simple_async_result_new (G_OBJECT (resolver), callback, user_data, uhm_resolver_lookup_service_async);
+static GList *
+propagate_lookup_result (GResolver *resolver, GAsyncResult *result, gpointer source_tag, GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (result, resolver), NULL);
+	g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == source_tag, NULL);
 
-	if (addr != NULL) {
-		g_simple_async_result_set_op_res_gpointer (res, addr, NULL);
-	} else {
-		g_simple_async_result_set_error (res, G_RESOLVER_ERROR, G_RESOLVER_ERROR_NOT_FOUND, "No fake SRV record registered for ‘%s’.", rrname);
+	return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static GList *
+uhm_resolver_lookup_by_name (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GError **error)
+{
+	return lookup_hosts (UHM_RESOLVER (resolver), hostname, G_SOCKET_FAMILY_INVALID, cancellable, error);
+}
+
+static void
+uhm_resolver_lookup_by_name_async (GResolver *resolver, const gchar *hostname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	GList *addresses;
+	GError *error = NULL;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	g_task_set_source_tag (task, uhm_resolver_lookup_by_name_async);
+
+	addresses = lookup_hosts (UHM_RESOLVER (resolver), hostname, G_SOCKET_FAMILY_INVALID, cancellable, &error);
+	return_lookup_result (task, addresses, (GDestroyNotify) g_resolver_free_addresses, error);
+}
+
+static GList *
+uhm_resolver_lookup_by_name_finish (GResolver *resolver, GAsyncResult *result, GError **error)
+{
+	return propagate_lookup_result (resolver, result, uhm_resolver_lookup_by_name_async, error);
+}
+
+#if GLIB_CHECK_VERSION (2, 60, 0)
+static GSocketFamily
+flags_to_family (GResolverNameLookupFlags flags)
+{
+	if (flags & G_RESOLVER_NAME_LOOKUP_FLAGS_IPV4_ONLY) {
+		return G_SOCKET_FAMILY_IPV4;
+	} else if (flags & G_RESOLVER_NAME_LOOKUP_FLAGS_IPV6_ONLY) {
+		return G_SOCKET_FAMILY_IPV6;
 	}
 
-	g_simple_async_result_complete_in_idle (res);
-	g_object_unref (res);
+	return G_SOCKET_FAMILY_INVALID;
+}
+
+static GList *
+uhm_resolver_lookup_by_name_with_flags (GResolver *resolver, const gchar *hostname, GResolverNameLookupFlags flags,
+                                        GCancellable *cancellable, GError **error)
+{
+	return lookup_hosts (UHM_RESOLVER (resolver), hostname, flags_to_family (flags), cancellable, error);
+}
+
+static void
+uhm_resolver_lookup_by_name_with_flags_async (GResolver *resolver, const gchar *hostname, GResolverNameLookupFlags flags,
+                                              GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	GList *addresses;
+	GError *error = NULL;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	g_task_set_source_tag (task, uhm_resolver_lookup_by_name_with_flags_async);
+
+	addresses = lookup_hosts (UHM_RESOLVER (resolver), hostname, flags_to_family (flags), cancellable, &error);
+	return_lookup_result (task, addresses, (GDestroyNotify) g_resolver_free_addresses, error);
+}
+
+static GList *
+uhm_resolver_lookup_by_name_with_flags_finish (GResolver *resolver, GAsyncResult *result, GError **error)
+{
+	return propagate_lookup_result (resolver, result, uhm_resolver_lookup_by_name_with_flags_async, error);
+}
+#endif /* GLib ≥ 2.60.0 */
+
+static GList *
+uhm_resolver_lookup_service (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GError **error)
+{
+	return lookup_services (UHM_RESOLVER (resolver), rrname, cancellable, error);
+}
+
+static void
+uhm_resolver_lookup_service_async (GResolver *resolver, const gchar *rrname, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	GList *targets;
+	GError *error = NULL;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	g_task_set_source_tag (task, uhm_resolver_lookup_service_async);
+
+	targets = lookup_services (UHM_RESOLVER (resolver), rrname, cancellable, &error);
+	return_lookup_result (task, targets, (GDestroyNotify) g_resolver_free_targets, error);
 }
 
 static GList *
 uhm_resolver_lookup_service_finish (GResolver *resolver, GAsyncResult *result, GError **error)
 {
-	GSimpleAsyncResult *simple = G_SIMPLE_ASYNC_RESULT (result);
+	return propagate_lookup_result (resolver, result, uhm_resolver_lookup_service_async, error);
+}
 
-	if (g_simple_async_result_propagate_error (simple, error)) {
-		return NULL;
-	}
+static GList *
+uhm_resolver_lookup_records (GResolver *resolver, const gchar *rrname, GResolverRecordType record_type, GCancellable *cancellable, GError **error)
+{
+	return lookup_records (UHM_RESOLVER (resolver), rrname, record_type, cancellable, error);
+}
+
+static void
+uhm_resolver_lookup_records_async (GResolver *resolver, const gchar *rrname, GResolverRecordType record_type, GCancellable *cancellable,
+                                   GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	GList *records;
+	GError *error = NULL;
+
+	task = g_task_new (resolver, cancellable, callback, user_data);
+	g_task_set_source_tag (task, uhm_resolver_lookup_records_async);
 
-	return g_simple_async_result_get_op_res_gpointer (simple);
+	records = lookup_records (UHM_RESOLVER (resolver), rrname, record_type, cancellable, &error);
+	return_lookup_result (task, records, (GDestroyNotify) free_records, error);
+}
+
+static GList *
+uhm_resolver_lookup_records_finish (GResolver *resolver, GAsyncResult *result, GError **error)
+{
+	return propagate_lookup_result (resolver, result, uhm_resolver_lookup_records_async, error);
 }
 
 /**
@@ -265,32 +618,52 @@ uhm_resolver_new (void)
  * uhm_resolver_reset:
  * @self: a #UhmResolver
  *
- * Resets the state of the #UhmResolver, deleting all records added with uhm_resolver_add_A() and uhm_resolver_add_SRV().
+ * Resets the state of the #UhmResolver, deleting all records added with uhm_resolver_add_A(), uhm_resolver_add_AAAA() and
+ * uhm_resolver_add_SRV().
  */
 void
 uhm_resolver_reset (UhmResolver *self)
 {
-	GList *fake = NULL;
-
 	g_return_if_fail (UHM_IS_RESOLVER (self));
 
-	for (fake = self->priv->fake_A; fake != NULL; fake = g_list_next (fake)) {
-		FakeHost *entry = fake->data;
-		g_free (entry->key);
-		g_free (entry->addr);
-		g_free (entry);
-	}
-	g_list_free (self->priv->fake_A);
-	self->priv->fake_A = NULL;
-
-	for (fake = self->priv->fake_SRV; fake != NULL; fake = g_list_next (fake)) {
-		FakeService *entry = fake->data;
-		g_free (entry->key);
-		g_srv_target_free (entry->srv);
-		g_free (entry);
+	g_hash_table_remove_all (self->priv->fake_A);
+	g_hash_table_remove_all (self->priv->fake_SRV);
+
+	wildcard_node_free (self->priv->wildcard_A);
+	self->priv->wildcard_A = wildcard_node_new ();
+}
+
+/* Add a record mapping @hostname (which may be a wildcard) to @address, taking ownership of @address. */
+static gboolean
+add_host_record (UhmResolver *self, const gchar *hostname, GInetAddress *address)
+{
+	gchar *key;
+
+	if (g_str_has_prefix (hostname, "*.")) {
+		/* Wildcard record. */
+		key = (strchr (hostname + 2, '*') == NULL) ? normalise_name (hostname + 2) : NULL;
+
+		if (key == NULL || *key == '\0') {
+			g_free (key);
+			g_object_unref (address);
+			return FALSE;
+		}
+
+		add_wildcard_record (self, key, address);
+		g_free (key);
+	} else {
+		/* Exact record. */
+		key = (strchr (hostname, '*') == NULL) ? normalise_name (hostname) : NULL;
+
+		if (key == NULL) {
+			g_object_unref (address);
+			return FALSE;
+		}
+
+		add_record (self->priv->fake_A, key, address, g_object_unref);
 	}
-	g_list_free (self->priv->fake_SRV);
-	self->priv->fake_SRV = NULL;
+
+	return TRUE;
 }
 
 /**
@@ -301,25 +674,68 @@ uhm_resolver_reset (UhmResolver *self)
  *
  * Adds a resolution mapping from the host name @hostname to the IP address @addr.
  *
- * Return value: %TRUE on success; %FALSE otherwise
+ * Host names are matched case-insensitively. If several addresses are added for the same @hostname, lookups return all of them, in the order
+ * they were added.
+ *
+ * Since 0.4.0, @hostname may be a wildcard of the form ‘*.example.com’, which matches any host name ending in ‘.example.com’ (such as
+ * ‘foo.example.com’ or ‘foo.bar.example.com’, but not ‘example.com’ itself). Records for an exact host name take precedence over wildcard
+ * records, and wildcards with longer suffixes take precedence over those with shorter ones.
+ *
+ * Return value: %TRUE on success; %FALSE if @hostname is not a valid host name or @addr is not a valid IP address
  *
  * Since: 0.1.0
  */
 gboolean
 uhm_resolver_add_A (UhmResolver *self, const gchar *hostname, const gchar *addr)
 {
-	FakeHost *entry;
+	GInetAddress *address;
 
 	g_return_val_if_fail (UHM_IS_RESOLVER (self), FALSE);
 	g_return_val_if_fail (hostname != NULL && *hostname != '\0', FALSE);
 	g_return_val_if_fail (addr != NULL && *addr != '\0', FALSE);
 
-	entry = g_new0 (FakeHost, 1);
-	entry->key = g_strdup (hostname);
-	entry->addr = g_strdup (addr);
-	self->priv->fake_A = g_list_append (self->priv->fake_A, entry);
+	address = g_inet_address_new_from_string (addr);
 
-	return TRUE;
+	if (address == NULL) {
+		return FALSE;
+	}
+
+	return add_host_record (self, hostname, address);
+}
+
+/**
+ * uhm_resolver_add_AAAA:
+ * @self: a #UhmResolver
+ * @hostname: the hostname to match
+ * @addr: the IPv6 address to resolve to
+ *
+ * Adds a resolution mapping from the host name @hostname to the IPv6 address @addr. This behaves exactly as uhm_resolver_add_A(), including
+ * support for wildcards, except that @addr must be an IPv6 address. Lookups for @hostname return the IPv4 and IPv6 addresses added for it
+ * in the order they were added; lookups restricted to one address family only return the addresses in that family.
+ *
+ * Return value: %TRUE on success; %FALSE if @hostname is not a valid host name or @addr is not a valid IPv6 address
+ *
+ * Since: 0.4.0
+ */
+gboolean
+uhm_resolver_add_AAAA (UhmResolver *self, const gchar *hostname, const gchar *addr)
+{
+	GInetAddress *address;
+
+	g_return_val_if_fail (UHM_IS_RESOLVER (self), FALSE);
+	g_return_val_if_fail (hostname != NULL && *hostname != '\0', FALSE);
+	g_return_val_if_fail (addr != NULL && *addr != '\0', FALSE);
+
+	address = g_inet_address_new_from_string (addr);
+
+	if (address == NULL) {
+		return FALSE;
+	} else if (g_inet_address_get_family (address) != G_SOCKET_FAMILY_IPV6) {
+		g_object_unref (address);
+		return FALSE;
+	}
+
+	return add_host_record (self, hostname, address);
 }
 
 /**
@@ -333,7 +749,7 @@ uhm_resolver_add_A (UhmResolver *self, const gchar *hostname, const gchar *addr)
  *
  * Adds a resolution mapping the given @service (on @protocol and @domain) to the IP address @addr and given @port.
  *
- * Return value: %TRUE on success; %FALSE otherwise
+ * Return value: %TRUE on success; %FALSE if @domain is not a valid domain name
  *
  * Since: 0.1.0
  */
@@ -341,8 +757,6 @@ gboolean
 uhm_resolver_add_SRV (UhmResolver *self, const gchar *service, const gchar *protocol, const gchar *domain, const gchar *addr, guint16 port)
 {
 	gchar *key;
-	GSrvTarget *serv;
-	FakeService *entry;
 
 	g_return_val_if_fail (UHM_IS_RESOLVER (self), FALSE);
 	g_return_val_if_fail (service != NULL && *service != '\0', FALSE);
@@ -352,11 +766,12 @@ uhm_resolver_add_SRV (UhmResolver *self, const gchar *service, const gchar *prot
 	g_return_val_if_fail (port > 0, FALSE);
 
 	key = _service_rrname (service, protocol, domain);
-	entry = g_new0 (FakeService, 1);
-	serv = g_srv_target_new (addr, port, 0, 0);
-	entry->key = key;
-	entry->srv = serv;
-	self->priv->fake_SRV = g_list_append (self->priv->fake_SRV, entry);
+
+	if (key == NULL) {
+		return FALSE;
+	}
+
+	add_record (self->priv->fake_SRV, key, g_srv_target_new (addr, port, 0, 0), (GDestroyNotify) g_srv_target_free);
 
 	return TRUE;
 }
@@ -67,6 +67,7 @@ UhmResolver *uhm_resolver_new (void) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 void uhm_resolver_reset (UhmResolver *self);
 
 gboolean uhm_resolver_add_A (UhmResolver *self, const gchar *hostname, const gchar *addr);
+gboolean uhm_resolver_add_AAAA (UhmResolver *self, const gchar *hostname, const gchar *addr);
 gboolean uhm_resolver_add_SRV (UhmResolver *self, const gchar *service, const gchar *protocol, const gchar *domain, const gchar *addr, guint16 port);
 
 G_END_DECLS
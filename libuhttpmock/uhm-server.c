@@ -42,6 +42,10 @@
  *  • Comparing mode (#UhmServer:enable-logging: %FALSE, #UhmServer:enable-online: %TRUE): Requests are sent to the real server online, and
  *    the request–response pairs are compared against those in an existing log file to see if the log file is up-to-date.
  *
+ * Trace files are recorded in a line-based text format. They may be converted to a binary format using the
+ * <command>uhm-trace-compile</command> utility; binary trace files load faster, and preserve message bodies exactly (the text format
+ * cannot represent bodies containing nul bytes). uhm_server_load_trace() automatically detects which format a trace file is in.
+ *
  * Since: 0.1.0
  */
 
@@ -49,16 +53,24 @@
 
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <libsoup/soup.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#ifdef HAVE_GIO_UNIX
+#include <gio/gunixsocketaddress.h>
+#endif
 
 #include "uhm-default-tls-certificate.h"
 #include "uhm-resolver.h"
 #include "uhm-server.h"
+#include "uhm-trace.h"
+#include "uhm-trace-reader.h"
+#include "uhm-trace-writer.h"
+#include "uhm-histogram.h"
 
 GQuark
 uhm_server_error_quark (void)
@@ -75,14 +87,31 @@ static gboolean real_handle_message (UhmServer *self, SoupMessage *message, Soup
 static gboolean real_compare_messages (UhmServer *self, SoupMessage *expected_message, SoupMessage *actual_message, SoupClientContext *actual_client);
 
 static void server_handler_cb (SoupServer *server, SoupMessage *message, const gchar *path, GHashTable *query, SoupClientContext *client, gpointer user_data);
-static void load_file_stream_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
-static void load_file_iteration_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
-
-static GDataInputStream *load_file_stream (GFile *trace_file, GCancellable *cancellable, GError **error);
-static SoupMessage *load_file_iteration (GDataInputStream *input_stream, SoupURI *base_uri, GCancellable *cancellable, GError **error);
+static void load_trace_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
 
 static void apply_expected_domain_names (UhmServer *self);
 
+/* Multiple server threads are implemented by binding a SoupServer per thread to the same port, which needs SO_REUSEPORT and the newer
+ * SoupServer API. */
+#if defined(HAVE_LIBSOUP_2_47_3) && defined(SO_REUSEPORT)
+#define ENABLE_SERVER_THREADS 1
+
+/* An additional server, listening on the same port as the main one and running in its own thread. */
+typedef struct {
+	SoupServer *server;  /* owned */
+	GMainContext *context;  /* owned */
+	GMainLoop *main_loop;  /* owned */
+	GThread *thread;  /* owned; NULL once joined */
+} ServerThread;
+
+static void server_thread_free (ServerThread *data);
+#endif
+
+/* Listening on a Unix socket needs soup_server_listen_socket() from the newer SoupServer API, and GUnixSocketAddress. */
+#if defined(HAVE_LIBSOUP_2_47_3) && defined(HAVE_GIO_UNIX)
+#define ENABLE_UNIX_SOCKET 1
+#endif
+
 struct _UhmServerPrivate {
 	/* UhmServer is based around HTTP/HTTPS, and cannot be extended to support other application-layer protocols.
 	 * If libuhttpmock is extended to support other protocols (e.g. IMAP) in future, a new UhmImapServer should be
@@ -98,31 +127,69 @@ struct _UhmServerPrivate {
 #ifdef HAVE_LIBSOUP_2_47_3
 	GMainLoop *server_main_loop;
 #endif
+#ifdef ENABLE_SERVER_THREADS
+	GPtrArray/*<ServerThread>*/ *server_threads;  /* owned; additional servers if #UhmServer:n-threads is greater than 1 */
+#endif
+	guint n_threads;
 
 	/* TLS certificate. */
 	GTlsCertificate *tls_certificate;
 
 	/* Server interface. */
 #ifdef HAVE_LIBSOUP_2_47_3
-	GSocketAddress *address;  /* owned */
+	GSocketAddress *address;  /* owned; IPv4 loopback address */
 	gchar *address_string;  /* owned; cache */
 #else
 	SoupAddress *address; /* owned */
 #endif
 	guint port;
+	guint http_port;  /* port plain HTTP is served on; equal to port if transport_mode is HTTP, and 0 if it's HTTPS */
+	UhmServerTransportMode transport_mode;
+	gboolean enable_dual_stack;
+	gboolean listening_ipv6;  /* whether the server is also listening on the IPv6 loopback address, on the same port */
+	gchar *unix_socket_path;  /* owned; NULL if not listening on a Unix socket */
+	gchar *bound_unix_socket_path;  /* owned; path of the Unix socket the running server is listening on, which is removed when it stops */
 
 	/* Expected resolver domain names. */
 	gchar **expected_domain_names;
 
+	/* The trace state below may be accessed from several server threads at once, so must only be accessed with trace_lock held. */
+	GMutex trace_lock;
+	GMutex trace_reader_lock;  /* held while waiting for a message from trace_reader; taken before trace_lock */
+
 	GFile *trace_file;
-	GDataInputStream *input_stream;
-	GFileOutputStream *output_stream;
+	UhmTrace *trace;  /* owned; NULL if no trace is loaded or it has been preloaded */
+	gsize trace_offset;  /* offset of the next message to parse from trace */
+	UhmTraceReader *trace_reader;  /* owned; parses messages from trace, starting at trace_offset, ahead of them being needed */
+	SoupURI *base_uri;  /* owned; URI of the mock server, set while it's running; immutable */
+	SoupURI *online_base_uri;  /* owned; arbitrary base URI used for trace messages in online mode; immutable */
+	SoupURI *online_http_base_uri;  /* owned; as online_base_uri, but used if transport_mode is HTTP; immutable */
+	UhmTraceWriter *trace_writer;  /* owned; non-NULL while logging to a trace file */
 	SoupMessage *next_message;
 	guint message_counter; /* ID of the message within the current trace file */
 
+	/* If preloading is enabled, the entire trace file is parsed when it's loaded, and messages are taken from this array in order
+	 * rather than being lazily parsed from trace. */
+	GPtrArray/*<SoupMessage>*/ *preloaded_messages;  /* owned; NULL if preloading is disabled */
+	guint preloaded_messages_index;  /* index of the next message to take from preloaded_messages */
+
+	/* If out-of-order matching is enabled, the entire trace file is parsed when it's loaded, and indexed by request method, path and
+	 * query. Each incoming request is served from the earliest unconsumed message with the same key. */
+	GHashTable/*<MessageKey, GQueue<SoupMessage>>*/ *message_index;  /* owned; NULL if out-of-order matching is disabled */
+
 	GFile *trace_directory;
 	gboolean enable_online;
 	gboolean enable_logging;
+	gboolean enable_preloading;
+	gboolean enable_out_of_order_matching;
+	gboolean enable_background_logging;
+	gboolean enable_replay_timing;
+	gdouble replay_speed;
+	guint bandwidth_limit;
+
+	/* Statistics about the requests handled by real_handle_message(). */
+	GMutex statistics_lock;
+	UhmServerStatistics statistics;  /* protected by statistics_lock */
 
 	GByteArray *comparison_message;
 	enum {
@@ -142,10 +209,23 @@ enum {
 	PROP_PORT,
 	PROP_RESOLVER,
 	PROP_TLS_CERTIFICATE,
+	PROP_ENABLE_PRELOADING,
+	PROP_ENABLE_OUT_OF_ORDER_MATCHING,
+	PROP_N_THREADS,
+	PROP_ENABLE_BACKGROUND_LOGGING,
+	PROP_ENABLE_REPLAY_TIMING,
+	PROP_REPLAY_SPEED,
+	PROP_BANDWIDTH_LIMIT,
+	PROP_STATISTICS,
+	PROP_ENABLE_DUAL_STACK,
+	PROP_UNIX_SOCKET_PATH,
+	PROP_TRANSPORT_MODE,
+	PROP_HTTP_PORT,
 };
 
 enum {
 	SIGNAL_HANDLE_MESSAGE = 1,
+	SIGNAL_HANDLE_MESSAGE_ASYNC,
 	SIGNAL_COMPARE_MESSAGES,
 	LAST_SIGNAL,
 };
@@ -154,6 +234,59 @@ static guint signals[LAST_SIGNAL] = { 0, };
 
 G_DEFINE_TYPE (UhmServer, uhm_server, G_TYPE_OBJECT)
 
+G_DEFINE_BOXED_TYPE (UhmServerStatistics, uhm_server_statistics, uhm_server_statistics_copy, uhm_server_statistics_free)
+
+GType
+uhm_server_transport_mode_get_type (void)
+{
+	static gsize type_id = 0;
+
+	if (g_once_init_enter (&type_id)) {
+		static const GEnumValue values[] = {
+			{ UHM_SERVER_TRANSPORT_MODE_HTTPS, "UHM_SERVER_TRANSPORT_MODE_HTTPS", "https" },
+			{ UHM_SERVER_TRANSPORT_MODE_HTTP, "UHM_SERVER_TRANSPORT_MODE_HTTP", "http" },
+			{ UHM_SERVER_TRANSPORT_MODE_BOTH, "UHM_SERVER_TRANSPORT_MODE_BOTH", "both" },
+			{ 0, NULL, NULL }
+		};
+		GType id;
+
+		id = g_enum_register_static (g_intern_static_string ("UhmServerTransportMode"), values);
+		g_once_init_leave (&type_id, id);
+	}
+
+	return type_id;
+}
+
+#define N_PHASES (UHM_SERVER_PHASE_TOTAL + 1)
+
+/* UhmServerStatistics.histograms is an array of N_PHASES UhmHistograms, holding latencies in microseconds. */
+static gpointer
+statistics_histograms_new (void)
+{
+	UhmHistogram **histograms;
+	guint i;
+
+	histograms = g_new (UhmHistogram *, N_PHASES);
+
+	for (i = 0; i < N_PHASES; i++) {
+		histograms[i] = uhm_histogram_new ();
+	}
+
+	return histograms;
+}
+
+static void
+statistics_histograms_free (gpointer histograms)
+{
+	guint i;
+
+	for (i = 0; i < N_PHASES; i++) {
+		uhm_histogram_free (((UhmHistogram **) histograms)[i]);
+	}
+
+	g_free (histograms);
+}
+
 static void
 uhm_server_class_init (UhmServerClass *klass)
 {
@@ -287,6 +420,237 @@ uhm_server_class_init (UhmServerClass *klass)
 	                                                      G_TYPE_TLS_CERTIFICATE,
 	                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+	/**
+	 * UhmServer:enable-preloading:
+	 *
+	 * %TRUE if trace files should be entirely parsed when they are loaded by uhm_server_load_trace() or uhm_server_load_trace_async();
+	 * %FALSE to parse each request–response pair lazily as the corresponding request is received.
+	 *
+	 * Preloading moves the cost of parsing the trace file out of the request path, so that the mock server only has to look up the next
+	 * expected message when handling a request. This reduces response latency for traces with many messages, at the cost of holding the
+	 * entire parsed trace in memory and of taking longer to load it. Changes to the property take effect on the next call to
+	 * uhm_server_load_trace() or uhm_server_load_trace_async().
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_PRELOADING,
+	                                 g_param_spec_boolean ("enable-preloading",
+	                                                       "Enable Preloading", "Whether trace files should be entirely parsed when loaded.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-out-of-order-matching:
+	 *
+	 * %TRUE if incoming requests may be matched against request–response pairs in the trace file in any order; %FALSE to require
+	 * requests to arrive in exactly the order they appear in the trace file.
+	 *
+	 * When enabled, trace files are entirely parsed when they are loaded (as with #UhmServer:enable-preloading), and indexed by request
+	 * method, path and query. Each incoming request is served from the earliest request–response pair in the trace which has the same
+	 * method, path and query and which has not already been used. That pair is then checked using #UhmServer::compare-messages as normal.
+	 * This allows clients which make requests in parallel, over several connections, to be tested against a trace. Changes to the property
+	 * take effect on the next call to uhm_server_load_trace() or uhm_server_load_trace_async().
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_OUT_OF_ORDER_MATCHING,
+	                                 g_param_spec_boolean ("enable-out-of-order-matching",
+	                                                       "Enable Out-of-Order Matching",
+	                                                       "Whether requests may be matched against the trace file in any order.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:n-threads:
+	 *
+	 * Number of threads the mock server uses to handle requests. By default, a single thread handles all connections to the server. If this
+	 * is greater than 1, that many threads each accept and handle connections, all listening on the same port, so that the server can make
+	 * use of several CPU cores when it has many concurrent clients. Changes to the property take effect on the next call to
+	 * uhm_server_run().
+	 *
+	 * If more than one thread is used, #UhmServer::handle-message and #UhmServer::compare-messages may be emitted from several threads
+	 * concurrently, so handlers for them must be thread safe. #UhmServer::compare-messages is emitted with an internal lock held, so its
+	 * handlers must not call back into the #UhmServer.
+	 *
+	 * Multiple threads are only supported on platforms which support <code class="literal">SO_REUSEPORT</code>, and with libsoup 2.47.3 or
+	 * later. Otherwise, a single thread is always used.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_N_THREADS,
+	                                 g_param_spec_uint ("n-threads",
+	                                                    "Number of Threads", "Number of threads the mock server uses to handle requests.",
+	                                                    1, G_MAXUINT, 1,
+	                                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-background-logging:
+	 *
+	 * %TRUE if trace files should be written to disk by a worker thread when logging; %FALSE to write them from the thread which calls
+	 * uhm_server_received_message_chunk().
+	 *
+	 * Trace files are always buffered while logging, and written out once each response has been received in full. With background
+	 * logging, uhm_server_received_message_chunk() never blocks on disk I/O, but errors writing the trace file are only reported by the
+	 * call after the one which caused them, and uhm_server_end_trace() waits for all pending writes to complete. Changes to the property
+	 * take effect on the next call to uhm_server_start_trace() or uhm_server_start_trace_full().
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_BACKGROUND_LOGGING,
+	                                 g_param_spec_boolean ("enable-background-logging",
+	                                                       "Enable Background Logging",
+	                                                       "Whether trace files should be written to disk by a worker thread.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-replay-timing:
+	 *
+	 * %TRUE if responses from the trace file should be delayed by the time the real server originally took to respond; %FALSE to respond
+	 * to requests immediately.
+	 *
+	 * The delay is the difference between the <literal>Soup-Debug-Timestamp</literal> headers which libsoup records in the request and
+	 * response of each message in the trace file, scaled by #UhmServer:replay-speed. Those timestamps only have a resolution of one
+	 * second. Messages which don't have both headers are not delayed, and nor are responses from #UhmServer::handle-message handlers
+	 * which don't chain up.
+	 *
+	 * Delayed responses are sent from a timeout in the server's main context, so the server continues to handle other requests while
+	 * they are pending.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_REPLAY_TIMING,
+	                                 g_param_spec_boolean ("enable-replay-timing",
+	                                                       "Enable Replay Timing",
+	                                                       "Whether responses should be delayed by their recorded latency.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:replay-speed:
+	 *
+	 * Factor to speed up replay timing by, if #UhmServer:enable-replay-timing is %TRUE. For example, a value of 2.0 halves the delay
+	 * before each response, and a value of 0.5 doubles it.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_REPLAY_SPEED,
+	                                 g_param_spec_double ("replay-speed",
+	                                                      "Replay Speed", "Factor to speed up replay timing by.",
+	                                                      0.01, 100.0, 1.0,
+	                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:bandwidth-limit:
+	 *
+	 * Maximum rate to send response bodies at, in bytes per second, or 0 to send them as fast as possible. This can be used to test how
+	 * clients behave over slow connections.
+	 *
+	 * Throttled bodies are appended to the response in small chunks from a timeout in the server's main context, so any number of
+	 * responses can be throttled at once without needing extra threads. The limit applies separately to each response, and to the
+	 * body which has been set on it by the time #UhmServer::handle-message returns.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_BANDWIDTH_LIMIT,
+	                                 g_param_spec_uint ("bandwidth-limit",
+	                                                    "Bandwidth Limit", "Maximum rate to send response bodies at, in bytes per second.",
+	                                                    0, G_MAXUINT, 0,
+	                                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:enable-dual-stack:
+	 *
+	 * %TRUE if the mock server should listen on the IPv6 loopback address (<literal>::1</literal>) as well as the IPv4 one, on the same
+	 * port; %FALSE to only listen on the IPv4 loopback address. This can be used to test how clients choose between IPv4 and IPv6
+	 * addresses when connecting, for example when they implement ‘Happy Eyeballs’.
+	 *
+	 * If the server is listening on both addresses, uhm_server_set_expected_domain_names() adds an AAAA record for each domain name as
+	 * well as an A record. #UhmServer:address is always the IPv4 address. If IPv6 is not supported on the system, the server silently
+	 * listens only on the IPv4 address. Changes to the property take effect on the next call to uhm_server_run().
+	 *
+	 * Dual-stack listening requires libsoup 2.47.3 or later. Otherwise, the server always only listens on the IPv4 address.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_ENABLE_DUAL_STACK,
+	                                 g_param_spec_boolean ("enable-dual-stack",
+	                                                       "Enable Dual Stack",
+	                                                       "Whether the server should listen on the IPv6 loopback address as well as the IPv4 one.",
+	                                                       FALSE,
+	                                                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:unix-socket-path:
+	 *
+	 * Path of a Unix domain socket for the mock server to listen on, in addition to its TCP/IP address, or %NULL to not listen on one.
+	 * Paths which start with ‘@’ are in the abstract socket namespace (with the ‘@’ removed), rather than on the file system. A socket
+	 * created on the file system is deleted when the server is stopped. Changes to the property take effect on the next call to
+	 * uhm_server_run().
+	 *
+	 * Connections to the Unix socket avoid the overhead of TCP/IP and always use plain HTTP rather than HTTPS, so they are cheaper to
+	 * make and to send requests over than connections to #UhmServer:address. They are handled by the first server thread only (see
+	 * #UhmServer:n-threads).
+	 *
+	 * Unix sockets are only supported on Unix platforms, and with libsoup 2.47.3 or later. Otherwise, this property is ignored.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_UNIX_SOCKET_PATH,
+	                                 g_param_spec_string ("unix-socket-path",
+	                                                      "Unix Socket Path", "Path of a Unix domain socket for the mock server to listen on.",
+	                                                      NULL,
+	                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:transport-mode:
+	 *
+	 * Transport the mock server serves requests over. By default, the server only serves HTTPS, which needs #UhmServer:tls-certificate
+	 * to be set. If the client code under test doesn't need to be tested over HTTPS, it can be cheaper to serve plain HTTP instead, which
+	 * avoids the overhead of TLS. The transport is also reflected in the scheme of the URIs which trace messages are resolved against.
+	 *
+	 * In %UHM_SERVER_TRANSPORT_MODE_BOTH, HTTPS is served on #UhmServer:port and plain HTTP on #UhmServer:http-port. Changes to the
+	 * property take effect on the next call to uhm_server_run().
+	 *
+	 * %UHM_SERVER_TRANSPORT_MODE_BOTH is only supported with libsoup 2.47.3 or later. Otherwise, it behaves the same as
+	 * %UHM_SERVER_TRANSPORT_MODE_HTTPS.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_TRANSPORT_MODE,
+	                                 g_param_spec_enum ("transport-mode",
+	                                                    "Transport Mode", "Transport the mock server serves requests over.",
+	                                                    UHM_TYPE_SERVER_TRANSPORT_MODE, UHM_SERVER_TRANSPORT_MODE_HTTPS,
+	                                                    G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:http-port:
+	 *
+	 * Port the local mock server serves plain HTTP on if it's running, or <code class="literal">0</code> if it's not running or isn't
+	 * serving plain HTTP (see #UhmServer:transport-mode). If the server only serves plain HTTP, this is the same as #UhmServer:port.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_HTTP_PORT,
+	                                 g_param_spec_uint ("http-port",
+	                                                    "Server HTTP Port", "Port the local mock server serves plain HTTP on if it's running.",
+	                                                    0, G_MAXUINT, 0,
+	                                                    G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	/**
+	 * UhmServer:statistics:
+	 *
+	 * A snapshot of the statistics about requests handled by the server. See uhm_server_get_statistics(). Change notifications are not
+	 * emitted for this property.
+	 *
+	 * Since: 0.4.0
+	 */
+	g_object_class_install_property (gobject_class, PROP_STATISTICS,
+	                                 g_param_spec_boxed ("statistics",
+	                                                     "Statistics", "Statistics about requests handled by the server.",
+	                                                     UHM_TYPE_SERVER_STATISTICS,
+	                                                     G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
 	/**
 	 * UhmServer::handle-message:
 	 * @self: a #UhmServer
@@ -308,6 +672,33 @@ uhm_server_class_init (UhmServerClass *klass)
 	                                               G_TYPE_BOOLEAN, 2,
 	                                               SOUP_TYPE_MESSAGE, SOUP_TYPE_CLIENT_CONTEXT);
 
+	/**
+	 * UhmServer::handle-message-async:
+	 * @self: a #UhmServer
+	 * @message: a message containing the incoming HTTP(S) request, and which the outgoing HTTP(S) response should be set on
+	 * @client: additional data about the HTTP client making the request
+	 *
+	 * Emitted whenever the mock server is running and receives a request from a client, before #UhmServer::handle-message. This is an
+	 * asynchronous counterpart to #UhmServer::handle-message: signal handlers may take responsibility for @message and return immediately,
+	 * then set a response on it and call uhm_server_complete_message() later, from any thread. In the meantime, the server thread is free to
+	 * handle requests on other connections. There is no default handler.
+	 *
+	 * Signal handlers should return %TRUE if they have taken responsibility for the request, in which case they must eventually call
+	 * uhm_server_complete_message() for @message; and %FALSE otherwise. If no handler returns %TRUE, #UhmServer::handle-message is emitted
+	 * to handle the request synchronously. @message and @client remain valid until uhm_server_complete_message() is called.
+	 *
+	 * There is no corresponding #UhmServerClass member, as adding one would change the size of the class structure and break the ABI of
+	 * existing subclasses.
+	 *
+	 * Since: 0.4.0
+	 */
+	signals[SIGNAL_HANDLE_MESSAGE_ASYNC] = g_signal_new ("handle-message-async", G_OBJECT_CLASS_TYPE (klass), G_SIGNAL_RUN_LAST,
+	                                                     0,
+	                                                     g_signal_accumulator_true_handled, NULL,
+	                                                     g_cclosure_marshal_generic,
+	                                                     G_TYPE_BOOLEAN, 2,
+	                                                     SOUP_TYPE_MESSAGE, SOUP_TYPE_CLIENT_CONTEXT);
+
 	/**
 	 * UhmServer::compare-messages:
 	 * @self: a #UhmServer
@@ -336,6 +727,34 @@ static void
 uhm_server_init (UhmServer *self)
 {
 	self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, UHM_TYPE_SERVER, UhmServerPrivate);
+	self->priv->n_threads = 1;
+	self->priv->replay_speed = 1.0;
+	self->priv->statistics.histograms = statistics_histograms_new ();
+	g_mutex_init (&self->priv->statistics_lock);
+	self->priv->online_base_uri = soup_uri_new ("https://localhost"); /* arbitrary */
+	self->priv->online_http_base_uri = soup_uri_new ("http://localhost"); /* arbitrary */
+	g_mutex_init (&self->priv->trace_lock);
+	g_mutex_init (&self->priv->trace_reader_lock);
+}
+
+/* Write out the rest of the trace file being logged, if any, and stop logging. There's no way to report errors from the callers of this, so
+ * just warn about them. */
+static void
+close_trace_writer (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+	GError *child_error = NULL;
+
+	if (priv->trace_writer == NULL) {
+		return;
+	}
+
+	if (uhm_trace_writer_close (priv->trace_writer, &child_error) == FALSE) {
+		g_warning ("Error writing trace file: %s", child_error->message);
+		g_error_free (child_error);
+	}
+
+	g_clear_pointer (&priv->trace_writer, uhm_trace_writer_free);
 }
 
 static void
@@ -346,11 +765,17 @@ uhm_server_dispose (GObject *object)
 	g_clear_object (&priv->resolver);
 	g_clear_object (&priv->server);
 	g_clear_pointer (&priv->server_context, g_main_context_unref);
-	g_clear_object (&priv->input_stream);
+#ifdef ENABLE_SERVER_THREADS
+	g_clear_pointer (&priv->server_threads, g_ptr_array_unref);
+#endif
 	g_clear_object (&priv->trace_file);
-	g_clear_object (&priv->input_stream);
-	g_clear_object (&priv->output_stream);
+	g_clear_pointer (&priv->trace_reader, uhm_trace_reader_unref);
+	g_clear_pointer (&priv->trace, uhm_trace_unref);
+	/* Don't lose any buffered trace data if the server is disposed of without uhm_server_end_trace() being called. */
+	close_trace_writer (UHM_SERVER (object));
 	g_clear_object (&priv->next_message);
+	g_clear_pointer (&priv->preloaded_messages, g_ptr_array_unref);
+	g_clear_pointer (&priv->message_index, g_hash_table_unref);
 	g_clear_object (&priv->trace_directory);
 	g_clear_pointer (&priv->server_thread, g_thread_unref);
 	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
@@ -366,6 +791,15 @@ uhm_server_finalize (GObject *object)
 	UhmServerPrivate *priv = UHM_SERVER (object)->priv;
 
 	g_strfreev (priv->expected_domain_names);
+	g_free (priv->unix_socket_path);
+	g_free (priv->bound_unix_socket_path);
+	g_clear_pointer (&priv->base_uri, soup_uri_free);
+	soup_uri_free (priv->online_base_uri);
+	soup_uri_free (priv->online_http_base_uri);
+	g_mutex_clear (&priv->trace_reader_lock);
+	g_mutex_clear (&priv->trace_lock);
+	statistics_histograms_free (priv->statistics.histograms);
+	g_mutex_clear (&priv->statistics_lock);
 
 	/* Chain up to the parent class */
 	G_OBJECT_CLASS (uhm_server_parent_class)->finalize (object);
@@ -398,6 +832,42 @@ uhm_server_get_property (GObject *object, guint property_id, GValue *value, GPar
 		case PROP_TLS_CERTIFICATE:
 			g_value_set_object (value, priv->tls_certificate);
 			break;
+		case PROP_ENABLE_PRELOADING:
+			g_value_set_boolean (value, priv->enable_preloading);
+			break;
+		case PROP_ENABLE_OUT_OF_ORDER_MATCHING:
+			g_value_set_boolean (value, priv->enable_out_of_order_matching);
+			break;
+		case PROP_N_THREADS:
+			g_value_set_uint (value, priv->n_threads);
+			break;
+		case PROP_ENABLE_BACKGROUND_LOGGING:
+			g_value_set_boolean (value, priv->enable_background_logging);
+			break;
+		case PROP_ENABLE_REPLAY_TIMING:
+			g_value_set_boolean (value, priv->enable_replay_timing);
+			break;
+		case PROP_REPLAY_SPEED:
+			g_value_set_double (value, priv->replay_speed);
+			break;
+		case PROP_BANDWIDTH_LIMIT:
+			g_value_set_uint (value, priv->bandwidth_limit);
+			break;
+		case PROP_STATISTICS:
+			g_value_take_boxed (value, uhm_server_get_statistics (UHM_SERVER (object)));
+			break;
+		case PROP_ENABLE_DUAL_STACK:
+			g_value_set_boolean (value, priv->enable_dual_stack);
+			break;
+		case PROP_UNIX_SOCKET_PATH:
+			g_value_set_string (value, priv->unix_socket_path);
+			break;
+		case PROP_TRANSPORT_MODE:
+			g_value_set_enum (value, priv->transport_mode);
+			break;
+		case PROP_HTTP_PORT:
+			g_value_set_uint (value, priv->http_port);
+			break;
 		default:
 			/* We don't have any other property... */
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -423,9 +893,41 @@ uhm_server_set_property (GObject *object, guint property_id, const GValue *value
 		case PROP_TLS_CERTIFICATE:
 			uhm_server_set_tls_certificate (self, g_value_get_object (value));
 			break;
+		case PROP_ENABLE_PRELOADING:
+			uhm_server_set_enable_preloading (self, g_value_get_boolean (value));
+			break;
+		case PROP_ENABLE_OUT_OF_ORDER_MATCHING:
+			uhm_server_set_enable_out_of_order_matching (self, g_value_get_boolean (value));
+			break;
+		case PROP_N_THREADS:
+			uhm_server_set_n_threads (self, g_value_get_uint (value));
+			break;
+		case PROP_ENABLE_BACKGROUND_LOGGING:
+			uhm_server_set_enable_background_logging (self, g_value_get_boolean (value));
+			break;
+		case PROP_ENABLE_REPLAY_TIMING:
+			uhm_server_set_enable_replay_timing (self, g_value_get_boolean (value));
+			break;
+		case PROP_REPLAY_SPEED:
+			uhm_server_set_replay_speed (self, g_value_get_double (value));
+			break;
+		case PROP_BANDWIDTH_LIMIT:
+			uhm_server_set_bandwidth_limit (self, g_value_get_uint (value));
+			break;
+		case PROP_ENABLE_DUAL_STACK:
+			uhm_server_set_enable_dual_stack (self, g_value_get_boolean (value));
+			break;
+		case PROP_UNIX_SOCKET_PATH:
+			uhm_server_set_unix_socket_path (self, g_value_get_string (value));
+			break;
+		case PROP_TRANSPORT_MODE:
+			uhm_server_set_transport_mode (self, g_value_get_enum (value));
+			break;
 		case PROP_ADDRESS:
 		case PROP_PORT:
+		case PROP_HTTP_PORT:
 		case PROP_RESOLVER:
+		case PROP_STATISTICS:
 			/* Read-only. */
 		default:
 			/* We don't have any other property... */
@@ -434,46 +936,38 @@ uhm_server_set_property (GObject *object, guint property_id, const GValue *value
 	}
 }
 
-typedef struct {
-	GDataInputStream *input_stream;
+/* Build the base URI of the running mock server. This is called once, when the server starts listening. */
+static SoupURI * /* transfer full */
+build_server_base_uri (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
 	SoupURI *base_uri;
-} LoadFileIterationData;
 
-static void
-load_file_iteration_data_free (LoadFileIterationData *data)
-{
-	g_object_unref (data->input_stream);
-	soup_uri_free (data->base_uri);
-	g_slice_free (LoadFileIterationData, data);
+	/* The server may be listening on several sockets, so build the URI from #UhmServer:address and #UhmServer:port, rather than from
+	 * whichever listener comes first. */
+	base_uri = soup_uri_new (NULL);
+	soup_uri_set_scheme (base_uri, (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_HTTP) ? SOUP_URI_SCHEME_HTTP : SOUP_URI_SCHEME_HTTPS);
+	soup_uri_set_host (base_uri, uhm_server_get_address (self));
+	soup_uri_set_port (base_uri, priv->port);
+	soup_uri_set_path (base_uri, "/");
+
+	return base_uri;
 }
 
-static SoupURI * /* transfer full */
-build_base_uri (UhmServer *self)
+/* Get the base URI to resolve URIs from the trace file against. This is immutable, so may be used from any thread without copying it. */
+static SoupURI * /* transfer none */
+get_base_uri (UhmServer *self)
 {
 	UhmServerPrivate *priv = self->priv;
-	gchar *base_uri_string;
-	SoupURI *base_uri;
 
 	if (priv->enable_online == FALSE) {
-#ifdef HAVE_LIBSOUP_2_47_3
-		GSList *uris;  /* owned */
-		uris = soup_server_get_uris (priv->server);
-		if (uris == NULL) {
-			return NULL;
-		}
-		base_uri_string = soup_uri_to_string (uris->data, FALSE);
-		g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
-#else
-		base_uri_string = g_strdup_printf ("https://%s:%u", soup_address_get_physical (self->priv->address), self->priv->port);
-#endif
+		/* NULL if the server isn't running. */
+		return priv->base_uri;
+	} else if (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_HTTP) {
+		return priv->online_http_base_uri;
 	} else {
-		base_uri_string = g_strdup ("https://localhost"); /* arbitrary */
+		return priv->online_base_uri;
 	}
-
-	base_uri = soup_uri_new (base_uri_string);
-	g_free (base_uri_string);
-
-	return base_uri;
 }
 
 static inline gboolean
@@ -522,743 +1016,979 @@ compare_incoming_message (UhmServer *self, SoupMessage *expected_message, SoupMe
 	return (messages_equal == TRUE) ? 0 : 1;
 }
 
-static void
-header_append_cb (const gchar *name, const gchar *value, gpointer user_data)
-{
-	SoupMessage *message = user_data;
-
-	soup_message_headers_append (message->response_headers, name, value);
-}
+/* Maximum number of messages to parse from a trace ahead of them being needed, if it isn't preloaded. */
+#define TRACE_READ_AHEAD 16
 
+/* Start parsing messages from the trace in a worker thread, ahead of them being needed, if that hasn't been started already. The messages are
+ * resolved relative to the current base URI, so this should be called once it's known. This must be called with trace_lock held. */
 static void
-server_response_append_headers (UhmServer *self, SoupMessage *message)
+start_trace_reader (UhmServer *self)
 {
 	UhmServerPrivate *priv = self->priv;
-	gchar *trace_file_name, *trace_file_offset;
 
-	trace_file_name = g_file_get_uri (priv->trace_file);
-	soup_message_headers_append (message->response_headers, "X-Mock-Trace-File", trace_file_name);
-	g_free (trace_file_name);
-
-	trace_file_offset = g_strdup_printf ("%u", priv->message_counter);
-	soup_message_headers_append (message->response_headers, "X-Mock-Trace-File-Offset", trace_file_offset);
-	g_free (trace_file_offset);
+	if (priv->trace != NULL && priv->trace_reader == NULL) {
+		priv->trace_reader = uhm_trace_reader_new (priv->trace, priv->trace_offset, get_base_uri (self), TRACE_READ_AHEAD);
+	}
 }
 
-static void
-server_process_message (UhmServer *self, SoupMessage *message, SoupClientContext *client)
+/* Waits for the trace reader to parse the next message from the trace and makes it the next expected message, unless another thread has
+ * already done so. The worker thread may be part way through parsing a large message, so this must be called without trace_lock held, to
+ * avoid blocking other threads which don't need the reader meanwhile. Only one thread waits for the reader at once, so messages become the
+ * next expected message in the order they appear in the trace. Returns %FALSE if the end of the trace has been reached. */
+static gboolean
+read_next_trace_message (UhmServer *self)
 {
 	UhmServerPrivate *priv = self->priv;
-	SoupBuffer *message_body;
-	goffset expected_content_length;
-
-	g_assert (priv->next_message != NULL);
-	priv->message_counter++;
-
-	if (compare_incoming_message (self, priv->next_message, message, client) != 0) {
-		gchar *body, *next_uri, *actual_uri;
-
-		/* Received message is not what we expected. Return an error. */
-		soup_message_set_status_full (message, SOUP_STATUS_BAD_REQUEST, "Unexpected request to mock server");
-
-		next_uri = soup_uri_to_string (soup_message_get_uri (priv->next_message), TRUE);
-		actual_uri = soup_uri_to_string (soup_message_get_uri (message), TRUE);
-		body = g_strdup_printf ("Expected %s URI ‘%s’, but got %s ‘%s’.", priv->next_message->method, next_uri, message->method, actual_uri);
-		g_free (actual_uri);
-		g_free (next_uri);
-		soup_message_body_append_take (message->response_body, (guchar *) body, strlen (body));
+	UhmTraceReader *reader = NULL;
+	SoupMessage *message;
+	gboolean end_of_trace;
 
-		server_response_append_headers (self, message);
+	g_mutex_lock (&priv->trace_reader_lock);
+	g_mutex_lock (&priv->trace_lock);
 
-		return;
+	if (priv->next_message == NULL && priv->trace != NULL && priv->message_index == NULL && priv->preloaded_messages == NULL) {
+		start_trace_reader (self);
+		reader = uhm_trace_reader_ref (priv->trace_reader);
 	}
 
-	/* The incoming message matches what we expected, so copy the headers and body from the expected response and return it. */
-	soup_message_set_http_version (message, soup_message_get_http_version (priv->next_message));
-	soup_message_set_status_full (message, priv->next_message->status_code, priv->next_message->reason_phrase);
-	soup_message_headers_foreach (priv->next_message->response_headers, header_append_cb, message);
-
-	/* Add debug headers to identify the message and trace file. */
-	server_response_append_headers (self, message);
+	g_mutex_unlock (&priv->trace_lock);
 
-	message_body = soup_message_body_flatten (priv->next_message->response_body);
-	if (message_body->length > 0) {
-		soup_message_body_append_buffer (message->response_body, message_body);
+	if (reader == NULL) {
+		/* Another thread read the next message while this one was waiting for trace_reader_lock, or the trace was unloaded. */
+		g_mutex_unlock (&priv->trace_reader_lock);
+		return TRUE;
 	}
 
-	/* If the log file doesn't contain the full response body (e.g. because it's a huge binary file containing a nul byte somewhere),
-	 * make one up (all zeros). */
-	expected_content_length = soup_message_headers_get_content_length (message->response_headers);
-	if (expected_content_length > 0 && message_body->length < (guint64) expected_content_length) {
-		guint8 *buf;
+	message = uhm_trace_reader_next_message (reader);
 
-		buf = g_malloc0 (expected_content_length - message_body->length);
-		soup_message_body_append_take (message->response_body, buf, expected_content_length - message_body->length);
+	g_mutex_lock (&priv->trace_lock);
+
+	/* The trace may have been unloaded or replaced while waiting, in which case the message is stale. The reference to the reader ensures it
+	 * can't have been freed and its address reused meanwhile. Nothing else sets next_message while the reader is in use. */
+	if (priv->trace_reader == reader) {
+		g_assert (priv->next_message == NULL);
+		priv->next_message = message;
+		end_of_trace = (message == NULL);
+	} else {
+		g_clear_object (&message);
+		end_of_trace = FALSE;
 	}
 
-	soup_buffer_free (message_body);
+	g_mutex_unlock (&priv->trace_lock);
+	g_mutex_unlock (&priv->trace_reader_lock);
 
-	soup_message_body_complete (message->response_body);
+	/* If the trace was unloaded meanwhile, this stops the worker thread, so must be done without the locks held. */
+	uhm_trace_reader_unref (reader);
 
-	/* Clear the expected message. */
-	g_clear_object (&priv->next_message);
+	return !end_of_trace;
 }
 
-static void
-server_handler_cb (SoupServer *server, SoupMessage *message, const gchar *path, GHashTable *query, SoupClientContext *client, gpointer user_data)
+/* Returns the next message from the preloaded trace, or %NULL if all its messages have been consumed. */
+static SoupMessage * /* transfer full */
+take_next_preloaded_message (UhmServer *self)
 {
-	UhmServer *self = user_data;
-	gboolean message_handled = FALSE;
+	UhmServerPrivate *priv = self->priv;
 
-	soup_server_pause_message (server, message);
-	g_signal_emit (self, signals[SIGNAL_HANDLE_MESSAGE], 0, message, client, &message_handled);
-	soup_server_unpause_message (server, message);
+	g_assert (priv->preloaded_messages != NULL);
 
-	/* The message should always be handled by real_handle_message() at least. */
-	g_assert (message_handled == TRUE);
+	if (priv->preloaded_messages_index >= priv->preloaded_messages->len) {
+		return NULL;
+	}
+
+	return g_object_ref (g_ptr_array_index (priv->preloaded_messages, priv->preloaded_messages_index++));
 }
 
-static gboolean
-real_handle_message (UhmServer *self, SoupMessage *message, SoupClientContext *client)
-{
-	UhmServerPrivate *priv = self->priv;
-	gboolean handled = FALSE;
+/* Key for the index of messages used for out-of-order matching. */
+typedef struct {
+	const gchar *method;  /* interned */
+	gchar *path;  /* owned */
+	gchar *query;  /* owned; may be NULL */
+} MessageKey;
 
-	/* Asynchronously load the next expected message from the trace file. */
-	if (priv->next_message == NULL) {
-		GTask *task;
-		LoadFileIterationData *data;
-		GError *child_error = NULL;
+static guint
+message_key_hash (gconstpointer key)
+{
+	const MessageKey *message_key = key;
+	guint hash;
 
-		data = g_slice_new (LoadFileIterationData);
-		data->input_stream = g_object_ref (priv->input_stream);
-		data->base_uri = build_base_uri (self);
+	hash = g_str_hash (message_key->method);
+	hash = hash * 31 + g_str_hash (message_key->path);
 
-		task = g_task_new (self, NULL, NULL, NULL);
-		g_task_set_task_data (task, data, (GDestroyNotify) load_file_iteration_data_free);
-		g_task_run_in_thread_sync (task, load_file_iteration_thread_cb);
+	if (message_key->query != NULL) {
+		hash = hash * 31 + g_str_hash (message_key->query);
+	}
 
-		/* Handle the results. */
-		priv->next_message = g_task_propagate_pointer (task, &child_error);
+	return hash;
+}
 
-		g_object_unref (task);
+static gboolean
+message_key_equal (gconstpointer a, gconstpointer b)
+{
+	const MessageKey *key_a = a, *key_b = b;
 
-		if (child_error != NULL) {
-			gchar *body;
+	return (strcmp (key_a->method, key_b->method) == 0 && strcmp (key_a->path, key_b->path) == 0 &&
+	        g_strcmp0 (key_a->query, key_b->query) == 0);
+}
 
-			soup_message_set_status_full (message, SOUP_STATUS_INTERNAL_SERVER_ERROR, "Error loading expected request");
+static void
+message_key_free (MessageKey *key)
+{
+	g_free (key->query);
+	g_free (key->path);
+	g_slice_free (MessageKey, key);
+}
 
-			body = g_strdup_printf ("Error: %s", child_error->message);
-			soup_message_body_append_take (message->response_body, (guchar *) body, strlen (body));
-			handled = TRUE;
+static void
+message_queue_free (GQueue *queue)
+{
+	g_queue_free_full (queue, g_object_unref);
+}
 
-			g_error_free (child_error);
+/* Build an index of the given messages for out-of-order matching. Messages with the same key are queued in trace order. */
+static GHashTable/*<MessageKey, GQueue<SoupMessage>>*/ *
+build_message_index (GPtrArray/*<SoupMessage>*/ *messages)
+{
+	GHashTable *message_index;
+	guint i;
 
-			server_response_append_headers (self, message);
-		} else if (priv->next_message == NULL) {
-			gchar *body, *actual_uri;
+	message_index = g_hash_table_new_full (message_key_hash, message_key_equal, (GDestroyNotify) message_key_free,
+	                                       (GDestroyNotify) message_queue_free);
 
-			/* Received message is not what we expected. Return an error. */
-			soup_message_set_status_full (message, SOUP_STATUS_BAD_REQUEST, "Unexpected request to mock server");
+	for (i = 0; i < messages->len; i++) {
+		SoupMessage *message = g_ptr_array_index (messages, i);
+		SoupURI *uri = soup_message_get_uri (message);
+		MessageKey lookup_key = { message->method, uri->path, uri->query };
+		GQueue *queue;
 
-			actual_uri = soup_uri_to_string (soup_message_get_uri (message), TRUE);
-			body = g_strdup_printf ("Expected no request, but got %s ‘%s’.", message->method, actual_uri);
-			g_free (actual_uri);
-			soup_message_body_append_take (message->response_body, (guchar *) body, strlen (body));
-			handled = TRUE;
+		queue = g_hash_table_lookup (message_index, &lookup_key);
+
+		if (queue == NULL) {
+			MessageKey *key;
+
+			key = g_slice_new (MessageKey);
+			key->method = message->method;
+			key->path = g_strdup (uri->path);
+			key->query = g_strdup (uri->query);
 
-			server_response_append_headers (self, message);
+			queue = g_queue_new ();
+			g_hash_table_insert (message_index, key, queue);
 		}
-	}
 
-	/* Process the actual message if we already know the expected message. */
-	g_assert (priv->next_message != NULL || handled == TRUE);
-	if (handled == FALSE) {
-		server_process_message (self, message, client);
-		handled = TRUE;
+		g_queue_push_tail (queue, g_object_ref (message));
 	}
 
-	g_assert (handled == TRUE);
-	return handled;
+	return message_index;
 }
 
-/**
- * uhm_server_new:
- *
- * Creates a new #UhmServer with default properties.
- *
- * Return value: (transfer full): a new #UhmServer; unref with g_object_unref()
- *
- * Since: 0.1.0
- */
-UhmServer *
-uhm_server_new (void)
+/* Returns the earliest unconsumed message from the index which matches @actual_message, or %NULL if there is none. */
+static SoupMessage * /* transfer full */
+take_indexed_message (UhmServer *self, SoupMessage *actual_message)
 {
-	return g_object_new (UHM_TYPE_SERVER, NULL);
-}
-
-static gboolean
-trace_to_soup_message_headers_and_body (SoupMessageHeaders *message_headers, SoupMessageBody *message_body, const gchar message_direction, const gchar **_trace)
-{
-	const gchar *i;
-	const gchar *trace = *_trace;
-
-	/* Parse headers. */
-	while (TRUE) {
-		gchar *header_name, *header_value;
-
-		if (*trace == '\0') {
-			/* No body. */
-			goto done;
-		} else if (*trace == ' ' && *(trace + 1) == ' ' && *(trace + 2) == '\n') {
-			/* No body. */
-			trace += 3;
-			goto done;
-		} else if (*trace != message_direction || *(trace + 1) != ' ') {
-			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-			goto error;
-		}
-		trace += 2;
-
-		if (*trace == '\n') {
-			/* Reached the end of the headers. */
-			trace++;
-			break;
-		}
+	UhmServerPrivate *priv = self->priv;
+	SoupURI *uri = soup_message_get_uri (actual_message);
+	MessageKey lookup_key = { actual_message->method, uri->path, uri->query };
+	GQueue *queue;
 
-		i = strchr (trace, ':');
-		if (i == NULL || *(i + 1) != ' ') {
-			g_warning ("Missing spacer ‘: ’.");
-			goto error;
-		}
+	g_assert (priv->message_index != NULL);
 
-		header_name = g_strndup (trace, i - trace);
-		trace += (i - trace) + 2;
+	queue = g_hash_table_lookup (priv->message_index, &lookup_key);
 
-		i = strchr (trace, '\n');
-		if (i == NULL) {
-			g_warning ("Missing spacer ‘\\n’.");
-			goto error;
-		}
+	return (queue != NULL) ? g_queue_pop_head (queue) : NULL;
+}
 
-		header_value = g_strndup (trace, i - trace);
-		trace += (i - trace) + 1;
+/* Returns @message, which was taken from the index using take_indexed_message() but not used, to the front of its queue. */
+static void
+return_indexed_message (UhmServer *self, SoupMessage *message)
+{
+	UhmServerPrivate *priv = self->priv;
+	SoupURI *uri = soup_message_get_uri (message);
+	MessageKey lookup_key = { message->method, uri->path, uri->query };
+	GQueue *queue;
 
-		/* Append the header. */
-		soup_message_headers_append (message_headers, header_name, header_value);
+	g_assert (priv->message_index != NULL);
 
-		g_free (header_value);
-		g_free (header_name);
-	}
+	queue = g_hash_table_lookup (priv->message_index, &lookup_key);
+	g_assert (queue != NULL);
 
-	/* Parse the body. */
-	while (TRUE) {
-		if (*trace == ' ' && *(trace + 1) == ' ' && *(trace + 2) == '\n') {
-			/* End of the body. */
-			trace += 3;
-			break;
-		} else if (*trace == '\0') {
-			/* End of the body. */
-			break;
-		} else if (*trace != message_direction || *(trace + 1) != ' ') {
-			g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-			goto error;
-		}
-		trace += 2;
+	g_queue_push_head (queue, g_object_ref (message));
+}
 
-		i = strchr (trace, '\n');
-		if (i == NULL) {
-			g_warning ("Missing spacer ‘\\n’.");
-			goto error;
-		}
+static void
+header_append_cb (const gchar *name, const gchar *value, gpointer user_data)
+{
+	SoupMessage *message = user_data;
 
-		soup_message_body_append (message_body, SOUP_MEMORY_COPY, trace, i - trace + 1); /* include trailing \n */
-		trace += (i - trace) + 1;
-	}
+	soup_message_headers_append (message->response_headers, name, value);
+}
 
-done:
-	/* Done. Update the output trace pointer. */
-	soup_message_body_complete (message_body);
-	*_trace = trace;
+static void
+server_response_append_headers (UhmServer *self, SoupMessage *message, guint message_counter)
+{
+	UhmServerPrivate *priv = self->priv;
+	gchar *trace_file_name, *trace_file_offset;
 
-	return TRUE;
+	trace_file_name = g_file_get_uri (priv->trace_file);
+	soup_message_headers_append (message->response_headers, "X-Mock-Trace-File", trace_file_name);
+	g_free (trace_file_name);
 
-error:
-	return FALSE;
-}
-
-/* base_uri is the base URI for the server, e.g. https://127.0.0.1:1431. */
-static SoupMessage *
-trace_to_soup_message (const gchar *trace, SoupURI *base_uri)
-{
-	SoupMessage *message = NULL;
-	const gchar *i, *j, *method;
-	gchar *uri_string, *response_message;
-	SoupHTTPVersion http_version;
-	guint response_status;
-	SoupURI *uri;
-
-	g_return_val_if_fail (trace != NULL, NULL);
-
-	/* The traces look somewhat like this:
-	 * > POST /unauth HTTP/1.1
-	 * > Soup-Debug-Timestamp: 1200171744
-	 * > Soup-Debug: SoupSessionAsync 1 (0x612190), SoupMessage 1 (0x617000), SoupSocket 1 (0x612220)
-	 * > Host: localhost
-	 * > Content-Type: text/plain
-	 * > Connection: close
-	 * > 
-	 * > This is a test.
-	 *   
-	 * < HTTP/1.1 201 Created
-	 * < Soup-Debug-Timestamp: 1200171744
-	 * < Soup-Debug: SoupMessage 1 (0x617000)
-	 * < Date: Sun, 12 Jan 2008 21:02:24 GMT
-	 * < Content-Length: 0
-	 *
-	 * This function parses a single request–response pair.
-	 */
+	trace_file_offset = g_strdup_printf ("%u", message_counter);
+	soup_message_headers_append (message->response_headers, "X-Mock-Trace-File-Offset", trace_file_offset);
+	g_free (trace_file_offset);
+}
 
-	/* Parse the method, URI and HTTP version first. */
-	if (*trace != '>' || *(trace + 1) != ' ') {
-		g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-		goto error;
-	}
-	trace += 2;
-
-	/* Parse “POST /unauth HTTP/1.1”. */
-	if (strncmp (trace, "POST", strlen ("POST")) == 0) {
-		method = SOUP_METHOD_POST;
-		trace += strlen ("POST");
-	} else if (strncmp (trace, "GET", strlen ("GET")) == 0) {
-		method = SOUP_METHOD_GET;
-		trace += strlen ("GET");
-	} else if (strncmp (trace, "DELETE", strlen ("DELETE")) == 0) {
-		method = SOUP_METHOD_DELETE;
-		trace += strlen ("DELETE");
-	} else if (strncmp (trace, "PUT", strlen ("PUT")) == 0) {
-		method = SOUP_METHOD_PUT;
-		trace += strlen ("PUT");
-	} else {
-		g_warning ("Unknown method ‘%s’.", trace);
-		goto error;
-	}
+/* Parse a Soup-Debug-Timestamp header from @headers, returning 0 if it's missing or invalid. */
+static guint64
+get_debug_timestamp (SoupMessageHeaders *headers)
+{
+	const gchar *timestamp;
 
-	if (*trace != ' ') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
-	}
-	trace++;
+	timestamp = soup_message_headers_get_one (headers, "Soup-Debug-Timestamp");
 
-	i = strchr (trace, ' ');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘ ’.");
-		goto error;
-	}
+	return (timestamp != NULL) ? g_ascii_strtoull (timestamp, NULL, 10) : 0;
+}
 
-	uri_string = g_strndup (trace, i - trace);
-	trace += (i - trace) + 1;
+/* Work out how long to delay the response to @expected_message by, in milliseconds, to replay the trace's timing. See
+ * #UhmServer:enable-replay-timing. */
+static guint
+get_replay_delay (UhmServer *self, SoupMessage *expected_message)
+{
+	guint64 request_time, response_time;
+	gdouble delay;
 
-	if (strncmp (trace, "HTTP/1.1", strlen ("HTTP/1.1")) == 0) {
-		http_version = SOUP_HTTP_1_1;
-		trace += strlen ("HTTP/1.1");
-	} else if (strncmp (trace, "HTTP/1.0", strlen ("HTTP/1.0")) == 0) {
-		http_version = SOUP_HTTP_1_0;
-		trace += strlen ("HTTP/1.0");
-	} else {
-		g_warning ("Unrecognised HTTP version ‘%s’.", trace);
-		http_version = SOUP_HTTP_1_1;
-	}
+	request_time = get_debug_timestamp (expected_message->request_headers);
+	response_time = get_debug_timestamp (expected_message->response_headers);
 
-	if (*trace != '\n') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
+	if (request_time == 0 || response_time <= request_time) {
+		return 0;
 	}
-	trace++;
 
-	/* Build the message. */
-	uri = soup_uri_new_with_base (base_uri, uri_string);
-	message = soup_message_new_from_uri (method, uri);
-	soup_uri_free (uri);
+	delay = (response_time - request_time) * 1000.0 / self->priv->replay_speed;
 
-	if (message == NULL) {
-		g_warning ("Invalid URI ‘%s’.", uri_string);
-		goto error;
-	}
+	return (delay < G_MAXUINT) ? (guint) delay : G_MAXUINT;
+}
 
-	soup_message_set_http_version (message, http_version);
-	g_free (uri_string);
+/* Quark for the delay, in milliseconds, before the response to a message is sent, attached to the message by server_process_message() if
+ * replaying the trace's timing. It's private to the server, so can't clash with data attached by handlers. */
+static GQuark
+response_delay_quark (void)
+{
+	return g_quark_from_static_string ("uhm-server-response-delay-quark");
+}
 
-	/* Parse the request headers and body. */
-	if (trace_to_soup_message_headers_and_body (message->request_headers, message->request_body, '>', &trace) == FALSE) {
-		goto error;
-	}
+/* Size of the block of zeros used to pad out truncated response bodies. */
+#define PADDING_BLOCK_SIZE (64 * 1024)
 
-	/* Parse the response, starting with “HTTP/1.1 201 Created”. */
-	if (*trace != '<' || *(trace + 1) != ' ') {
-		g_warning ("Unrecognised start sequence ‘%c%c’.", *trace, *(trace + 1));
-		goto error;
-	}
-	trace += 2;
+/* Build the response to @message from @expected_message, which has already been compared against it and found to match. */
+static void
+server_process_message (UhmServer *self, SoupMessage *message, SoupMessage *expected_message, guint message_counter)
+{
+	static guint8 padding_block[PADDING_BLOCK_SIZE];  /* never modified */
+	SoupBuffer *chunk;
+	goffset body_length, expected_content_length;
 
-	if (strncmp (trace, "HTTP/1.1", strlen ("HTTP/1.1")) == 0) {
-		http_version = SOUP_HTTP_1_1;
-		trace += strlen ("HTTP/1.1");
-	} else if (strncmp (trace, "HTTP/1.0", strlen ("HTTP/1.0")) == 0) {
-		http_version = SOUP_HTTP_1_0;
-		trace += strlen ("HTTP/1.0");
-	} else {
-		g_warning ("Unrecognised HTTP version ‘%s’.", trace);
-	}
+	/* The incoming message matches what we expected, so copy the headers and body from the expected response and return it. */
+	soup_message_set_http_version (message, soup_message_get_http_version (expected_message));
+	soup_message_set_status_full (message, expected_message->status_code, expected_message->reason_phrase);
+	soup_message_headers_foreach (expected_message->response_headers, header_append_cb, message);
 
-	if (*trace != ' ') {
-		g_warning ("Unrecognised spacer ‘%c’.", *trace);
-		goto error;
-	}
-	trace++;
+	/* Add debug headers to identify the message and trace file. */
+	server_response_append_headers (self, message, message_counter);
 
-	i = strchr (trace, ' ');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘ ’.");
-		goto error;
-	}
+	/* Don't keep the body around once it's been sent, so that the memory used by a response doesn't depend on its size. */
+	soup_message_body_set_accumulate (message->response_body, FALSE);
 
-	response_status = g_ascii_strtoull (trace, (gchar **) &j, 10);
-	if (j != i) {
-		g_warning ("Invalid status ‘%s’.", trace);
-		goto error;
-	}
-	trace += (i - trace) + 1;
+	/* Reference each chunk of the expected body rather than copying it. The chunks point into the loaded trace file. The expected body
+	 * is complete, so the end of it is marked by a zero-length chunk. */
+	body_length = 0;
 
-	i = strchr (trace, '\n');
-	if (i == NULL) {
-		g_warning ("Missing spacer ‘\n’.");
-		goto error;
+	while ((chunk = soup_message_body_get_chunk (expected_message->response_body, body_length)) != NULL && chunk->length > 0) {
+		soup_message_body_append_buffer (message->response_body, chunk);
+		body_length += chunk->length;
+		soup_buffer_free (chunk);
 	}
 
-	response_message = g_strndup (trace, i - trace);
-	trace += (i - trace) + 1;
+	g_clear_pointer (&chunk, soup_buffer_free);
 
-	soup_message_set_status_full (message, response_status, response_message);
+	/* If the log file doesn't contain the full response body (e.g. because it's a text trace of a huge binary file containing a nul
+	 * byte somewhere), make one up (all zeros). Binary traces always contain the full body. The padding is sent in blocks which all
+	 * reference the same static zeros, so it doesn't need to be allocated. */
+	expected_content_length = soup_message_headers_get_content_length (message->response_headers);
 
-	g_free (response_message);
+	while (expected_content_length > body_length) {
+		gsize block_length = MIN (expected_content_length - body_length, PADDING_BLOCK_SIZE);
 
-	/* Parse the response headers and body. */
-	if (trace_to_soup_message_headers_and_body (message->response_headers, message->response_body, '<', &trace) == FALSE) {
-		goto error;
+		soup_message_body_append (message->response_body, SOUP_MEMORY_STATIC, padding_block, block_length);
+		body_length += block_length;
 	}
 
-	return message;
-
-error:
-	g_clear_object (&message);
+	soup_message_body_complete (message->response_body);
 
-	return NULL;
+	/* Tell send_response() to hold the response back, if replaying the trace's timing. */
+	if (self->priv->enable_replay_timing == TRUE) {
+		g_object_set_qdata (G_OBJECT (message), response_delay_quark (), GUINT_TO_POINTER (get_replay_delay (self, expected_message)));
+	}
 }
 
-static GDataInputStream *
-load_file_stream (GFile *trace_file, GCancellable *cancellable, GError **error)
-{
-	GFileInputStream *base_stream = NULL;  /* owned */
-	GDataInputStream *data_stream = NULL;  /* owned */
+/* Interval between the chunks of a throttled response, in milliseconds. See #UhmServer:bandwidth-limit. */
+#define THROTTLE_INTERVAL 100
 
-	base_stream = g_file_read (trace_file, cancellable, error);
+/* A response which has been built, but which is held back by a timeout in the main context of the server thread handling it: either
+ * because it's delayed (see #UhmServer:enable-replay-timing), or because its body is being trickled out (see #UhmServer:bandwidth-limit).
+ * The message stays paused except when a chunk of its body has just been made available. */
+typedef struct {
+	SoupServer *server;  /* owned */
+	SoupMessage *message;  /* owned */
+	gulong finished_id;
 
-	data_stream = g_data_input_stream_new (G_INPUT_STREAM (base_stream));
-	g_data_input_stream_set_byte_order (data_stream, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
-	g_data_input_stream_set_newline_type (data_stream, G_DATA_STREAM_NEWLINE_TYPE_LF);
+	/* Only used for throttled responses. */
+	SoupMessageBody *body;  /* owned; the complete response body, which is appended to @message in chunks */
+	goffset body_offset;  /* amount of @body appended to @message so far */
+	gsize chunk_size;
+	gint64 start_time;  /* monotonic time at which to append the first chunk */
+} PendingResponseData;
 
-	g_object_unref (base_stream);
+static void
+pending_response_data_free (PendingResponseData *data)
+{
+	g_signal_handler_disconnect (data->message, data->finished_id);
+	g_clear_pointer (&data->body, soup_message_body_free);
+	g_object_unref (data->message);
+	g_object_unref (data->server);
 
-	return data_stream;
+	g_slice_free (PendingResponseData, data);
 }
 
 static gboolean
-load_message_half (GDataInputStream *input_stream, GString *current_message, GCancellable *cancellable, GError **error)
+pending_response_cb (gpointer user_data)
 {
-	gsize len;
-	gchar *line = NULL;  /* owned */
-	GError *child_error = NULL;
+	PendingResponseData *data = user_data;
+	SoupBuffer *chunk, *subchunk;
 
-	while (TRUE) {
-		line = g_data_input_stream_read_line (input_stream, &len, cancellable, &child_error);
+	/* Unthrottled responses are sent in one go once they're due. */
+	if (data->body == NULL) {
+		soup_server_unpause_message (data->server, data->message);
 
-		if (line == NULL && child_error != NULL) {
-			/* Error. */
-			g_propagate_error (error, child_error);
-			return FALSE;
-		} else if (line == NULL) {
-			/* EOF. Try again to grab a response. */
-			return TRUE;
-		} else {
-			gboolean reached_eom;
+		return G_SOURCE_REMOVE;
+	}
 
-			reached_eom = (g_strcmp0 (line, "  ") == 0);
+	/* Throttled responses may be delayed as well. */
+	if (g_get_monotonic_time () < data->start_time) {
+		return G_SOURCE_CONTINUE;
+	}
 
-			g_string_append_len (current_message, line, len);
-			g_string_append_c (current_message, '\n');
+	/* Append the next chunk and let the server write it. The body is complete, so the end is marked by a zero-length chunk. */
+	chunk = soup_message_body_get_chunk (data->body, data->body_offset);
 
-			g_free (line);
+	if (chunk->length == 0) {
+		soup_buffer_free (chunk);
+		soup_message_body_complete (data->message->response_body);
+		soup_server_unpause_message (data->server, data->message);
 
-			if (reached_eom) {
-				/* Reached the end of the message. */
-				return TRUE;
-			}
-		}
+		return G_SOURCE_REMOVE;
 	}
-}
 
-/* Returns TRUE iff the given message from a trace file should be ignored and not used by the mock server. */
-static gboolean
-should_ignore_soup_message (SoupMessage *message)
-{
-	switch (message->status_code) {
-		case SOUP_STATUS_NONE:
-		case SOUP_STATUS_CANCELLED:
-		case SOUP_STATUS_CANT_RESOLVE:
-		case SOUP_STATUS_CANT_RESOLVE_PROXY:
-		case SOUP_STATUS_CANT_CONNECT:
-		case SOUP_STATUS_CANT_CONNECT_PROXY:
-		case SOUP_STATUS_SSL_FAILED:
-		case SOUP_STATUS_IO_ERROR:
-		case SOUP_STATUS_MALFORMED:
-		case SOUP_STATUS_TRY_AGAIN:
-		case SOUP_STATUS_TOO_MANY_REDIRECTS:
-		case SOUP_STATUS_TLS_FAILED:
-			return TRUE;
-		default:
-			return FALSE;
+	if (chunk->length > data->chunk_size) {
+		subchunk = soup_buffer_new_subbuffer (chunk, 0, data->chunk_size);
+		soup_buffer_free (chunk);
+		chunk = subchunk;
 	}
+
+	soup_message_body_append_buffer (data->message->response_body, chunk);
+	data->body_offset += chunk->length;
+	soup_buffer_free (chunk);
+
+	soup_server_unpause_message (data->server, data->message);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+pending_response_finished_cb (SoupMessage *message, GSource *source)
+{
+	/* The client went away before the response was sent, so there's nothing left to unpause. This frees the PendingResponseData. */
+	g_source_destroy (source);
 }
 
-static SoupMessage *
-load_file_iteration (GDataInputStream *input_stream, SoupURI *base_uri, GCancellable *cancellable, GError **error)
+/* Hold back the paused @message, sending it after @delay milliseconds. If @bandwidth_limit is non-zero, its body is then sent at no more
+ * than @bandwidth_limit bytes per second. This uses a timeout in the calling thread's main context (the context of the server thread
+ * which is handling @message), so no extra threads are needed, however many responses are pending. */
+static void
+hold_response (SoupServer *server, SoupMessage *message, guint delay, guint bandwidth_limit)
 {
-	SoupMessage *output_message = NULL;
-	GString *current_message = NULL;
+	PendingResponseData *data;
+	GSource *source;
 
-	current_message = g_string_new (NULL);
+	data = g_slice_new0 (PendingResponseData);
+	data->server = g_object_ref (server);
+	data->message = g_object_ref (message);
 
-	do {
-		/* Start loading from the stream. */
-		g_string_truncate (current_message, 0);
+	if (bandwidth_limit > 0 && message->response_body->length > 0) {
+		SoupBuffer *chunk;
+		goffset offset = 0;
 
-		/* We should be at the start of a request; grab it. */
-		if (!load_message_half (input_stream, current_message, cancellable, error) ||
-		    !load_message_half (input_stream, current_message, cancellable, error)) {
-			goto done;
+		/* Move the body out of the message, so it can be appended again in chunks. This only adds references to the chunks. */
+		data->body = soup_message_body_new ();
+
+		while ((chunk = soup_message_body_get_chunk (message->response_body, offset)) != NULL && chunk->length > 0) {
+			soup_message_body_append_buffer (data->body, chunk);
+			offset += chunk->length;
+			soup_buffer_free (chunk);
 		}
 
-		if (current_message->len > 0) {
-			output_message = trace_to_soup_message (current_message->str, base_uri);
-		} else {
-			/* Reached the end of the file. */
-			output_message = NULL;
+		g_clear_pointer (&chunk, soup_buffer_free);
+		soup_message_body_complete (data->body);
+		soup_message_body_truncate (message->response_body);
+
+		/* The server can't work out the Content-Length from a body which hasn't been appended yet. */
+		if (soup_message_headers_get_encoding (message->response_headers) != SOUP_ENCODING_CHUNKED) {
+			soup_message_headers_set_content_length (message->response_headers, data->body->length);
 		}
-	} while (output_message != NULL && should_ignore_soup_message (output_message) == TRUE);
 
-done:
-	/* Tidy up. */
-	g_string_free (current_message, TRUE);
+		data->chunk_size = MAX ((guint64) bandwidth_limit * THROTTLE_INTERVAL / 1000, 1);
+		data->start_time = g_get_monotonic_time () + (gint64) delay * 1000;
+
+		source = g_timeout_source_new (THROTTLE_INTERVAL);
+	} else {
+		source = g_timeout_source_new (delay);
+	}
 
-	/* Postcondition: (output_message != NULL) => (*error == NULL). */
-	g_assert (output_message == NULL || (error == NULL || *error == NULL));
+	data->finished_id = g_signal_connect (message, "finished", (GCallback) pending_response_finished_cb, source);
 
-	return output_message;
+	g_source_set_callback (source, pending_response_cb, data, (GDestroyNotify) pending_response_data_free);
+	g_source_attach (source, g_main_context_get_thread_default ());
+	g_source_unref (source);
 }
 
+/* Send the response which has been set on the paused @message, once it's due. This must be called in the main context of the server thread
+ * handling @message. */
 static void
-load_file_stream_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+send_response (UhmServer *self, SoupServer *server, SoupMessage *message)
 {
-	GFile *trace_file;
-	GDataInputStream *input_stream;
-	GError *child_error = NULL;
+	guint delay, bandwidth_limit;
 
-	trace_file = task_data;
-	g_assert (G_IS_FILE (trace_file));
+	/* If replaying the trace's timing or limiting bandwidth, keep the message paused until its response is due. This doesn't block the
+	 * server thread. */
+	delay = GPOINTER_TO_UINT (g_object_steal_qdata (G_OBJECT (message), response_delay_quark ()));
+	bandwidth_limit = self->priv->bandwidth_limit;
 
-	input_stream = load_file_stream (trace_file, cancellable, &child_error);
-
-	if (child_error != NULL) {
-		g_task_return_error (task, child_error);
+	if (delay > 0 || bandwidth_limit > 0) {
+		hold_response (server, message, delay, bandwidth_limit);
 	} else {
-		g_task_return_pointer (task, input_stream, g_object_unref);
+		soup_server_unpause_message (server, message);
 	}
 }
 
+/* A message which a #UhmServer::handle-message-async handler has taken responsibility for, and which stays paused until the handler calls
+ * uhm_server_complete_message(). This is attached to the message using deferred_message_quark(). */
+typedef struct {
+	UhmServer *self;  /* owned */
+	SoupServer *server;  /* owned */
+	SoupMessage *message;  /* owned; the data is attached to it, so this reference cycle is broken when it's completed */
+	GMainContext *context;  /* owned; main context of the server thread handling @message */
+	gulong finished_id;
+	gboolean finished;  /* TRUE if the client went away before the response was sent; only accessed in @context */
+} DeferredMessageData;
+
+static GQuark
+deferred_message_quark (void)
+{
+	return g_quark_from_static_string ("uhm-server-deferred-message-quark");
+}
+
 static void
-load_file_iteration_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+deferred_message_data_free (DeferredMessageData *data)
 {
-	LoadFileIterationData *data = task_data;
-	GDataInputStream *input_stream;
-	SoupMessage *output_message;
-	SoupURI *base_uri;
-	GError *child_error = NULL;
+	g_signal_handler_disconnect (data->message, data->finished_id);
+	g_object_unref (data->message);
+	g_main_context_unref (data->context);
+	g_object_unref (data->server);
+	g_object_unref (data->self);
+
+	g_slice_free (DeferredMessageData, data);
+}
 
-	input_stream = data->input_stream;
-	g_assert (G_IS_DATA_INPUT_STREAM (input_stream));
-	base_uri = data->base_uri;
+static void
+deferred_message_finished_cb (SoupMessage *message, DeferredMessageData *data)
+{
+	data->finished = TRUE;
+}
 
-	output_message = load_file_iteration (input_stream, base_uri, cancellable, &child_error);
+static gboolean
+deferred_message_complete_cb (gpointer user_data)
+{
+	DeferredMessageData *data = user_data;
 
-	if (child_error != NULL) {
-		g_task_return_error (task, child_error);
-	} else {
-		g_task_return_pointer (task, output_message, g_object_unref);
+	/* There's nothing left to send if the client went away in the meantime. */
+	if (data->finished == FALSE) {
+		send_response (data->self, data->server, data->message);
 	}
+
+	return G_SOURCE_REMOVE;
 }
 
-/**
- * uhm_server_unload_trace:
- * @self: a #UhmServer
- *
- * Unloads the current trace file of network messages, as loaded by uhm_server_load_trace() or uhm_server_load_trace_async().
- *
- * Since: 0.1.0
- */
-void
-uhm_server_unload_trace (UhmServer *self)
+static void
+server_handler_cb (SoupServer *server, SoupMessage *message, const gchar *path, GHashTable *query, SoupClientContext *client, gpointer user_data)
 {
-	UhmServerPrivate *priv = self->priv;
+	UhmServer *self = user_data;
+	gboolean message_handled = FALSE;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
+	soup_server_pause_message (server, message);
 
-	g_clear_object (&priv->next_message);
-	g_clear_object (&priv->input_stream);
-	g_clear_object (&priv->trace_file);
-	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
-	priv->message_counter = 0;
-	priv->received_message_state = UNKNOWN;
+	/* Give asynchronous handlers the first chance at the message. They unpause it by calling uhm_server_complete_message(). The signal isn't
+	 * emitted at all if nothing could handle it, as it's emitted for every request. */
+	if (g_signal_has_handler_pending (self, signals[SIGNAL_HANDLE_MESSAGE_ASYNC], 0, FALSE) == TRUE) {
+		DeferredMessageData *data;
+
+		/* Attach the data before emitting the signal, since a handler may complete the message straight away. */
+		data = g_slice_new0 (DeferredMessageData);
+		data->self = g_object_ref (self);
+		data->server = g_object_ref (server);
+		data->message = g_object_ref (message);
+		data->context = g_main_context_ref_thread_default ();
+		data->finished_id = g_signal_connect (message, "finished", (GCallback) deferred_message_finished_cb, data);
+
+		g_object_set_qdata_full (G_OBJECT (message), deferred_message_quark (), data, (GDestroyNotify) deferred_message_data_free);
+
+		g_signal_emit (self, signals[SIGNAL_HANDLE_MESSAGE_ASYNC], 0, message, client, &message_handled);
+
+		if (message_handled == TRUE) {
+			return;
+		}
+
+		g_object_set_qdata (G_OBJECT (message), deferred_message_quark (), NULL);
+	}
+
+	g_signal_emit (self, signals[SIGNAL_HANDLE_MESSAGE], 0, message, client, &message_handled);
+
+	/* The message should always be handled by real_handle_message() at least. */
+	g_assert (message_handled == TRUE);
+
+	send_response (self, server, message);
 }
 
 /**
- * uhm_server_load_trace:
+ * uhm_server_complete_message:
  * @self: a #UhmServer
- * @trace_file: trace file to load
- * @cancellable: (allow-none): a #GCancellable, or %NULL
- * @error: (allow-none): return location for a #GError, or %NULL
- *
- * Synchronously loads the given @trace_file of network messages, ready to simulate a network conversation by matching
- * requests against the file and returning the associated responses. Call uhm_server_run() to start the mock
- * server afterwards.
+ * @message: a message passed to a #UhmServer::handle-message-async handler
  *
- * Loading the trace file may be cancelled from another thread using @cancellable.
+ * Completes the handling of @message by a #UhmServer::handle-message-async handler which returned %TRUE, sending the response which has
+ * been set on it. The response is subject to #UhmServer:enable-replay-timing and #UhmServer:bandwidth-limit as usual.
  *
- * On error, @error will be set and the state of the #UhmServer will not change. A #GIOError will be set if there is
- * a problem reading the trace file.
+ * This may be called from any thread, including from within the signal handler itself. The response is sent from the server thread which
+ * received the request. It must be called exactly once for each message a handler has taken responsibility for, and must not be called for
+ * any other messages.
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
 void
-uhm_server_load_trace (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GError **error)
+uhm_server_complete_message (UhmServer *self, SoupMessage *message)
 {
-	UhmServerPrivate *priv = self->priv;
-	SoupURI *base_uri;
+	DeferredMessageData *data;
 
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_FILE (trace_file));
-	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-	g_return_if_fail (error == NULL || *error == NULL);
-	g_return_if_fail (priv->trace_file == NULL && priv->input_stream == NULL && priv->next_message == NULL);
+	g_return_if_fail (SOUP_IS_MESSAGE (message));
 
-	base_uri = build_base_uri (self);
+	/* Take ownership of the data (and hence of a reference to the message) until the response has been sent. */
+	data = g_object_steal_qdata (G_OBJECT (message), deferred_message_quark ());
+	g_return_if_fail (data != NULL);
 
-	priv->trace_file = g_object_ref (trace_file);
-	priv->input_stream = load_file_stream (priv->trace_file, cancellable, error);
+	g_main_context_invoke_full (data->context, G_PRIORITY_DEFAULT, deferred_message_complete_cb, data,
+	                            (GDestroyNotify) deferred_message_data_free);
+}
 
-	if (priv->input_stream != NULL) {
-		GError *child_error = NULL;
+/* Add a request which has just been handled to the statistics. The times are all monotonic, in microseconds. */
+static void
+record_statistics (UhmServer *self, SoupMessage *message, gboolean messages_match, gint64 start_time, gint64 load_time,
+                   gint64 compare_time, gint64 end_time)
+{
+	UhmServerPrivate *priv = self->priv;
+	UhmHistogram **histograms = priv->statistics.histograms;
 
-		priv->next_message = load_file_iteration (priv->input_stream, base_uri, cancellable, &child_error);
-		priv->message_counter = 0;
-		priv->comparison_message = g_byte_array_new ();
-		priv->received_message_state = UNKNOWN;
+	g_mutex_lock (&priv->statistics_lock);
 
-		if (child_error != NULL) {
-			g_clear_object (&priv->trace_file);
-			g_propagate_error (error, child_error);
-		}
-	} else {
-		/* Error. */
-		g_clear_object (&priv->trace_file);
-	}
+	priv->statistics.n_requests++;
+	priv->statistics.n_unexpected_requests += (messages_match == FALSE) ? 1 : 0;
+	priv->statistics.bytes_received += message->request_body->length;
+	priv->statistics.bytes_sent += message->response_body->length;
 
-	soup_uri_free (base_uri);
-}
+	uhm_histogram_record (histograms[UHM_SERVER_PHASE_LOAD], load_time - start_time);
+	uhm_histogram_record (histograms[UHM_SERVER_PHASE_COMPARE], compare_time - load_time);
+	uhm_histogram_record (histograms[UHM_SERVER_PHASE_RESPONSE], end_time - compare_time);
+	uhm_histogram_record (histograms[UHM_SERVER_PHASE_TOTAL], end_time - start_time);
 
-typedef struct {
-	GAsyncReadyCallback callback;
-	gpointer user_data;
-	SoupURI *base_uri;
-} LoadTraceData;
+	g_mutex_unlock (&priv->statistics_lock);
+}
 
-static void
-load_trace_async_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+static gboolean
+real_handle_message (UhmServer *self, SoupMessage *message, SoupClientContext *client)
 {
-	UhmServer *self = UHM_SERVER (source_object);
-	LoadTraceData *data = user_data;
-	LoadFileIterationData *iteration_data;
-	GTask *task;
-	GError *child_error = NULL;
+	UhmServerPrivate *priv = self->priv;
+	SoupMessage *expected_message = NULL;
+	gboolean messages_match = FALSE, indexed;
+	guint message_counter;
+	gint64 start_time, load_time, compare_time;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_ASYNC_RESULT (result));
-	g_return_if_fail (g_task_is_valid (result, self));
+	start_time = g_get_monotonic_time ();
 
-	self->priv->input_stream = g_task_propagate_pointer (G_TASK (result), &child_error);
+	/* Several server threads may handle messages concurrently (see #UhmServer:n-threads), so the expected message is chosen and
+	 * compared with the trace lock held. If it matches, it's removed from the trace state, so the response can be built from it
+	 * without the lock held. */
+	g_mutex_lock (&priv->trace_lock);
 
-	iteration_data = g_slice_new (LoadFileIterationData);
-	iteration_data->input_stream = g_object_ref (self->priv->input_stream);
-	iteration_data->base_uri = data->base_uri; /* transfer ownership */
-	data->base_uri = NULL;
+	/* Load the next expected message from the trace file. If the trace has been preloaded, this is a simple lookup; otherwise the
+	 * message has normally already been parsed from the trace file by the trace reader's worker thread. The lock is dropped while
+	 * waiting for the reader, so another thread may take the message first; in that case, wait for the one after it. */
+	if (priv->next_message == NULL) {
+		if (priv->message_index != NULL) {
+			priv->next_message = take_indexed_message (self, message);
+		} else if (priv->preloaded_messages != NULL) {
+			priv->next_message = take_next_preloaded_message (self);
+		} else {
+			while (priv->next_message == NULL && priv->trace != NULL && priv->message_index == NULL &&
+			       priv->preloaded_messages == NULL) {
+				gboolean more_messages;
 
-	task = g_task_new (g_task_get_source_object (G_TASK (result)), g_task_get_cancellable (G_TASK (result)), data->callback, data->user_data);
-	g_task_set_task_data (task, iteration_data, (GDestroyNotify) load_file_iteration_data_free);
+				g_mutex_unlock (&priv->trace_lock);
+				more_messages = read_next_trace_message (self);
+				g_mutex_lock (&priv->trace_lock);
 
-	if (child_error != NULL) {
-		g_task_return_error (task, child_error);
-	} else {
-		g_task_run_in_thread (task, load_file_iteration_thread_cb);
+				if (more_messages == FALSE) {
+					break;
+				}
+			}
+		}
 	}
 
-	g_object_unref (task);
-
-	g_slice_free (LoadTraceData, data);
-}
+	load_time = compare_time = g_get_monotonic_time ();
+
+	if (priv->next_message != NULL) {
+		priv->message_counter++;
+		expected_message = g_object_ref (priv->next_message);
+		messages_match = (compare_incoming_message (self, expected_message, message, client) == 0);
+		compare_time = g_get_monotonic_time ();
+
+		/* Clear the expected message once it's been used. Messages taken from the index are always cleared, but are returned to the
+		 * index if they weren't used, so that they can match a later request. */
+		if (messages_match == FALSE && priv->message_index != NULL) {
+			return_indexed_message (self, priv->next_message);
+			g_clear_object (&priv->next_message);
+		} else if (messages_match == TRUE) {
+			g_clear_object (&priv->next_message);
+		}
+	}
 
-/**
- * uhm_server_load_trace_async:
- * @self: a #UhmServer
- * @trace_file: trace file to load
- * @cancellable: (allow-none): a #GCancellable, or %NULL
- * @callback: function to call once the async operation is complete
- * @user_data: (allow-none): user data to pass to @callback, or %NULL
- *
- * Asynchronous version of uhm_server_load_trace(). In @callback, call uhm_server_load_trace_finish() to complete the operation.
- *
- * Since: 0.1.0
- */
-void
-uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
-{
-	GTask *task;
-	LoadTraceData *data;
+	indexed = (priv->message_index != NULL);
+	message_counter = priv->message_counter;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_FILE (trace_file));
-	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-	g_return_if_fail (self->priv->trace_file == NULL && self->priv->input_stream == NULL && self->priv->next_message == NULL);
+	g_mutex_unlock (&priv->trace_lock);
 
-	self->priv->trace_file = g_object_ref (trace_file);
+	if (expected_message == NULL) {
+		gchar *body, *actual_uri;
 
-	data = g_slice_new (LoadTraceData);
-	data->callback = callback;
-	data->user_data = user_data;
-	data->base_uri = build_base_uri (self);
+		/* Received message is not what we expected. Return an error. */
+		soup_message_set_status_full (message, SOUP_STATUS_BAD_REQUEST, "Unexpected request to mock server");
+
+		actual_uri = soup_uri_to_string (soup_message_get_uri (message), TRUE);
+		if (indexed == TRUE) {
+			body = g_strdup_printf ("Expected no more requests matching %s ‘%s’.", message->method, actual_uri);
+		} else {
+			body = g_strdup_printf ("Expected no request, but got %s ‘%s’.", message->method, actual_uri);
+		}
+		g_free (actual_uri);
+		soup_message_body_append_take (message->response_body, (guchar *) body, strlen (body));
+
+		server_response_append_headers (self, message, message_counter);
+	} else if (messages_match == FALSE) {
+		gchar *body, *next_uri, *actual_uri;
+
+		/* Received message is not what we expected. Return an error. */
+		soup_message_set_status_full (message, SOUP_STATUS_BAD_REQUEST, "Unexpected request to mock server");
+
+		next_uri = soup_uri_to_string (soup_message_get_uri (expected_message), TRUE);
+		actual_uri = soup_uri_to_string (soup_message_get_uri (message), TRUE);
+		body = g_strdup_printf ("Expected %s URI ‘%s’, but got %s ‘%s’.", expected_message->method, next_uri, message->method, actual_uri);
+		g_free (actual_uri);
+		g_free (next_uri);
+		soup_message_body_append_take (message->response_body, (guchar *) body, strlen (body));
+
+		server_response_append_headers (self, message, message_counter);
+	} else {
+		server_process_message (self, message, expected_message, message_counter);
+	}
+
+	g_clear_object (&expected_message);
+
+	record_statistics (self, message, messages_match, start_time, load_time, compare_time, g_get_monotonic_time ());
+
+	return TRUE;
+}
+
+/**
+ * uhm_server_new:
+ *
+ * Creates a new #UhmServer with default properties.
+ *
+ * Return value: (transfer full): a new #UhmServer; unref with g_object_unref()
+ *
+ * Since: 0.1.0
+ */
+UhmServer *
+uhm_server_new (void)
+{
+	return g_object_new (UHM_TYPE_SERVER, NULL);
+}
+
+typedef struct {
+	GFile *trace_file;  /* owned */
+	SoupURI *base_uri;  /* owned; may be NULL */
+	gboolean preload;  /* TRUE to parse all the messages in the trace, rather than just the first one */
+	gboolean build_index;  /* TRUE to parse all the messages in the trace and index them for out-of-order matching */
+} LoadTraceData;
+
+static void
+load_trace_data_free (LoadTraceData *data)
+{
+	g_object_unref (data->trace_file);
+	if (data->base_uri != NULL) {
+		soup_uri_free (data->base_uri);
+	}
+	g_slice_free (LoadTraceData, data);
+}
+
+typedef struct {
+	UhmTrace *trace;  /* owned; NULL if preloaded */
+	gsize trace_offset;
+	SoupMessage *next_message;  /* owned; NULL if preloaded */
+	GPtrArray/*<SoupMessage>*/ *preloaded_messages;  /* owned; NULL unless preloaded */
+	GHashTable/*<MessageKey, GQueue<SoupMessage>>*/ *message_index;  /* owned; NULL unless indexed */
+} LoadTraceResult;
+
+static void
+load_trace_result_free (LoadTraceResult *result)
+{
+	g_clear_pointer (&result->trace, uhm_trace_unref);
+	g_clear_object (&result->next_message);
+	g_clear_pointer (&result->preloaded_messages, g_ptr_array_unref);
+	g_clear_pointer (&result->message_index, g_hash_table_unref);
+	g_slice_free (LoadTraceResult, result);
+}
+
+/* Load the trace file and parse either its first message, or all of its messages if preloading or indexing. This does blocking I/O, so may
+ * be called in a worker thread. */
+static LoadTraceResult *
+load_trace (GFile *trace_file, SoupURI *base_uri, gboolean preload, gboolean build_index, GCancellable *cancellable, GError **error)
+{
+	LoadTraceResult *result;
+	UhmTrace *trace;
+	GError *child_error = NULL;
+
+	trace = uhm_trace_new_from_file (trace_file, cancellable, error);
+
+	if (trace == NULL) {
+		return NULL;
+	}
+
+	result = g_slice_new0 (LoadTraceResult);
+
+	if (preload == TRUE || build_index == TRUE) {
+		result->preloaded_messages = uhm_trace_load_all (trace, &result->trace_offset, base_uri, cancellable, &child_error);
+
+		/* The parsed messages reference the trace's data themselves, so there's no need to keep the trace around. */
+		uhm_trace_unref (trace);
+	} else {
+		result->trace = trace;
+		result->next_message = uhm_trace_next_message (trace, &result->trace_offset, base_uri);
+	}
+
+	if (child_error != NULL) {
+		g_propagate_error (error, child_error);
+		load_trace_result_free (result);
+
+		return NULL;
+	}
+
+	/* The index holds its own references to the messages, so the array isn't needed once it's built. */
+	if (build_index == TRUE) {
+		result->message_index = build_message_index (result->preloaded_messages);
+		g_clear_pointer (&result->preloaded_messages, g_ptr_array_unref);
+	}
+
+	return result;
+}
+
+/* Change the server's state to reflect a newly loaded trace. This takes ownership of @result. */
+static void
+apply_loaded_trace (UhmServer *self, LoadTraceResult *result)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	g_mutex_lock (&priv->trace_lock);
+
+	priv->trace = result->trace;
+	result->trace = NULL;
+	priv->trace_offset = result->trace_offset;
+	priv->preloaded_messages = result->preloaded_messages;
+	result->preloaded_messages = NULL;
+	priv->preloaded_messages_index = 0;
+	priv->message_index = result->message_index;
+	result->message_index = NULL;
+
+	if (priv->message_index != NULL) {
+		/* The next message depends on the incoming request, so can't be chosen in advance. */
+		priv->next_message = NULL;
+	} else if (priv->preloaded_messages != NULL) {
+		priv->next_message = take_next_preloaded_message (self);
+	} else {
+		priv->next_message = result->next_message;
+		result->next_message = NULL;
+	}
+
+	priv->message_counter = 0;
+	priv->comparison_message = g_byte_array_new ();
+	priv->received_message_state = UNKNOWN;
+
+	/* Start reading ahead straight away if the server's running. Otherwise, wait until it is, so the right base URI is used. */
+	if (get_base_uri (self) != NULL) {
+		start_trace_reader (self);
+	}
+
+	g_mutex_unlock (&priv->trace_lock);
+
+	load_trace_result_free (result);
+}
+
+static void
+load_trace_thread_cb (GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	LoadTraceData *data = task_data;
+	LoadTraceResult *result;
+	GError *child_error = NULL;
+
+	g_assert (G_IS_FILE (data->trace_file));
+
+	result = load_trace (data->trace_file, data->base_uri, data->preload, data->build_index, cancellable, &child_error);
+
+	if (child_error != NULL) {
+		g_task_return_error (task, child_error);
+	} else {
+		g_task_return_pointer (task, result, (GDestroyNotify) load_trace_result_free);
+	}
+}
+
+/**
+ * uhm_server_unload_trace:
+ * @self: a #UhmServer
+ *
+ * Unloads the current trace file of network messages, as loaded by uhm_server_load_trace() or uhm_server_load_trace_async().
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_unload_trace (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	g_mutex_lock (&priv->trace_lock);
+
+	/* This cancels any reading ahead, and waits for the worker thread to finish, unless another thread is waiting for a message from the
+	 * reader. In that case, the worker is stopped once that thread has its message. */
+	g_clear_pointer (&priv->trace_reader, uhm_trace_reader_unref);
+	g_clear_object (&priv->next_message);
+	g_clear_pointer (&priv->preloaded_messages, g_ptr_array_unref);
+	g_clear_pointer (&priv->message_index, g_hash_table_unref);
+	priv->preloaded_messages_index = 0;
+	g_clear_pointer (&priv->trace, uhm_trace_unref);
+	priv->trace_offset = 0;
+	g_clear_object (&priv->trace_file);
+	g_clear_pointer (&priv->comparison_message, g_byte_array_unref);
+	priv->message_counter = 0;
+	priv->received_message_state = UNKNOWN;
 
-	task = g_task_new (self, cancellable, load_trace_async_cb, data);
-	g_task_set_task_data (task, g_object_ref (self->priv->trace_file), g_object_unref);
-	g_task_run_in_thread (task, load_file_stream_thread_cb);
+	g_mutex_unlock (&priv->trace_lock);
+}
+
+/**
+ * uhm_server_load_trace:
+ * @self: a #UhmServer
+ * @trace_file: trace file to load
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Synchronously loads the given @trace_file of network messages, ready to simulate a network conversation by matching
+ * requests against the file and returning the associated responses. Call uhm_server_run() to start the mock
+ * server afterwards.
+ *
+ * Loading the trace file may be cancelled from another thread using @cancellable.
+ *
+ * If #UhmServer:enable-preloading or #UhmServer:enable-out-of-order-matching is %TRUE, all the messages in @trace_file are parsed by this
+ * function; otherwise only the first is, and subsequent messages are parsed a few at a time in a worker thread while the server is running,
+ * ahead of them being needed.
+ *
+ * @trace_file may be in either the text or the binary trace format; the format is detected automatically.
+ *
+ * On error, @error will be set and the state of the #UhmServer will not change. A #GIOError will be set if there is
+ * a problem reading the trace file, or if it is a binary trace file which is corrupt or in an unsupported version of the format.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_load_trace (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GError **error)
+{
+	UhmServerPrivate *priv = self->priv;
+	LoadTraceResult *result;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (error == NULL || *error == NULL);
+	g_return_if_fail (priv->trace_file == NULL && priv->trace == NULL && priv->next_message == NULL && priv->preloaded_messages == NULL &&
+	                  priv->message_index == NULL);
+
+	result = load_trace (trace_file, get_base_uri (self), priv->enable_preloading, priv->enable_out_of_order_matching, cancellable, error);
+
+	if (result != NULL) {
+		priv->trace_file = g_object_ref (trace_file);
+		apply_loaded_trace (self, result);
+	}
+}
+
+/**
+ * uhm_server_load_trace_async:
+ * @self: a #UhmServer
+ * @trace_file: trace file to load
+ * @cancellable: (allow-none): a #GCancellable, or %NULL
+ * @callback: function to call once the async operation is complete
+ * @user_data: (allow-none): user data to pass to @callback, or %NULL
+ *
+ * Asynchronous version of uhm_server_load_trace(). In @callback, call uhm_server_load_trace_finish() to complete the operation.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GTask *task;
+	LoadTraceData *data;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+	g_return_if_fail (self->priv->trace_file == NULL && self->priv->trace == NULL && self->priv->next_message == NULL &&
+	                  self->priv->preloaded_messages == NULL && self->priv->message_index == NULL);
+
+	self->priv->trace_file = g_object_ref (trace_file);
+
+	data = g_slice_new (LoadTraceData);
+	data->trace_file = g_object_ref (trace_file);
+	data->base_uri = (get_base_uri (self) != NULL) ? soup_uri_copy (get_base_uri (self)) : NULL;
+	data->preload = self->priv->enable_preloading;
+	data->build_index = self->priv->enable_out_of_order_matching;
+
+	task = g_task_new (self, cancellable, callback, user_data);
+	g_task_set_task_data (task, data, (GDestroyNotify) load_trace_data_free);
+	g_task_run_in_thread (task, load_trace_thread_cb);
 	g_object_unref (task);
 }
 
@@ -1278,15 +2008,20 @@ uhm_server_load_trace_async (UhmServer *self, GFile *trace_file, GCancellable *c
 void
 uhm_server_load_trace_finish (UhmServer *self, GAsyncResult *result, GError **error)
 {
+	LoadTraceResult *load_result;
+
 	g_return_if_fail (UHM_IS_SERVER (self));
 	g_return_if_fail (G_IS_ASYNC_RESULT (result));
 	g_return_if_fail (error == NULL || *error == NULL);
 	g_return_if_fail (g_task_is_valid (result, self));
 
-	self->priv->next_message = g_task_propagate_pointer (G_TASK (result), error);
-	self->priv->message_counter = 0;
-	self->priv->comparison_message = g_byte_array_new ();
-	self->priv->received_message_state = UNKNOWN;
+	load_result = g_task_propagate_pointer (G_TASK (result), error);
+
+	if (load_result != NULL) {
+		apply_loaded_trace (self, load_result);
+	} else {
+		g_clear_object (&self->priv->trace_file);
+	}
 }
 
 /* Must only be called in the server thread. */
@@ -1325,515 +2060,1296 @@ server_thread_cb (gpointer user_data)
 	return NULL;
 }
 
-/**
- * uhm_server_run:
- * @self: a #UhmServer
- *
- * Runs the mock server, binding to a loopback TCP/IP interface and preparing a HTTPS server which is ready to accept requests.
- * The TCP/IP address and port number are chosen randomly out of the loopback addresses, and are exposed as #UhmServer:address and #UhmServer:port
- * once this function has returned. A #UhmResolver (exposed as #UhmServer:resolver) is set as the default #GResolver while the server is running.
- *
- * The server is started in a worker thread, so this function returns immediately and the server continues to run in the background. Use uhm_server_stop()
- * to shut it down.
- *
- * This function always succeeds.
- *
- * Since: 0.1.0
- */
-void
-uhm_server_run (UhmServer *self)
+#ifdef HAVE_LIBSOUP_2_47_3
+#ifdef ENABLE_SERVER_THREADS
+/* Listen on the loopback address for @family with SO_REUSEPORT set, so that several servers can listen on the same port. If *@port is 0,
+ * a random port is chosen and returned in @port. */
+static gboolean
+listen_reuse_port (SoupServer *server, GSocketFamily family, guint *port, SoupServerListenOptions options, GError **error)
 {
-	UhmServerPrivate *priv = self->priv;
-#ifndef HAVE_LIBSOUP_2_47_3
-	union {
-		struct sockaddr sock;
-		struct sockaddr_in in;
-	} sock;
-	SoupAddress *addr;
-#endif
+	GSocket *socket;
+	GInetAddress *inet_address;
+	GSocketAddress *address;
+	gboolean success;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (priv->resolver == NULL);
-	g_return_if_fail (priv->server == NULL);
+	socket = g_socket_new (family, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
 
-#ifndef HAVE_LIBSOUP_2_47_3
-	/* Grab a loopback IP to use. */
-	memset (&sock, 0, sizeof (sock));
-	sock.in.sin_family = AF_INET;
-	sock.in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
-	sock.in.sin_port = htons (0); /* random port */
+	if (socket == NULL) {
+		return FALSE;
+	}
 
-	addr = soup_address_new_from_sockaddr (&sock.sock, sizeof (sock));
-	g_assert (addr != NULL);
-#endif
+	inet_address = g_inet_address_new_loopback (family);
+	address = g_inet_socket_address_new (inet_address, *port);
 
-	/* Set up the server. If (priv->tls_certificate != NULL) it will be a HTTPS server;
-	 * otherwise it will be a HTTP server. */
-	priv->server_context = g_main_context_new ();
-	priv->server = soup_server_new ("tls-certificate", priv->tls_certificate,
-	                                "raw-paths", TRUE,
-#ifndef HAVE_LIBSOUP_2_47_3
-	                                "async-context", priv->server_context,
-	                                "interface", addr,
-#endif
-	                                NULL);
-	soup_server_add_handler (priv->server, "/", server_handler_cb, self, NULL);
+	success = g_socket_set_option (socket, SOL_SOCKET, SO_REUSEPORT, 1, error) &&
+	          g_socket_bind (socket, address, FALSE, error) &&
+	          g_socket_listen (socket, error) &&
+	          soup_server_listen_socket (server, socket, options, error);
 
-#ifndef HAVE_LIBSOUP_2_47_3
-	g_object_unref (addr);
-#endif
+	g_object_unref (address);
+	g_object_unref (inet_address);
 
-#ifdef HAVE_LIBSOUP_2_47_3
-{
-	GError *error = NULL;
+	if (success == TRUE && *port == 0) {
+		address = g_socket_get_local_address (socket, NULL);
 
-	g_main_context_push_thread_default (priv->server_context);
+		if (address != NULL) {
+			*port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (address));
+			g_object_unref (address);
+		}
+	}
 
-	priv->server_main_loop = g_main_loop_new (priv->server_context, FALSE);
-	soup_server_listen_local (priv->server, 0, SOUP_SERVER_LISTEN_HTTPS,
-	                          &error);
-	g_assert_no_error (error);  /* binding to localhost should never really fail */
+	g_object_unref (socket);
 
-	g_main_context_pop_thread_default (priv->server_context);
+	return success;
 }
 #endif
 
-	/* Grab the randomly selected address and port. */
-#ifdef HAVE_LIBSOUP_2_47_3
+/* Get the IPv4 address @server is listening on, ignoring any listeners on @exclude_port (if it's non-zero). If @listening_ipv6 is
+ * non-%NULL, it's set to whether the server is also listening on an IPv6 address. If listening on both IPv4 and IPv6, both sockets use the
+ * same port, and the IPv4 one is returned. */
+static GSocketAddress * /* transfer full */
+get_listener_address (SoupServer *server, guint exclude_port, gboolean *listening_ipv6)
+{
+	GSList *sockets, *l;  /* owned */
+	GSocketAddress *address = NULL;
+
+	sockets = soup_server_get_listeners (server);
+
+	for (l = sockets; l != NULL; l = l->next) {
+		GSocket *socket = l->data;
+		GSocketAddress *socket_address;
+		GSocketFamily family;
+
+		family = g_socket_get_family (socket);
+
+		if (family != G_SOCKET_FAMILY_IPV4 && family != G_SOCKET_FAMILY_IPV6) {
+			continue;
+		}
+
+		socket_address = g_socket_get_local_address (socket, NULL);
+		g_assert (socket_address != NULL);
+
+		if (exclude_port != 0 && g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (socket_address)) == exclude_port) {
+			g_object_unref (socket_address);
+		} else if (family == G_SOCKET_FAMILY_IPV6) {
+			if (listening_ipv6 != NULL) {
+				*listening_ipv6 = TRUE;
+			}
+
+			g_object_unref (socket_address);
+		} else if (address == NULL) {
+			address = socket_address;
+		} else {
+			g_object_unref (socket_address);
+		}
+	}
+
+	g_slist_free (sockets);
+
+	g_assert (address != NULL);
+
+	return address;
+}
+
+/* Start @server listening on the given loopback @port (or a random one if @port is 0). If @reuse_port is %TRUE, the listening sockets
+ * are created with SO_REUSEPORT so that other servers can listen on the same port. If @dual_stack is %TRUE, the server listens on the IPv6
+ * loopback address as well as the IPv4 one, if IPv6 is supported. If @secure is %TRUE, HTTPS is served; otherwise plain HTTP is. This must
+ * be called with the server's main context as the thread default. */
+static gboolean
+server_listen_local (SoupServer *server, guint port, gboolean reuse_port, gboolean dual_stack, gboolean secure, GError **error)
+{
+	SoupServerListenOptions options = (secure == TRUE) ? SOUP_SERVER_LISTEN_HTTPS : 0;
+
+#ifdef ENABLE_SERVER_THREADS
+	if (reuse_port == TRUE) {
+		GError *child_error = NULL;
+
+		if (listen_reuse_port (server, G_SOCKET_FAMILY_IPV4, &port, options, error) == FALSE) {
+			return FALSE;
+		}
+
+		/* As with soup_server_listen_local(), ignore failure to listen on IPv6 if it's not supported. */
+		if (dual_stack == TRUE && listen_reuse_port (server, G_SOCKET_FAMILY_IPV6, &port, options, &child_error) == FALSE) {
+			if (g_error_matches (child_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED) == FALSE) {
+				g_propagate_error (error, child_error);
+				return FALSE;
+			}
+
+			g_error_free (child_error);
+		}
+
+		return TRUE;
+	}
+#endif
+
+	return soup_server_listen_local (server, port, options | ((dual_stack == TRUE) ? 0 : SOUP_SERVER_LISTEN_IPV4_ONLY), error);
+}
+
+#ifdef ENABLE_UNIX_SOCKET
+/* Start @server listening on the Unix socket at @path, which is in the abstract namespace if it starts with ‘@’. Connections to it use plain
+ * HTTP. This must be called with the server's main context as the thread default. */
+static gboolean
+server_listen_unix (SoupServer *server, const gchar *path, GError **error)
+{
+	GSocket *socket;
+	GSocketAddress *address;
+	gboolean success;
+
+	socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT, error);
+
+	if (socket == NULL) {
+		return FALSE;
+	}
+
+	if (path[0] == '@') {
+		address = g_unix_socket_address_new_with_type (path + 1, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+	} else {
+		address = g_unix_socket_address_new (path);
+	}
+
+	success = g_socket_bind (socket, address, FALSE, error) &&
+	          g_socket_listen (socket, error) &&
+	          soup_server_listen_socket (server, socket, 0, error);
+
+	g_object_unref (address);
+	g_object_unref (socket);
+
+	return success;
+}
+#endif
+#endif
+
+#ifdef ENABLE_SERVER_THREADS
+static void
+server_thread_free (ServerThread *data)
+{
+	g_main_loop_unref (data->main_loop);
+	g_main_context_unref (data->context);
+	g_object_unref (data->server);
+
+	g_slice_free (ServerThread, data);
+}
+
+static gboolean
+extra_server_thread_quit_cb (gpointer user_data)
+{
+	ServerThread *data = user_data;
+
+	g_main_loop_quit (data->main_loop);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer
+extra_server_thread_cb (gpointer user_data)
+{
+	ServerThread *data = user_data;
+
+	g_main_context_push_thread_default (data->context);
+	g_main_loop_run (data->main_loop);
+	g_main_context_pop_thread_default (data->context);
+
+	return NULL;
+}
+
+/* Start the servers for threads other than the main server thread, all listening on the same port as the main server. */
+static void
+start_extra_server_threads (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+	guint i;
+
+	priv->server_threads = g_ptr_array_new_with_free_func ((GDestroyNotify) server_thread_free);
+
+	for (i = 1; i < priv->n_threads; i++) {
+		ServerThread *data;
+		GError *error = NULL;
+
+		data = g_slice_new0 (ServerThread);
+		data->context = g_main_context_new ();
+		data->main_loop = g_main_loop_new (data->context, FALSE);
+		data->server = soup_server_new ("tls-certificate", priv->tls_certificate,
+		                                "raw-paths", TRUE,
+		                                NULL);
+		soup_server_add_handler (data->server, "/", server_handler_cb, self, NULL);
+
+		g_main_context_push_thread_default (data->context);
+
+		if (priv->transport_mode != UHM_SERVER_TRANSPORT_MODE_HTTP) {
+			server_listen_local (data->server, priv->port, TRUE, priv->enable_dual_stack, TRUE, &error);
+			g_assert_no_error (error);  /* binding to localhost should never really fail */
+		}
+
+		if (priv->http_port != 0) {
+			server_listen_local (data->server, priv->http_port, TRUE, priv->enable_dual_stack, FALSE, &error);
+			g_assert_no_error (error);
+		}
+
+		g_main_context_pop_thread_default (data->context);
+
+		data->thread = g_thread_new ("mock-server-thread", extra_server_thread_cb, data);
+		g_ptr_array_add (priv->server_threads, data);
+	}
+}
+
+static void
+stop_extra_server_threads (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+	guint i;
+
+	for (i = 0; i < priv->server_threads->len; i++) {
+		ServerThread *data = g_ptr_array_index (priv->server_threads, i);
+		GSource *idle;
+
+		idle = g_idle_source_new ();
+		g_source_set_callback (idle, extra_server_thread_quit_cb, data, NULL);
+		g_source_attach (idle, data->context);
+		g_source_unref (idle);
+
+		g_thread_join (data->thread);
+		data->thread = NULL;
+	}
+
+	g_clear_pointer (&priv->server_threads, g_ptr_array_unref);
+}
+#endif
+
+/**
+ * uhm_server_run:
+ * @self: a #UhmServer
+ *
+ * Runs the mock server, binding to a loopback TCP/IP interface and preparing a HTTPS server which is ready to accept requests.
+ * The TCP/IP address and port number are chosen randomly out of the loopback addresses, and are exposed as #UhmServer:address and #UhmServer:port
+ * once this function has returned. A #UhmResolver (exposed as #UhmServer:resolver) is set as the default #GResolver while the server is running.
+ *
+ * If #UhmServer:transport-mode is %UHM_SERVER_TRANSPORT_MODE_HTTP, a plain HTTP server is prepared instead; if it's
+ * %UHM_SERVER_TRANSPORT_MODE_BOTH, a plain HTTP server is additionally prepared on a second random port, exposed as #UhmServer:http-port.
+ *
+ * The server is started in a worker thread, so this function returns immediately and the server continues to run in the background. Use uhm_server_stop()
+ * to shut it down. If #UhmServer:n-threads is greater than 1, that many worker threads are started, each accepting connections on the same port.
+ *
+ * This function always succeeds.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_run (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+#ifndef HAVE_LIBSOUP_2_47_3
+	union {
+		struct sockaddr sock;
+		struct sockaddr_in in;
+	} sock;
+	SoupAddress *addr;
+#endif
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (priv->resolver == NULL);
+	g_return_if_fail (priv->server == NULL);
+
+#ifndef HAVE_LIBSOUP_2_47_3
+	/* Grab a loopback IP to use. */
+	memset (&sock, 0, sizeof (sock));
+	sock.in.sin_family = AF_INET;
+	sock.in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	sock.in.sin_port = htons (0); /* random port */
+
+	addr = soup_address_new_from_sockaddr (&sock.sock, sizeof (sock));
+	g_assert (addr != NULL);
+#endif
+
+	/* Set up the server. With the old SoupServer API, it will be a HTTPS server if it has a TLS certificate, and a HTTP server otherwise.
+	 * With the new API, that's decided when it starts listening. */
+	priv->server_context = g_main_context_new ();
+	priv->server = soup_server_new ("tls-certificate",
+#ifndef HAVE_LIBSOUP_2_47_3
+	                                (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_HTTP) ? NULL : priv->tls_certificate,
+#else
+	                                priv->tls_certificate,
+#endif
+	                                "raw-paths", TRUE,
+#ifndef HAVE_LIBSOUP_2_47_3
+	                                "async-context", priv->server_context,
+	                                "interface", addr,
+#endif
+	                                NULL);
+	soup_server_add_handler (priv->server, "/", server_handler_cb, self, NULL);
+
+#ifndef HAVE_LIBSOUP_2_47_3
+	g_object_unref (addr);
+#endif
+
+#ifdef HAVE_LIBSOUP_2_47_3
 {
-	GSList *sockets;  /* owned */
-	GSocket *socket;
 	GError *error = NULL;
 
-	sockets = soup_server_get_listeners (priv->server);
-	g_assert (sockets != NULL);
+	g_main_context_push_thread_default (priv->server_context);
 
-	socket = sockets->data;
-	priv->address = g_socket_get_local_address (socket, &error);
-	g_assert_no_error (error);
+	priv->server_main_loop = g_main_loop_new (priv->server_context, FALSE);
+	server_listen_local (priv->server, 0, priv->n_threads > 1, priv->enable_dual_stack,
+	                     priv->transport_mode != UHM_SERVER_TRANSPORT_MODE_HTTP, &error);
+	g_assert_no_error (error);  /* binding to localhost should never really fail */
+
+	/* Grab the randomly selected address and port, before listening on anything else. */
+	priv->address = get_listener_address (priv->server, 0, &priv->listening_ipv6);
 	priv->port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (priv->address));
 
-	g_slist_free (sockets);
+	if (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_BOTH) {
+		GSocketAddress *http_address;
+
+		/* Serve plain HTTP on a second random port. */
+		server_listen_local (priv->server, 0, priv->n_threads > 1, priv->enable_dual_stack, FALSE, &error);
+		g_assert_no_error (error);
+
+		http_address = get_listener_address (priv->server, priv->port, NULL);
+		priv->http_port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (http_address));
+		g_object_unref (http_address);
+	} else if (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_HTTP) {
+		priv->http_port = priv->port;
+	}
+
+#ifdef ENABLE_UNIX_SOCKET
+	/* Unlike the loopback address, the Unix socket path is chosen by the caller, so binding to it can fail. */
+	if (priv->unix_socket_path != NULL) {
+		if (server_listen_unix (priv->server, priv->unix_socket_path, &error) == TRUE) {
+			priv->bound_unix_socket_path = g_strdup (priv->unix_socket_path);
+		} else {
+			g_warning ("Error listening on Unix socket ‘%s’: %s", priv->unix_socket_path, error->message);
+			g_clear_error (&error);
+		}
+	}
+#endif
+
+	g_main_context_pop_thread_default (priv->server_context);
+}
+#endif
+
+#ifndef HAVE_LIBSOUP_2_47_3
+	/* Grab the randomly selected address and port. */
+	priv->address = g_object_ref (soup_socket_get_local_address (soup_server_get_listener (priv->server)));
+	priv->port = soup_server_get_port (priv->server);
+	priv->http_port = (priv->transport_mode == UHM_SERVER_TRANSPORT_MODE_HTTP) ? priv->port : 0;
+#endif
+
+	/* Cache the server's base URI, which trace messages are resolved against, rather than rebuilding it for each message. */
+	priv->base_uri = build_server_base_uri (self);
+
+	/* Start reading ahead in any trace which was loaded before the server was started. */
+	g_mutex_lock (&priv->trace_lock);
+	start_trace_reader (self);
+	g_mutex_unlock (&priv->trace_lock);
+
+	/* Set up the resolver. It is expected that callers will grab the resolver (by calling uhm_server_get_resolver())
+	 * immediately after this function returns, and add some expected hostnames by calling uhm_resolver_add_A() one or
+	 * more times, before starting the next test.Or they could call uhm_server_set_expected_domain_names() any time. */
+	priv->resolver = uhm_resolver_new ();
+	g_resolver_set_default (G_RESOLVER (priv->resolver));
+
+	/* Note: This must be called before notify::resolver, so the user can add extra domain names in that callback if desired. */
+	apply_expected_domain_names (self);
+
+	g_object_freeze_notify (G_OBJECT (self));
+	g_object_notify (G_OBJECT (self), "address");
+	g_object_notify (G_OBJECT (self), "port");
+	g_object_notify (G_OBJECT (self), "http-port");
+	g_object_notify (G_OBJECT (self), "resolver");
+	g_object_thaw_notify (G_OBJECT (self));
+
+	/* Start the network thread(s). */
+	priv->server_thread = g_thread_new ("mock-server-thread", server_thread_cb, self);
+
+#ifdef ENABLE_SERVER_THREADS
+	start_extra_server_threads (self);
+#endif
+}
+
+/**
+ * uhm_server_stop:
+ * @self: a #UhmServer
+ *
+ * Stops a mock server started by calling uhm_server_run(). This shuts down the server's worker thread and unbinds it from its TCP/IP socket.
+ *
+ * This unloads any trace file loaded by calling uhm_server_load_trace() (or its asynchronous counterpart). It also resets the set of domain
+ * names loaded into the #UhmServer:resolver.
+ *
+ * This function always succeeds.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_stop (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+	GSource *idle;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (priv->server != NULL);
+	g_return_if_fail (priv->resolver != NULL);
+
+	/* Stop the server. */
+	idle = g_idle_source_new ();
+	g_source_set_callback (idle, server_thread_quit_cb, self, NULL);
+	g_source_attach (idle, priv->server_context);
+	g_source_unref (idle);
+
+	g_thread_join (priv->server_thread);
+	priv->server_thread = NULL;
+
+#ifdef ENABLE_SERVER_THREADS
+	stop_extra_server_threads (self);
+#endif
+
+	uhm_resolver_reset (priv->resolver);
+
+#ifdef HAVE_LIBSOUP_2_47_3
+	g_clear_pointer (&priv->server_main_loop, g_main_loop_unref);
+#endif
+	g_clear_pointer (&priv->server_context, g_main_context_unref);
+	g_clear_object (&priv->server);
+	g_clear_object (&priv->resolver);
+
+	g_clear_object (&priv->address);
+#ifdef HAVE_LIBSOUP_2_47_3
+	g_free (priv->address_string);
+	priv->address_string = NULL;
+#endif
+	priv->port = 0;
+	priv->http_port = 0;
+	priv->listening_ipv6 = FALSE;
+
+	/* Remove the Unix socket, unless it's abstract. */
+	if (priv->bound_unix_socket_path != NULL && priv->bound_unix_socket_path[0] != '@') {
+		g_unlink (priv->bound_unix_socket_path);
+	}
+
+	g_free (priv->bound_unix_socket_path);
+	priv->bound_unix_socket_path = NULL;
+	g_clear_pointer (&priv->base_uri, soup_uri_free);
+
+	g_object_freeze_notify (G_OBJECT (self));
+	g_object_notify (G_OBJECT (self), "address");
+	g_object_notify (G_OBJECT (self), "port");
+	g_object_notify (G_OBJECT (self), "http-port");
+	g_object_notify (G_OBJECT (self), "resolver");
+	g_object_thaw_notify (G_OBJECT (self));
+
+	/* Reset the trace file. */
+	uhm_server_unload_trace (self);
+}
+
+/**
+ * uhm_server_get_trace_directory:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:trace-directory property.
+ *
+ * Return value: (allow-none) (transfer none): the directory to load/store trace files from, or %NULL
+ *
+ * Since: 0.1.0
+ */
+GFile *
+uhm_server_get_trace_directory (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	return self->priv->trace_directory;
+}
+
+/**
+ * uhm_server_set_trace_directory:
+ * @self: a #UhmServer
+ * @trace_directory: (allow-none) (transfer none): a directory to load/store trace files from, or %NULL to unset it
+ *
+ * Sets the value of the #UhmServer:trace-directory property.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_set_trace_directory (UhmServer *self, GFile *trace_directory)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (trace_directory == NULL || G_IS_FILE (trace_directory));
+
+	if (trace_directory != NULL) {
+		g_object_ref (trace_directory);
+	}
+
+	g_clear_object (&self->priv->trace_directory);
+	self->priv->trace_directory = trace_directory;
+	g_object_notify (G_OBJECT (self), "trace-directory");
+}
+
+/**
+ * uhm_server_start_trace:
+ * @self: a #UhmServer
+ * @trace_name: name of the trace
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Starts a mock server which follows the trace file of filename @trace_name in the #UhmServer:trace-directory directory.
+ * See uhm_server_start_trace_full() for further documentation.
+ *
+ * This function has undefined behaviour if #UhmServer:trace-directory is %NULL.
+ *
+ * On failure, @error will be set and the #UhmServer state will remain unchanged. See uhm_server_start_trace_full() for
+ * details of the error domains used.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_start_trace (UhmServer *self, const gchar *trace_name, GError **error)
+{
+	GFile *trace_file;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (trace_name != NULL && *trace_name != '\0');
+	g_return_if_fail (error == NULL || *error == NULL);
+
+	g_assert (self->priv->trace_directory != NULL);
+
+	trace_file = g_file_get_child (self->priv->trace_directory, trace_name);
+	uhm_server_start_trace_full (self, trace_file, error);
+	g_object_unref (trace_file);
+}
+
+/**
+ * uhm_server_start_trace_full:
+ * @self: a #UhmServer
+ * @trace_file: a trace file to load
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Convenience function to start logging to or reading from the given @trace_file, depending on the values of #UhmServer:enable-logging and
+ * #UhmServer:enable-online.
+ *
+ * If #UhmServer:enable-logging is %TRUE, a log handler will be set up to redirect all client network activity into the given @trace_file.
+ * If @trace_file already exists, it will be overwritten.
+ *
+ * If #UhmServer:enable-online is %FALSE, the given @trace_file is loaded using uhm_server_load_trace() and then a mock server is
+ * started using uhm_server_run().
+ *
+ * On failure, @error will be set and the #UhmServer state will remain unchanged. A #GIOError will be set if logging is enabled
+ * (#UhmServer:enable-logging) and there is a problem writing to the trace file; or if a trace needs to be loaded and there is a problem
+ * reading from the trace file.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
+{
+	UhmServerPrivate *priv = self->priv;
+	GError *child_error = NULL;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (G_IS_FILE (trace_file));
+	g_return_if_fail (error == NULL || *error == NULL);
+
+	if (priv->trace_writer != NULL) {
+		g_warning ("%s: Nested trace files are not supported. Call uhm_server_end_trace() before calling %s again.", G_STRFUNC, G_STRFUNC);
+	}
+	g_return_if_fail (priv->trace_writer == NULL);
+
+	/* Start writing out a trace file if logging is enabled. */
+	if (priv->enable_logging == TRUE) {
+		GFileOutputStream *output_stream;
+
+		output_stream = g_file_replace (trace_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &child_error);
+
+		if (child_error != NULL) {
+			gchar *trace_file_path;
+
+			trace_file_path = g_file_get_path (trace_file);
+			g_set_error (error, child_error->domain, child_error->code,
+			             "Error replacing trace file ‘%s’: %s", trace_file_path, child_error->message);
+			g_free (trace_file_path);
+
+			g_error_free (child_error);
+
+			return;
+		} else {
+			/* Change state. */
+			priv->trace_writer = uhm_trace_writer_new (G_OUTPUT_STREAM (output_stream), priv->enable_background_logging);
+			g_object_unref (output_stream);
+		}
+	}
+
+	/* Start reading from a trace file if online testing is disabled or if we need to compare server responses to the trace file. */
+	if (priv->enable_online == FALSE) {
+		uhm_server_run (self);
+		uhm_server_load_trace (self, trace_file, NULL, &child_error);
+
+		if (child_error != NULL) {
+			gchar *trace_file_path = g_file_get_path (trace_file);
+			g_set_error (error, child_error->domain, child_error->code,
+			             "Error loading trace file ‘%s’: %s", trace_file_path, child_error->message);
+			g_free (trace_file_path);
+
+			g_error_free (child_error);
+
+			uhm_server_stop (self);
+			g_clear_pointer (&priv->trace_writer, uhm_trace_writer_free);
+
+			return;
+		}
+	} else if (priv->enable_online == TRUE && priv->enable_logging == FALSE) {
+		uhm_server_load_trace (self, trace_file, NULL, &child_error);
+
+		if (child_error != NULL) {
+			gchar *trace_file_path = g_file_get_path (trace_file);
+			g_set_error (error, child_error->domain, child_error->code,
+			             "Error loading trace file ‘%s’: %s", trace_file_path, child_error->message);
+			g_free (trace_file_path);
+
+			g_error_free (child_error);
+
+			g_clear_pointer (&priv->trace_writer, uhm_trace_writer_free);
+
+			return;
+		}
+	}
+}
+
+/**
+ * uhm_server_end_trace:
+ * @self: a #UhmServer
+ *
+ * Convenience function to finish logging to or reading from a trace file previously passed to uhm_server_start_trace() or
+ * uhm_server_start_trace_full().
+ *
+ * If #UhmServer:enable-online is %FALSE, this will shut down the mock server (as if uhm_server_stop() had been called).
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_end_trace (UhmServer *self)
+{
+	UhmServerPrivate *priv = self->priv;
+
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	if (priv->enable_online == FALSE) {
+		uhm_server_stop (self);
+	} else if (priv->enable_online == TRUE && priv->enable_logging == FALSE) {
+		uhm_server_unload_trace (self);
+	}
+
+	if (priv->enable_logging == TRUE) {
+		close_trace_writer (self);
+	}
+}
+
+/**
+ * uhm_server_get_enable_online:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-online property.
+ *
+ * Return value: %TRUE if the server does not intercept and handle network connections from client code; %FALSE otherwise
+ *
+ * Since: 0.1.0
+ */
+gboolean
+uhm_server_get_enable_online (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_online;
 }
-#else
-	priv->address = g_object_ref (soup_socket_get_local_address (soup_server_get_listener (priv->server)));
-	priv->port = soup_server_get_port (priv->server);
-#endif
-
-	/* Set up the resolver. It is expected that callers will grab the resolver (by calling uhm_server_get_resolver())
-	 * immediately after this function returns, and add some expected hostnames by calling uhm_resolver_add_A() one or
-	 * more times, before starting the next test.Or they could call uhm_server_set_expected_domain_names() any time. */
-	priv->resolver = uhm_resolver_new ();
-	g_resolver_set_default (G_RESOLVER (priv->resolver));
-
-	/* Note: This must be called before notify::resolver, so the user can add extra domain names in that callback if desired. */
-	apply_expected_domain_names (self);
 
-	g_object_freeze_notify (G_OBJECT (self));
-	g_object_notify (G_OBJECT (self), "address");
-	g_object_notify (G_OBJECT (self), "port");
-	g_object_notify (G_OBJECT (self), "resolver");
-	g_object_thaw_notify (G_OBJECT (self));
+/**
+ * uhm_server_set_enable_online:
+ * @self: a #UhmServer
+ * @enable_online: %TRUE to not intercept and handle network connections from client code; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-online property.
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_set_enable_online (UhmServer *self, gboolean enable_online)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
 
-	/* Start the network thread. */
-	priv->server_thread = g_thread_new ("mock-server-thread", server_thread_cb, self);
+	self->priv->enable_online = enable_online;
+	g_object_notify (G_OBJECT (self), "enable-online");
 }
 
 /**
- * uhm_server_stop:
+ * uhm_server_get_enable_logging:
  * @self: a #UhmServer
  *
- * Stops a mock server started by calling uhm_server_run(). This shuts down the server's worker thread and unbinds it from its TCP/IP socket.
+ * Gets the value of the #UhmServer:enable-logging property.
  *
- * This unloads any trace file loaded by calling uhm_server_load_trace() (or its asynchronous counterpart). It also resets the set of domain
- * names loaded into the #UhmServer:resolver.
+ * Return value: %TRUE if client network traffic is being logged to a trace file; %FALSE otherwise
  *
- * This function always succeeds.
+ * Since: 0.1.0
+ */
+gboolean
+uhm_server_get_enable_logging (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_logging;
+}
+
+/**
+ * uhm_server_set_enable_logging:
+ * @self: a #UhmServer
+ * @enable_logging: %TRUE to log client network traffic to a trace file; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-logging property.
  *
  * Since: 0.1.0
  */
 void
-uhm_server_stop (UhmServer *self)
+uhm_server_set_enable_logging (UhmServer *self, gboolean enable_logging)
 {
-	UhmServerPrivate *priv = self->priv;
-	GSource *idle;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (priv->server != NULL);
-	g_return_if_fail (priv->resolver != NULL);
-
-	/* Stop the server. */
-	idle = g_idle_source_new ();
-	g_source_set_callback (idle, server_thread_quit_cb, self, NULL);
-	g_source_attach (idle, priv->server_context);
-	g_source_unref (idle);
 
-	g_thread_join (priv->server_thread);
-	priv->server_thread = NULL;
-	uhm_resolver_reset (priv->resolver);
+	self->priv->enable_logging = enable_logging;
+	g_object_notify (G_OBJECT (self), "enable-logging");
+}
 
-#ifdef HAVE_LIBSOUP_2_47_3
-	g_clear_pointer (&priv->server_main_loop, g_main_loop_unref);
-#endif
-	g_clear_pointer (&priv->server_context, g_main_context_unref);
-	g_clear_object (&priv->server);
-	g_clear_object (&priv->resolver);
+/**
+ * uhm_server_get_enable_preloading:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-preloading property.
+ *
+ * Return value: %TRUE if trace files are entirely parsed when they are loaded; %FALSE otherwise
+ *
+ * Since: 0.4.0
+ */
+gboolean
+uhm_server_get_enable_preloading (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
 
-	g_clear_object (&priv->address);
-#ifdef HAVE_LIBSOUP_2_47_3
-	g_free (priv->address_string);
-	priv->address_string = NULL;
-#endif
-	priv->port = 0;
+	return self->priv->enable_preloading;
+}
 
-	g_object_freeze_notify (G_OBJECT (self));
-	g_object_notify (G_OBJECT (self), "address");
-	g_object_notify (G_OBJECT (self), "port");
-	g_object_notify (G_OBJECT (self), "resolver");
-	g_object_thaw_notify (G_OBJECT (self));
+/**
+ * uhm_server_set_enable_preloading:
+ * @self: a #UhmServer
+ * @enable_preloading: %TRUE to entirely parse trace files when they are loaded; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-preloading property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_enable_preloading (UhmServer *self, gboolean enable_preloading)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
 
-	/* Reset the trace file. */
-	uhm_server_unload_trace (self);
+	self->priv->enable_preloading = enable_preloading;
+	g_object_notify (G_OBJECT (self), "enable-preloading");
 }
 
 /**
- * uhm_server_get_trace_directory:
+ * uhm_server_get_enable_out_of_order_matching:
  * @self: a #UhmServer
  *
- * Gets the value of the #UhmServer:trace-directory property.
+ * Gets the value of the #UhmServer:enable-out-of-order-matching property.
  *
- * Return value: (allow-none) (transfer none): the directory to load/store trace files from, or %NULL
+ * Return value: %TRUE if requests may be matched against the trace file in any order; %FALSE otherwise
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
-GFile *
-uhm_server_get_trace_directory (UhmServer *self)
+gboolean
+uhm_server_get_enable_out_of_order_matching (UhmServer *self)
 {
-	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
 
-	return self->priv->trace_directory;
+	return self->priv->enable_out_of_order_matching;
 }
 
 /**
- * uhm_server_set_trace_directory:
+ * uhm_server_set_enable_out_of_order_matching:
  * @self: a #UhmServer
- * @trace_directory: (allow-none) (transfer none): a directory to load/store trace files from, or %NULL to unset it
+ * @enable_out_of_order_matching: %TRUE to match requests against the trace file in any order; %FALSE otherwise
  *
- * Sets the value of the #UhmServer:trace-directory property.
+ * Sets the value of the #UhmServer:enable-out-of-order-matching property.
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
 void
-uhm_server_set_trace_directory (UhmServer *self, GFile *trace_directory)
+uhm_server_set_enable_out_of_order_matching (UhmServer *self, gboolean enable_out_of_order_matching)
 {
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (trace_directory == NULL || G_IS_FILE (trace_directory));
-
-	if (trace_directory != NULL) {
-		g_object_ref (trace_directory);
-	}
 
-	g_clear_object (&self->priv->trace_directory);
-	self->priv->trace_directory = trace_directory;
-	g_object_notify (G_OBJECT (self), "trace-directory");
+	self->priv->enable_out_of_order_matching = enable_out_of_order_matching;
+	g_object_notify (G_OBJECT (self), "enable-out-of-order-matching");
 }
 
 /**
- * uhm_server_start_trace:
+ * uhm_server_get_n_threads:
  * @self: a #UhmServer
- * @trace_name: name of the trace
- * @error: (allow-none): return location for a #GError, or %NULL
  *
- * Starts a mock server which follows the trace file of filename @trace_name in the #UhmServer:trace-directory directory.
- * See uhm_server_start_trace_full() for further documentation.
+ * Gets the value of the #UhmServer:n-threads property.
  *
- * This function has undefined behaviour if #UhmServer:trace-directory is %NULL.
+ * Return value: number of threads the mock server uses to handle requests
  *
- * On failure, @error will be set and the #UhmServer state will remain unchanged. See uhm_server_start_trace_full() for
- * details of the error domains used.
+ * Since: 0.4.0
+ */
+guint
+uhm_server_get_n_threads (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), 1);
+
+	return self->priv->n_threads;
+}
+
+/**
+ * uhm_server_set_n_threads:
+ * @self: a #UhmServer
+ * @n_threads: number of threads for the mock server to use to handle requests; must be at least 1
  *
- * Since: 0.1.0
+ * Sets the value of the #UhmServer:n-threads property.
+ *
+ * Since: 0.4.0
  */
 void
-uhm_server_start_trace (UhmServer *self, const gchar *trace_name, GError **error)
+uhm_server_set_n_threads (UhmServer *self, guint n_threads)
 {
-	GFile *trace_file;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (trace_name != NULL && *trace_name != '\0');
-	g_return_if_fail (error == NULL || *error == NULL);
-
-	g_assert (self->priv->trace_directory != NULL);
+	g_return_if_fail (n_threads >= 1);
 
-	trace_file = g_file_get_child (self->priv->trace_directory, trace_name);
-	uhm_server_start_trace_full (self, trace_file, error);
-	g_object_unref (trace_file);
+	self->priv->n_threads = n_threads;
+	g_object_notify (G_OBJECT (self), "n-threads");
 }
 
 /**
- * uhm_server_start_trace_full:
+ * uhm_server_get_enable_background_logging:
  * @self: a #UhmServer
- * @trace_file: a trace file to load
- * @error: (allow-none): return location for a #GError, or %NULL
  *
- * Convenience function to start logging to or reading from the given @trace_file, depending on the values of #UhmServer:enable-logging and
- * #UhmServer:enable-online.
+ * Gets the value of the #UhmServer:enable-background-logging property.
  *
- * If #UhmServer:enable-logging is %TRUE, a log handler will be set up to redirect all client network activity into the given @trace_file.
- * If @trace_file already exists, it will be overwritten.
+ * Return value: %TRUE if trace files are written to disk by a worker thread; %FALSE otherwise
  *
- * If #UhmServer:enable-online is %FALSE, the given @trace_file is loaded using uhm_server_load_trace() and then a mock server is
- * started using uhm_server_run().
+ * Since: 0.4.0
+ */
+gboolean
+uhm_server_get_enable_background_logging (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+
+	return self->priv->enable_background_logging;
+}
+
+/**
+ * uhm_server_set_enable_background_logging:
+ * @self: a #UhmServer
+ * @enable_background_logging: %TRUE to write trace files to disk from a worker thread; %FALSE otherwise
  *
- * On failure, @error will be set and the #UhmServer state will remain unchanged. A #GIOError will be set if logging is enabled
- * (#UhmServer:enable-logging) and there is a problem writing to the trace file; or if a trace needs to be loaded and there is a problem
- * reading from the trace file.
+ * Sets the value of the #UhmServer:enable-background-logging property.
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
 void
-uhm_server_start_trace_full (UhmServer *self, GFile *trace_file, GError **error)
+uhm_server_set_enable_background_logging (UhmServer *self, gboolean enable_background_logging)
 {
-	UhmServerPrivate *priv = self->priv;
-	GError *child_error = NULL;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (G_IS_FILE (trace_file));
-	g_return_if_fail (error == NULL || *error == NULL);
 
-	if (priv->output_stream != NULL) {
-		g_warning ("%s: Nested trace files are not supported. Call uhm_server_end_trace() before calling %s again.", G_STRFUNC, G_STRFUNC);
-	}
-	g_return_if_fail (priv->output_stream == NULL);
+	self->priv->enable_background_logging = enable_background_logging;
+	g_object_notify (G_OBJECT (self), "enable-background-logging");
+}
 
-	/* Start writing out a trace file if logging is enabled. */
-	if (priv->enable_logging == TRUE) {
-		GFileOutputStream *output_stream;
+/**
+ * uhm_server_get_enable_replay_timing:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-replay-timing property.
+ *
+ * Return value: %TRUE if responses are delayed by their recorded latency; %FALSE otherwise
+ *
+ * Since: 0.4.0
+ */
+gboolean
+uhm_server_get_enable_replay_timing (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
 
-		output_stream = g_file_replace (trace_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &child_error);
+	return self->priv->enable_replay_timing;
+}
 
-		if (child_error != NULL) {
-			gchar *trace_file_path;
+/**
+ * uhm_server_set_enable_replay_timing:
+ * @self: a #UhmServer
+ * @enable_replay_timing: %TRUE to delay responses by their recorded latency; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-replay-timing property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_enable_replay_timing (UhmServer *self, gboolean enable_replay_timing)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
 
-			trace_file_path = g_file_get_path (trace_file);
-			g_set_error (error, child_error->domain, child_error->code,
-			             "Error replacing trace file ‘%s’: %s", trace_file_path, child_error->message);
-			g_free (trace_file_path);
+	self->priv->enable_replay_timing = enable_replay_timing;
+	g_object_notify (G_OBJECT (self), "enable-replay-timing");
+}
 
-			g_error_free (child_error);
+/**
+ * uhm_server_get_replay_speed:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:replay-speed property.
+ *
+ * Return value: the factor replay timing is sped up by
+ *
+ * Since: 0.4.0
+ */
+gdouble
+uhm_server_get_replay_speed (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), 1.0);
 
-			return;
-		} else {
-			/* Change state. */
-			priv->output_stream = output_stream;
-		}
-	}
+	return self->priv->replay_speed;
+}
 
-	/* Start reading from a trace file if online testing is disabled or if we need to compare server responses to the trace file. */
-	if (priv->enable_online == FALSE) {
-		uhm_server_run (self);
-		uhm_server_load_trace (self, trace_file, NULL, &child_error);
+/**
+ * uhm_server_set_replay_speed:
+ * @self: a #UhmServer
+ * @replay_speed: factor to speed up replay timing by, between 0.01 and 100.0
+ *
+ * Sets the value of the #UhmServer:replay-speed property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_replay_speed (UhmServer *self, gdouble replay_speed)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (replay_speed >= 0.01 && replay_speed <= 100.0);
 
-		if (child_error != NULL) {
-			gchar *trace_file_path = g_file_get_path (trace_file);
-			g_set_error (error, child_error->domain, child_error->code,
-			             "Error loading trace file ‘%s’: %s", trace_file_path, child_error->message);
-			g_free (trace_file_path);
+	self->priv->replay_speed = replay_speed;
+	g_object_notify (G_OBJECT (self), "replay-speed");
+}
 
-			g_error_free (child_error);
+/**
+ * uhm_server_get_bandwidth_limit:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:bandwidth-limit property.
+ *
+ * Return value: the maximum rate to send response bodies at, in bytes per second, or 0 if unlimited
+ *
+ * Since: 0.4.0
+ */
+guint
+uhm_server_get_bandwidth_limit (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), 0);
 
-			uhm_server_stop (self);
-			g_clear_object (&priv->output_stream);
+	return self->priv->bandwidth_limit;
+}
 
-			return;
-		}
-	} else if (priv->enable_online == TRUE && priv->enable_logging == FALSE) {
-		uhm_server_load_trace (self, trace_file, NULL, &child_error);
+/**
+ * uhm_server_set_bandwidth_limit:
+ * @self: a #UhmServer
+ * @bandwidth_limit: maximum rate to send response bodies at, in bytes per second, or 0 for no limit
+ *
+ * Sets the value of the #UhmServer:bandwidth-limit property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_bandwidth_limit (UhmServer *self, guint bandwidth_limit)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
 
-		if (child_error != NULL) {
-			gchar *trace_file_path = g_file_get_path (trace_file);
-			g_set_error (error, child_error->domain, child_error->code,
-			             "Error loading trace file ‘%s’: %s", trace_file_path, child_error->message);
-			g_free (trace_file_path);
+	self->priv->bandwidth_limit = bandwidth_limit;
+	g_object_notify (G_OBJECT (self), "bandwidth-limit");
+}
 
-			g_error_free (child_error);
+/**
+ * uhm_server_get_enable_dual_stack:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:enable-dual-stack property.
+ *
+ * Return value: %TRUE if the server listens on the IPv6 loopback address as well as the IPv4 one; %FALSE otherwise
+ *
+ * Since: 0.4.0
+ */
+gboolean
+uhm_server_get_enable_dual_stack (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
 
-			g_clear_object (&priv->output_stream);
+	return self->priv->enable_dual_stack;
+}
 
-			return;
-		}
-	}
+/**
+ * uhm_server_set_enable_dual_stack:
+ * @self: a #UhmServer
+ * @enable_dual_stack: %TRUE to listen on the IPv6 loopback address as well as the IPv4 one; %FALSE otherwise
+ *
+ * Sets the value of the #UhmServer:enable-dual-stack property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_enable_dual_stack (UhmServer *self, gboolean enable_dual_stack)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+
+	self->priv->enable_dual_stack = enable_dual_stack;
+	g_object_notify (G_OBJECT (self), "enable-dual-stack");
 }
 
 /**
- * uhm_server_end_trace:
+ * uhm_server_get_unix_socket_path:
  * @self: a #UhmServer
  *
- * Convenience function to finish logging to or reading from a trace file previously passed to uhm_server_start_trace() or
- * uhm_server_start_trace_full().
+ * Gets the value of the #UhmServer:unix-socket-path property.
  *
- * If #UhmServer:enable-online is %FALSE, this will shut down the mock server (as if uhm_server_stop() had been called).
+ * Return value: (allow-none): the path of the Unix socket the server listens on, or %NULL if it doesn't listen on one
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
-void
-uhm_server_end_trace (UhmServer *self)
+const gchar *
+uhm_server_get_unix_socket_path (UhmServer *self)
 {
-	UhmServerPrivate *priv = self->priv;
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
 
-	g_return_if_fail (UHM_IS_SERVER (self));
+	return self->priv->unix_socket_path;
+}
 
-	if (priv->enable_online == FALSE) {
-		uhm_server_stop (self);
-	} else if (priv->enable_online == TRUE && priv->enable_logging == FALSE) {
-		uhm_server_unload_trace (self);
-	}
+/**
+ * uhm_server_set_unix_socket_path:
+ * @self: a #UhmServer
+ * @unix_socket_path: (allow-none): path of a Unix socket for the server to listen on, or %NULL to not listen on one
+ *
+ * Sets the value of the #UhmServer:unix-socket-path property.
+ *
+ * Since: 0.4.0
+ */
+void
+uhm_server_set_unix_socket_path (UhmServer *self, const gchar *unix_socket_path)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (unix_socket_path == NULL || *unix_socket_path != '\0');
 
-	if (priv->enable_logging == TRUE) {
-		g_clear_object (&self->priv->output_stream);
-	}
+	g_free (self->priv->unix_socket_path);
+	self->priv->unix_socket_path = g_strdup (unix_socket_path);
+	g_object_notify (G_OBJECT (self), "unix-socket-path");
 }
 
 /**
- * uhm_server_get_enable_online:
+ * uhm_server_get_transport_mode:
  * @self: a #UhmServer
  *
- * Gets the value of the #UhmServer:enable-online property.
+ * Gets the value of the #UhmServer:transport-mode property.
  *
- * Return value: %TRUE if the server does not intercept and handle network connections from client code; %FALSE otherwise
+ * Return value: the transport the server serves requests over
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
-gboolean
-uhm_server_get_enable_online (UhmServer *self)
+UhmServerTransportMode
+uhm_server_get_transport_mode (UhmServer *self)
 {
-	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+	g_return_val_if_fail (UHM_IS_SERVER (self), UHM_SERVER_TRANSPORT_MODE_HTTPS);
 
-	return self->priv->enable_online;
+	return self->priv->transport_mode;
 }
 
 /**
- * uhm_server_set_enable_online:
+ * uhm_server_set_transport_mode:
  * @self: a #UhmServer
- * @enable_online: %TRUE to not intercept and handle network connections from client code; %FALSE otherwise
+ * @transport_mode: the transport for the server to serve requests over
  *
- * Sets the value of the #UhmServer:enable-online property.
+ * Sets the value of the #UhmServer:transport-mode property.
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
 void
-uhm_server_set_enable_online (UhmServer *self, gboolean enable_online)
+uhm_server_set_transport_mode (UhmServer *self, UhmServerTransportMode transport_mode)
 {
 	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (transport_mode <= UHM_SERVER_TRANSPORT_MODE_BOTH);
 
-	self->priv->enable_online = enable_online;
-	g_object_notify (G_OBJECT (self), "enable-online");
+	self->priv->transport_mode = transport_mode;
+	g_object_notify (G_OBJECT (self), "transport-mode");
 }
 
 /**
- * uhm_server_get_enable_logging:
+ * uhm_server_get_statistics:
  * @self: a #UhmServer
  *
- * Gets the value of the #UhmServer:enable-logging property.
+ * Gets a snapshot of the statistics about requests handled by the server since it was created, or since uhm_server_reset_statistics()
+ * was last called. Only requests which reach the default #UhmServer::handle-message handler (i.e. which are answered from the trace file,
+ * or with an error because they didn't match it) are counted. Comparing the latencies in the statistics with those seen by a client shows
+ * whether time is being spent in the mock server or in the client.
  *
- * Return value: %TRUE if client network traffic is being logged to a trace file; %FALSE otherwise
+ * This may be called while the server is handling requests in other threads.
  *
- * Since: 0.1.0
+ * Return value: (transfer full): a new #UhmServerStatistics; free with uhm_server_statistics_free()
+ *
+ * Since: 0.4.0
  */
-gboolean
-uhm_server_get_enable_logging (UhmServer *self)
+UhmServerStatistics *
+uhm_server_get_statistics (UhmServer *self)
 {
-	g_return_val_if_fail (UHM_IS_SERVER (self), FALSE);
+	UhmServerStatistics *statistics;
 
-	return self->priv->enable_logging;
+	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
+
+	g_mutex_lock (&self->priv->statistics_lock);
+	statistics = uhm_server_statistics_copy (&self->priv->statistics);
+	g_mutex_unlock (&self->priv->statistics_lock);
+
+	return statistics;
 }
 
 /**
- * uhm_server_set_enable_logging:
+ * uhm_server_reset_statistics:
  * @self: a #UhmServer
- * @enable_logging: %TRUE to log client network traffic to a trace file; %FALSE otherwise
  *
- * Sets the value of the #UhmServer:enable-logging property.
+ * Resets all the statistics returned by uhm_server_get_statistics() to zero.
  *
- * Since: 0.1.0
+ * Since: 0.4.0
  */
 void
-uhm_server_set_enable_logging (UhmServer *self, gboolean enable_logging)
+uhm_server_reset_statistics (UhmServer *self)
 {
+	UhmServerPrivate *priv;
+	guint i;
+
 	g_return_if_fail (UHM_IS_SERVER (self));
 
-	self->priv->enable_logging = enable_logging;
-	g_object_notify (G_OBJECT (self), "enable-logging");
+	priv = self->priv;
+
+	g_mutex_lock (&priv->statistics_lock);
+
+	priv->statistics.n_requests = 0;
+	priv->statistics.n_unexpected_requests = 0;
+	priv->statistics.bytes_received = 0;
+	priv->statistics.bytes_sent = 0;
+
+	for (i = 0; i < N_PHASES; i++) {
+		uhm_histogram_reset (((UhmHistogram **) priv->statistics.histograms)[i]);
+	}
+
+	g_mutex_unlock (&priv->statistics_lock);
 }
 
 /**
- * uhm_server_received_message_chunk:
- * @self: a #UhmServer
- * @message_chunk: single line of a message which was received
- * @message_chunk_length: length of @message_chunk in bytes
- * @error: (allow-none): return location for a #GError, or %NULL
+ * uhm_server_statistics_copy:
+ * @self: a #UhmServerStatistics
  *
- * Indicates to the mock server that a single new line of a message was received from the real server. The message line may be
- * appended to the current trace file if logging is enabled (#UhmServer:enable-logging is %TRUE), adding a newline character
- * at the end. If logging is disabled but online mode is enabled (#UhmServer:enable-online is %TRUE), the message line will
- * be compared to the next expected line in the existing trace file. Otherwise, this function is a no-op.
+ * Copies @self.
  *
- * On failure, @error will be set and the #UhmServer state will remain unchanged apart from the parse state machine, which will remain
- * in the state reached after parsing @message_chunk. A %G_IO_ERROR will be returned if writing to the trace file failed. If in
- * comparison mode and the received message chunk corresponds to an unexpected message in the trace file, a %UHM_SERVER_ERROR will
- * be returned.
+ * Return value: (transfer full): a new copy of @self; free with uhm_server_statistics_free()
  *
- * <note><para>In common cases where message log data only needs to be passed to a #UhmServer and not (for example) logged to an
- * application-specific file or the command line as  well, it is simpler to use uhm_server_received_message_chunk_from_soup(), passing
- * it directly to soup_logger_set_printer(). See the documentation for uhm_server_received_message_chunk_from_soup() for details.</para></note>
+ * Since: 0.4.0
+ */
+UhmServerStatistics *
+uhm_server_statistics_copy (const UhmServerStatistics *self)
+{
+	UhmServerStatistics *copy;
+	UhmHistogram **histograms;
+	guint i;
+
+	g_return_val_if_fail (self != NULL, NULL);
+
+	copy = g_slice_dup (UhmServerStatistics, self);
+	copy->histograms = histograms = g_new (UhmHistogram *, N_PHASES);
+
+	for (i = 0; i < N_PHASES; i++) {
+		histograms[i] = uhm_histogram_copy (((UhmHistogram **) self->histograms)[i]);
+	}
+
+	return copy;
+}
+
+/**
+ * uhm_server_statistics_free:
+ * @self: a #UhmServerStatistics
  *
- * Since: 0.1.0
+ * Frees @self.
+ *
+ * Since: 0.4.0
  */
 void
-uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error)
+uhm_server_statistics_free (UhmServerStatistics *self)
+{
+	g_return_if_fail (self != NULL);
+
+	statistics_histograms_free (self->histograms);
+	g_slice_free (UhmServerStatistics, self);
+}
+
+/**
+ * uhm_server_statistics_get_latency:
+ * @self: a #UhmServerStatistics
+ * @phase: the phase of handling requests to get the latency of
+ * @percentile: percentage of requests, between 0.0 and 100.0
+ *
+ * Gets the latency of @phase which @percentile percent of requests were handled within. For example, a @percentile of 50.0 gives the
+ * median latency, and 100.0 gives the maximum. Latencies are recorded to within about 6% of their true value.
+ *
+ * Return value: the latency, in microseconds, or 0 if no requests have been handled
+ *
+ * Since: 0.4.0
+ */
+guint64
+uhm_server_statistics_get_latency (const UhmServerStatistics *self, UhmServerPhase phase, gdouble percentile)
+{
+	g_return_val_if_fail (self != NULL, 0);
+	g_return_val_if_fail (phase <= UHM_SERVER_PHASE_TOTAL, 0);
+	g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+	return uhm_histogram_get_percentile (((UhmHistogram **) self->histograms)[phase], percentile);
+}
+
+/* Common implementation of the uhm_server_received_message_chunk*() functions. @direction is the first character of the line (‘>’, ‘<’ or
+ * ‘ ’), and @data is the rest of it after the following space, which may contain nul bytes. Lines which don't have the form of a libsoup
+ * log line should be passed with a @direction of ‘\0’, which resets the state machine. Passing the two parts separately means neither
+ * caller has to allocate a copy of the line. */
+static void
+received_message_line (UhmServer *self, gchar direction, const gchar *data, gsize data_length, GError **error)
 {
 	UhmServerPrivate *priv = self->priv;
 	GError *child_error = NULL;
 
-	g_return_if_fail (UHM_IS_SERVER (self));
-	g_return_if_fail (message_chunk != NULL);
-	g_return_if_fail (error == NULL || *error == NULL);
-
 	/* Silently ignore the call if logging is disabled and we're offline, or if a trace file hasn't been specified. */
-	if ((priv->enable_logging == FALSE && priv->enable_online == FALSE) || (priv->enable_logging == TRUE && priv->output_stream == NULL)) {
+	if ((priv->enable_logging == FALSE && priv->enable_online == FALSE) || (priv->enable_logging == TRUE && priv->trace_writer == NULL)) {
 		return;
 	}
 
 	/* Simple state machine to track where we are in the soup log format. */
 	switch (priv->received_message_state) {
 		case UNKNOWN:
-			if (strncmp (message_chunk, "> ", 2) == 0) {
+			if (direction == '>') {
 				priv->received_message_state = REQUEST_DATA;
 			}
 			break;
 		case REQUEST_DATA:
-			if (strcmp (message_chunk, "  ") == 0) {
+			if (direction == ' ' && data_length == 0) {
 				priv->received_message_state = REQUEST_TERMINATOR;
-			} else if (strncmp (message_chunk, "> ", 2) != 0) {
+			} else if (direction != '>') {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case REQUEST_TERMINATOR:
-			if (strncmp (message_chunk, "< ", 2) == 0) {
+			if (direction == '<') {
 				priv->received_message_state = RESPONSE_DATA;
 			} else {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case RESPONSE_DATA:
-			if (strcmp (message_chunk, "  ") == 0) {
+			if (direction == ' ' && data_length == 0) {
 				priv->received_message_state = RESPONSE_TERMINATOR;
-			} else if (strncmp (message_chunk, "< ", 2) != 0) {
+			} else if (direction != '<') {
 				priv->received_message_state = UNKNOWN;
 			}
 			break;
 		case RESPONSE_TERMINATOR:
-			if (strncmp (message_chunk, "> ", 2) == 0) {
+			if (direction == '>') {
 				priv->received_message_state = REQUEST_DATA;
 			} else {
 				priv->received_message_state = UNKNOWN;
@@ -1853,10 +3369,11 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 		return;
 	}
 
-	/* Append to the trace file. */
+	/* Append to the trace file. This is buffered, and written out at the end of each message. */
 	if (priv->enable_logging == TRUE &&
-	    (g_output_stream_write_all (G_OUTPUT_STREAM (priv->output_stream), message_chunk, message_chunk_length, NULL, NULL, &child_error) == FALSE ||
-	     g_output_stream_write_all (G_OUTPUT_STREAM (priv->output_stream), "\n", 1, NULL, NULL, &child_error) == FALSE)) {
+	    (uhm_trace_writer_append_line (priv->trace_writer, direction, data, data_length, &child_error) == FALSE ||
+	     (priv->received_message_state == RESPONSE_TERMINATOR &&
+	      uhm_trace_writer_flush (priv->trace_writer, &child_error) == FALSE))) {
 		gchar *trace_file_path = g_file_get_path (priv->trace_file);
 		g_set_error (error, child_error->domain, child_error->code,
 		             "Error appending to log file ‘%s’: %s", trace_file_path, child_error->message);
@@ -1872,56 +3389,126 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 		/* Build up the message to compare. We explicitly don't escape nul bytes, because we want the trace
 		 * files to be (pretty much) ASCII. File uploads are handled by zero-extending the responses according
 		 * to the traced Content-Length. */
-		g_byte_array_append (priv->comparison_message, (const guint8 *) message_chunk, message_chunk_length);
+		const gchar prefix[2] = { direction, ' ' };
+
+		g_byte_array_append (priv->comparison_message, (const guint8 *) prefix, sizeof (prefix));
+		g_byte_array_append (priv->comparison_message, (const guint8 *) data, data_length);
 		g_byte_array_append (priv->comparison_message, (const guint8 *) "\n", 1);
 
 		if (priv->received_message_state == RESPONSE_TERMINATOR) {
 			/* Received the last chunk of the response, so compare the message from the trace file and that from online. */
-			SoupMessage *online_message;
-			SoupURI *base_uri;
+			SoupMessage *online_message, *expected_message;
 
 			/* End of a message. */
-			base_uri = build_base_uri (self);
-			online_message = trace_to_soup_message ((const gchar *) priv->comparison_message->data, base_uri);
-			soup_uri_free (base_uri);
+			online_message = uhm_trace_message_new_from_data ((const gchar *) priv->comparison_message->data,
+			                                                  priv->comparison_message->len, get_base_uri (self));
 
 			g_byte_array_set_size (priv->comparison_message, 0);
 			priv->received_message_state = UNKNOWN;
 
-			g_assert (priv->next_message != NULL);
+			/* Find the message from the log file to compare against. */
+			g_mutex_lock (&priv->trace_lock);
+
+			if (priv->message_index != NULL) {
+				expected_message = take_indexed_message (self, online_message);
+			} else {
+				g_assert (priv->next_message != NULL);
+				expected_message = g_object_ref (priv->next_message);
+			}
+
+			g_mutex_unlock (&priv->trace_lock);
+
+			if (expected_message == NULL) {
+				gchar *actual_uri;
+
+				actual_uri = soup_uri_to_string (soup_message_get_uri (online_message), TRUE);
+				g_set_error (error, UHM_SERVER_ERROR, UHM_SERVER_ERROR_MESSAGE_MISMATCH,
+				             "Expected no more requests matching ‘%s’.", actual_uri);
+				g_free (actual_uri);
+
+				g_object_unref (online_message);
+
+				return;
+			}
 
 			/* Compare the message from the server with the message in the log file. */
-			if (compare_incoming_message (self, online_message, priv->next_message, NULL) != 0) {
+			if (compare_incoming_message (self, online_message, expected_message, NULL) != 0) {
 				gchar *next_uri, *actual_uri;
 
-				next_uri = soup_uri_to_string (soup_message_get_uri (priv->next_message), TRUE);
+				next_uri = soup_uri_to_string (soup_message_get_uri (expected_message), TRUE);
 				actual_uri = soup_uri_to_string (soup_message_get_uri (online_message), TRUE);
 				g_set_error (error, UHM_SERVER_ERROR, UHM_SERVER_ERROR_MESSAGE_MISMATCH,
 				             "Expected URI ‘%s’, but got ‘%s’.", next_uri, actual_uri);
 				g_free (actual_uri);
 				g_free (next_uri);
 
+				g_object_unref (expected_message);
 				g_object_unref (online_message);
 
 				return;
 			}
 
+			g_object_unref (expected_message);
 			g_object_unref (online_message);
 		}
 	}
 }
 
+/**
+ * uhm_server_received_message_chunk:
+ * @self: a #UhmServer
+ * @message_chunk: single line of a message which was received
+ * @message_chunk_length: length of @message_chunk in bytes
+ * @error: (allow-none): return location for a #GError, or %NULL
+ *
+ * Indicates to the mock server that a single new line of a message was received from the real server. The message line may be
+ * appended to the current trace file if logging is enabled (#UhmServer:enable-logging is %TRUE), adding a newline character
+ * at the end. If logging is disabled but online mode is enabled (#UhmServer:enable-online is %TRUE), the message line will
+ * be compared to the next expected line in the existing trace file. Otherwise, this function is a no-op.
+ *
+ * On failure, @error will be set and the #UhmServer state will remain unchanged apart from the parse state machine, which will remain
+ * in the state reached after parsing @message_chunk. A %G_IO_ERROR will be returned if writing to the trace file failed. If in
+ * comparison mode and the received message chunk corresponds to an unexpected message in the trace file, a %UHM_SERVER_ERROR will
+ * be returned.
+ *
+ * <note><para>In common cases where message log data only needs to be passed to a #UhmServer and not (for example) logged to an
+ * application-specific file or the command line as  well, it is simpler to use uhm_server_received_message_chunk_from_soup(), passing
+ * it directly to soup_logger_set_printer(). See the documentation for uhm_server_received_message_chunk_from_soup() for details.</para></note>
+ *
+ * Since: 0.1.0
+ */
+void
+uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error)
+{
+	g_return_if_fail (UHM_IS_SERVER (self));
+	g_return_if_fail (message_chunk != NULL);
+	g_return_if_fail (message_chunk_length >= -1);
+	g_return_if_fail (error == NULL || *error == NULL);
+
+	if (message_chunk_length == -1) {
+		message_chunk_length = strlen (message_chunk);
+	}
+
+	/* Split the direction prefix off the line. */
+	if (message_chunk_length >= 2 && message_chunk[1] == ' ') {
+		received_message_line (self, message_chunk[0], message_chunk + 2, message_chunk_length - 2, error);
+	} else {
+		received_message_line (self, '\0', message_chunk, message_chunk_length, error);
+	}
+}
+
 /**
  * uhm_server_received_message_chunk_with_direction:
  * @self: a #UhmServer
  * @direction: single character indicating the direction of message transmission
  * @data: single line of a message which was received
- * @data_length: length of @data in bytes
+ * @data_length: length of @data in bytes, or -1 if @data is nul-terminated
  * @error: (allow-none): return location for a #GError, or %NULL
  *
  * Convenience version of uhm_server_received_message_chunk() which takes the
  * message @direction and @data separately, as provided by libsoup in a
- * #SoupLoggerPrinter callback.
+ * #SoupLoggerPrinter callback. If @data_length is given, @data may contain
+ * nul bytes, and they are recorded in the trace file verbatim.
  *
  * <informalexample><programlisting>
  * UhmServer *mock_server;
@@ -1952,18 +3539,13 @@ uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk,
 void
 uhm_server_received_message_chunk_with_direction (UhmServer *self, char direction, const gchar *data, goffset data_length, GError **error)
 {
-	gchar *message_chunk;
-
 	g_return_if_fail (UHM_IS_SERVER (self));
 	g_return_if_fail (direction == '<' || direction == '>' || direction == ' ');
 	g_return_if_fail (data != NULL);
 	g_return_if_fail (data_length >= -1);
 	g_return_if_fail (error == NULL || *error == NULL);
 
-	/* This is inefficient and not nul-safe, but it’ll do for now. */
-	message_chunk = g_strdup_printf ("%c %s", direction, data);
-	uhm_server_received_message_chunk (self, message_chunk, (data_length > -1) ? data_length + 2 : -1, error);
-	g_free (message_chunk);
+	received_message_line (self, direction, data, (data_length > -1) ? (gsize) data_length : strlen (data), error);
 }
 
 /**
@@ -2055,6 +3637,25 @@ uhm_server_get_port (UhmServer *self)
 	return self->priv->port;
 }
 
+/**
+ * uhm_server_get_http_port:
+ * @self: a #UhmServer
+ *
+ * Gets the value of the #UhmServer:http-port property.
+ *
+ * Return value: the port the server is serving plain HTTP on; or <code class="literal">0</code> if the server is not running or is not serving
+ * plain HTTP
+ *
+ * Since: 0.4.0
+ */
+guint
+uhm_server_get_http_port (UhmServer *self)
+{
+	g_return_val_if_fail (UHM_IS_SERVER (self), 0);
+
+	return self->priv->http_port;
+}
+
 /**
  * uhm_server_get_resolver:
  * @self: a #UhmServer
@@ -2119,6 +3720,26 @@ uhm_server_set_tls_certificate (UhmServer *self, GTlsCertificate *tls_certificat
 	g_object_notify (G_OBJECT (self), "tls-certificate");
 }
 
+/* The default certificate is parsed the first time it's needed and then shared by all servers, since parsing it (and the private key in
+ * particular) is slow, and certificates are immutable. */
+static GTlsCertificate *
+get_default_tls_certificate (void)
+{
+	static GTlsCertificate *default_tls_certificate = NULL;  /* owned; never freed */
+
+	if (g_once_init_enter (&default_tls_certificate)) {
+		GTlsCertificate *cert;
+		GError *child_error = NULL;
+
+		cert = g_tls_certificate_new_from_pem (uhm_default_tls_certificate, -1, &child_error);
+		g_assert_no_error (child_error);
+
+		g_once_init_leave (&default_tls_certificate, cert);
+	}
+
+	return default_tls_certificate;
+}
+
 /**
  * uhm_server_set_default_tls_certificate:
  * @self: a #UhmServer
@@ -2128,6 +3749,9 @@ uhm_server_set_tls_certificate (UhmServer *self, GTlsCertificate *tls_certificat
  * be used by clients which have no special certificate requirements; clients which have special requirements should
  * construct a custom #GTlsCertificate and pass it to uhm_server_set_tls_certificate().
  *
+ * Since 0.4.0, the default certificate is only constructed once, and the same #GTlsCertificate is shared by all #UhmServer<!-- -->s in the
+ * process, so this is cheap to call for every test.
+ *
  * Return value: (transfer none): the default certificate set as #UhmServer:tls-certificate
  *
  * Since: 0.1.0
@@ -2136,17 +3760,11 @@ GTlsCertificate *
 uhm_server_set_default_tls_certificate (UhmServer *self)
 {
 	GTlsCertificate *cert;
-	GError *child_error = NULL;
 
 	g_return_val_if_fail (UHM_IS_SERVER (self), NULL);
 
-	/* Build the certificate. */
-	cert = g_tls_certificate_new_from_pem (uhm_default_tls_certificate, -1, &child_error);
-	g_assert_no_error (child_error);
-
-	/* Set it as the property. */
+	cert = get_default_tls_certificate ();
 	uhm_server_set_tls_certificate (self, cert);
-	g_object_unref (cert);
 
 	return cert;
 }
@@ -2172,6 +3790,11 @@ apply_expected_domain_names (UhmServer *self)
 	g_assert (ip_address != NULL);
 
 	for (i = 0; priv->expected_domain_names[i] != NULL; i++) {
+		/* Add the IPv6 address first, as clients generally prefer it. */
+		if (priv->listening_ipv6 == TRUE) {
+			uhm_resolver_add_AAAA (priv->resolver, priv->expected_domain_names[i], "::1");
+		}
+
 		uhm_resolver_add_A (priv->resolver, priv->expected_domain_names[i], ip_address);
 	}
 }
@@ -2184,7 +3807,10 @@ apply_expected_domain_names (UhmServer *self)
  * Set the domain names which are expected to have requests made of them by the client code interacting with this #UhmServer.
  * This is a convenience method which calls uhm_resolver_add_A() on the server’s #UhmResolver for each of the domain names
  * listed in @domain_names. It associates them with the server’s current IP address, and automatically updates the mappings
- * if the IP address or resolver change.
+ * if the IP address or resolver change. If the server is listening on the IPv6 loopback address too (see #UhmServer:enable-dual-stack),
+ * uhm_resolver_add_AAAA() is also called for each of the domain names.
+ *
+ * Since 0.4.0, the domain names may be wildcards of the form ‘*.example.com’, as supported by uhm_resolver_add_A().
  *
  * Note that this will reset all records on the server’s #UhmResolver, replacing all of them with the provided @domain_names.
  *
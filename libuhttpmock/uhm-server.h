@@ -43,6 +43,77 @@ typedef enum {
 
 GQuark uhm_server_error_quark (void) G_GNUC_CONST;
 
+/**
+ * UhmServerPhase:
+ * @UHM_SERVER_PHASE_LOAD: Finding the next expected message in the trace file, including waiting for other server threads to finish
+ * with the trace.
+ * @UHM_SERVER_PHASE_COMPARE: Comparing the request with the expected message.
+ * @UHM_SERVER_PHASE_RESPONSE: Building the response.
+ * @UHM_SERVER_PHASE_TOTAL: All of the above.
+ *
+ * Phases of handling a request, which the latencies in #UhmServerStatistics are broken down by. Time spent sending the response is not
+ * included.
+ *
+ * Since: 0.4.0
+ **/
+typedef enum {
+	UHM_SERVER_PHASE_LOAD = 0,
+	UHM_SERVER_PHASE_COMPARE,
+	UHM_SERVER_PHASE_RESPONSE,
+	UHM_SERVER_PHASE_TOTAL,
+} UhmServerPhase;
+
+/**
+ * UhmServerTransportMode:
+ * @UHM_SERVER_TRANSPORT_MODE_HTTPS: Serve HTTPS on #UhmServer:port, using #UhmServer:tls-certificate.
+ * @UHM_SERVER_TRANSPORT_MODE_HTTP: Serve plain HTTP on #UhmServer:port.
+ * @UHM_SERVER_TRANSPORT_MODE_BOTH: Serve HTTPS on #UhmServer:port, and plain HTTP on #UhmServer:http-port.
+ *
+ * Transports a #UhmServer can serve requests over. See #UhmServer:transport-mode.
+ *
+ * Since: 0.4.0
+ **/
+typedef enum {
+	UHM_SERVER_TRANSPORT_MODE_HTTPS = 0,
+	UHM_SERVER_TRANSPORT_MODE_HTTP,
+	UHM_SERVER_TRANSPORT_MODE_BOTH,
+} UhmServerTransportMode;
+
+#define UHM_TYPE_SERVER_TRANSPORT_MODE	(uhm_server_transport_mode_get_type ())
+
+GType uhm_server_transport_mode_get_type (void) G_GNUC_CONST;
+
+/**
+ * UhmServerStatistics:
+ * @n_requests: number of requests handled
+ * @n_unexpected_requests: number of requests which didn't match the trace file, and were answered with an error
+ * @bytes_received: total length of the request bodies, in bytes
+ * @bytes_sent: total length of the response bodies, in bytes
+ *
+ * Statistics about the requests handled by a #UhmServer, as returned by uhm_server_get_statistics(). The latency of each
+ * #UhmServerPhase can be retrieved with uhm_server_statistics_get_latency().
+ *
+ * Since: 0.4.0
+ */
+typedef struct {
+	guint64 n_requests;
+	guint64 n_unexpected_requests;
+	guint64 bytes_received;
+	guint64 bytes_sent;
+
+	/*< private >*/
+	gpointer histograms;
+} UhmServerStatistics;
+
+#define UHM_TYPE_SERVER_STATISTICS	(uhm_server_statistics_get_type ())
+
+GType uhm_server_statistics_get_type (void) G_GNUC_CONST;
+
+UhmServerStatistics *uhm_server_statistics_copy (const UhmServerStatistics *self) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+void uhm_server_statistics_free (UhmServerStatistics *self);
+
+guint64 uhm_server_statistics_get_latency (const UhmServerStatistics *self, UhmServerPhase phase, gdouble percentile);
+
 #define UHM_TYPE_SERVER			(uhm_server_get_type ())
 #define UHM_SERVER(o)			(G_TYPE_CHECK_INSTANCE_CAST ((o), UHM_TYPE_SERVER, UhmServer))
 #define UHM_SERVER_CLASS(k)		(G_TYPE_CHECK_CLASS_CAST((k), UHM_TYPE_SERVER, UhmServerClass))
@@ -99,6 +170,8 @@ void uhm_server_unload_trace (UhmServer *self);
 void uhm_server_run (UhmServer *self);
 void uhm_server_stop (UhmServer *self);
 
+void uhm_server_complete_message (UhmServer *self, SoupMessage *message);
+
 GFile *uhm_server_get_trace_directory (UhmServer *self);
 void uhm_server_set_trace_directory (UhmServer *self, GFile *trace_directory);
 
@@ -112,12 +185,46 @@ void uhm_server_set_enable_online (UhmServer *self, gboolean enable_online);
 gboolean uhm_server_get_enable_logging (UhmServer *self);
 void uhm_server_set_enable_logging (UhmServer *self, gboolean enable_logging);
 
+gboolean uhm_server_get_enable_preloading (UhmServer *self);
+void uhm_server_set_enable_preloading (UhmServer *self, gboolean enable_preloading);
+
+gboolean uhm_server_get_enable_out_of_order_matching (UhmServer *self);
+void uhm_server_set_enable_out_of_order_matching (UhmServer *self, gboolean enable_out_of_order_matching);
+
+guint uhm_server_get_n_threads (UhmServer *self);
+void uhm_server_set_n_threads (UhmServer *self, guint n_threads);
+
+gboolean uhm_server_get_enable_background_logging (UhmServer *self);
+void uhm_server_set_enable_background_logging (UhmServer *self, gboolean enable_background_logging);
+
+gboolean uhm_server_get_enable_replay_timing (UhmServer *self);
+void uhm_server_set_enable_replay_timing (UhmServer *self, gboolean enable_replay_timing);
+
+gdouble uhm_server_get_replay_speed (UhmServer *self);
+void uhm_server_set_replay_speed (UhmServer *self, gdouble replay_speed);
+
+guint uhm_server_get_bandwidth_limit (UhmServer *self);
+void uhm_server_set_bandwidth_limit (UhmServer *self, guint bandwidth_limit);
+
+gboolean uhm_server_get_enable_dual_stack (UhmServer *self);
+void uhm_server_set_enable_dual_stack (UhmServer *self, gboolean enable_dual_stack);
+
+const gchar *uhm_server_get_unix_socket_path (UhmServer *self);
+void uhm_server_set_unix_socket_path (UhmServer *self, const gchar *unix_socket_path);
+
+UhmServerTransportMode uhm_server_get_transport_mode (UhmServer *self);
+void uhm_server_set_transport_mode (UhmServer *self, UhmServerTransportMode transport_mode);
+
+UhmServerStatistics *uhm_server_get_statistics (UhmServer *self) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+void uhm_server_reset_statistics (UhmServer *self);
+
 void uhm_server_received_message_chunk (UhmServer *self, const gchar *message_chunk, goffset message_chunk_length, GError **error);
 void uhm_server_received_message_chunk_with_direction (UhmServer *self, char direction, const gchar *data, goffset data_length, GError **error);
 void uhm_server_received_message_chunk_from_soup (SoupLogger *logger, SoupLoggerLogLevel level, char direction, const char *data, gpointer user_data);
 
 const gchar *uhm_server_get_address (UhmServer *self);
 guint uhm_server_get_port (UhmServer *self);
+guint uhm_server_get_http_port (UhmServer *self);
 
 UhmResolver *uhm_server_get_resolver (UhmServer *self);
 
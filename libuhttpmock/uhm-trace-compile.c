@@ -0,0 +1,90 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * uhm-trace-compile: convert a trace file to the binary trace format, which is faster for #UhmServer to load. The input may be in either
+ * the text or binary format.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <locale.h>
+
+#include "uhm-trace.h"
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GFile *input_file = NULL, *output_file = NULL;
+	GFileOutputStream *output_stream = NULL;
+	UhmTrace *trace = NULL;
+	GError *error = NULL;
+	int retval = 1;
+
+	setlocale (LC_ALL, "");
+
+#if !GLIB_CHECK_VERSION (2, 35, 0)
+	g_type_init ();
+#endif
+
+	context = g_option_context_new ("INPUT OUTPUT");
+	g_option_context_set_summary (context, "Convert a uhttpmock trace file to the binary trace format.");
+
+	if (g_option_context_parse (context, &argc, &argv, &error) == FALSE) {
+		g_printerr ("%s: %s\n", g_get_prgname (), error->message);
+		goto done;
+	} else if (argc != 3) {
+		g_printerr ("%s: Expected an input and an output file name.\n", g_get_prgname ());
+		goto done;
+	}
+
+	input_file = g_file_new_for_commandline_arg (argv[1]);
+	output_file = g_file_new_for_commandline_arg (argv[2]);
+
+	trace = uhm_trace_new_from_file (input_file, NULL, &error);
+
+	if (trace == NULL) {
+		g_printerr ("%s: Error loading ‘%s’: %s\n", g_get_prgname (), argv[1], error->message);
+		goto done;
+	}
+
+	output_stream = g_file_replace (output_file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error);
+
+	if (output_stream == NULL ||
+	    uhm_trace_compile (trace, G_OUTPUT_STREAM (output_stream), NULL, &error) == FALSE ||
+	    g_output_stream_close (G_OUTPUT_STREAM (output_stream), NULL, &error) == FALSE) {
+		g_printerr ("%s: Error writing ‘%s’: %s\n", g_get_prgname (), argv[2], error->message);
+		goto done;
+	}
+
+	retval = 0;
+
+done:
+	g_clear_error (&error);
+	g_clear_object (&output_stream);
+	g_clear_pointer (&trace, uhm_trace_unref);
+	g_clear_object (&output_file);
+	g_clear_object (&input_file);
+	g_option_context_free (context);
+
+	return retval;
+}
@@ -0,0 +1,183 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read-ahead of trace files.
+ *
+ * Messages are parsed from the trace by a worker thread, ahead of them being needed, and queued until the caller takes them. The queue is
+ * bounded, so the worker stops parsing while it's full and memory use doesn't depend on the length of the trace. The reader is reference
+ * counted, so a caller can wait for a message without holding whatever lock protects its pointer to the reader. The worker is cancelled and
+ * joined when the last reference is dropped.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "uhm-trace.h"
+#include "uhm-trace-reader.h"
+
+struct _UhmTraceReader {
+	volatile gint ref_count;
+
+	UhmTrace *trace;  /* owned; only accessed by the worker thread */
+	gsize offset;  /* offset of the next message to parse from trace; only accessed by the worker thread */
+	SoupURI *base_uri;  /* owned; may be NULL */
+	guint max_queued;
+	GThread *thread;  /* owned */
+
+	/* The state below is shared between the worker thread and the caller, so must only be accessed with lock held. */
+	GMutex lock;
+	GCond cond;  /* signalled when any of the state below changes */
+	GQueue/*<SoupMessage>*/ queue;  /* owned; parsed messages which haven't been taken yet, in order */
+	gboolean finished;  /* TRUE once the worker has reached the end of the trace */
+	gboolean cancelled;  /* TRUE once the reader is being freed */
+};
+
+static gpointer
+read_ahead_thread_cb (gpointer user_data)
+{
+	UhmTraceReader *self = user_data;
+	SoupMessage *message;
+
+	do {
+		/* Wait for space in the queue. */
+		g_mutex_lock (&self->lock);
+
+		while (self->cancelled == FALSE && self->queue.length >= self->max_queued) {
+			g_cond_wait (&self->cond, &self->lock);
+		}
+
+		if (self->cancelled == TRUE) {
+			g_mutex_unlock (&self->lock);
+			break;
+		}
+
+		g_mutex_unlock (&self->lock);
+
+		/* Parse the next message without the lock held, so the caller can take queued messages meanwhile. */
+		message = uhm_trace_next_message (self->trace, &self->offset, self->base_uri);
+
+		g_mutex_lock (&self->lock);
+
+		if (message != NULL) {
+			g_queue_push_tail (&self->queue, message);
+		} else {
+			self->finished = TRUE;
+		}
+
+		g_cond_broadcast (&self->cond);
+		g_mutex_unlock (&self->lock);
+	} while (message != NULL);
+
+	return NULL;
+}
+
+/* Creates a new UhmTraceReader which parses messages from @trace, starting at @offset, in a worker thread. Messages are resolved relative to
+ * @base_uri, which is copied. At most @max_queued messages are parsed before the caller takes them. */
+UhmTraceReader *
+uhm_trace_reader_new (UhmTrace *trace, gsize offset, SoupURI *base_uri, guint max_queued)
+{
+	UhmTraceReader *self;
+
+	g_return_val_if_fail (trace != NULL, NULL);
+	g_return_val_if_fail (max_queued > 0, NULL);
+
+	self = g_slice_new0 (UhmTraceReader);
+	self->ref_count = 1;
+	self->trace = uhm_trace_ref (trace);
+	self->offset = offset;
+	self->base_uri = (base_uri != NULL) ? soup_uri_copy (base_uri) : NULL;
+	self->max_queued = max_queued;
+	g_mutex_init (&self->lock);
+	g_cond_init (&self->cond);
+	g_queue_init (&self->queue);
+
+	self->thread = g_thread_new ("uhm-trace-reader", read_ahead_thread_cb, self);
+
+	return self;
+}
+
+UhmTraceReader *
+uhm_trace_reader_ref (UhmTraceReader *self)
+{
+	g_return_val_if_fail (self != NULL, NULL);
+
+	g_atomic_int_inc (&self->ref_count);
+
+	return self;
+}
+
+/* Once the last reference is dropped, stops the worker thread, waiting for it to finish parsing any message it's in the middle of, and frees
+ * the reader along with any queued messages. */
+void
+uhm_trace_reader_unref (UhmTraceReader *self)
+{
+	g_return_if_fail (self != NULL);
+
+	if (g_atomic_int_dec_and_test (&self->ref_count) == FALSE) {
+		return;
+	}
+
+	g_mutex_lock (&self->lock);
+	self->cancelled = TRUE;
+	g_cond_broadcast (&self->cond);
+	g_mutex_unlock (&self->lock);
+
+	g_thread_join (self->thread);
+
+	while (!g_queue_is_empty (&self->queue)) {
+		g_object_unref (g_queue_pop_head (&self->queue));
+	}
+
+	g_cond_clear (&self->cond);
+	g_mutex_clear (&self->lock);
+	if (self->base_uri != NULL) {
+		soup_uri_free (self->base_uri);
+	}
+	uhm_trace_unref (self->trace);
+
+	g_slice_free (UhmTraceReader, self);
+}
+
+/* Takes the next message from the trace, waiting for the worker thread to parse it if it hasn't already. Returns NULL if the end of the
+ * trace has been reached, as for uhm_trace_next_message(). */
+SoupMessage *
+uhm_trace_reader_next_message (UhmTraceReader *self)
+{
+	SoupMessage *message;
+
+	g_return_val_if_fail (self != NULL, NULL);
+
+	g_mutex_lock (&self->lock);
+
+	while (g_queue_is_empty (&self->queue) && self->finished == FALSE) {
+		g_cond_wait (&self->cond, &self->lock);
+	}
+
+	message = g_queue_pop_head (&self->queue);
+
+	/* Let the worker parse another message into the space. */
+	g_cond_broadcast (&self->cond);
+
+	g_mutex_unlock (&self->lock);
+
+	return message;
+}
@@ -0,0 +1,42 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UHM_TRACE_READER_H
+#define UHM_TRACE_READER_H
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "uhm-trace.h"
+
+G_BEGIN_DECLS
+
+/* Private API for parsing trace files ahead of demand. This is not installed. */
+
+typedef struct _UhmTraceReader UhmTraceReader;
+
+G_GNUC_INTERNAL UhmTraceReader *uhm_trace_reader_new (UhmTrace *trace, gsize offset, SoupURI *base_uri, guint max_queued);
+G_GNUC_INTERNAL UhmTraceReader *uhm_trace_reader_ref (UhmTraceReader *self);
+G_GNUC_INTERNAL void uhm_trace_reader_unref (UhmTraceReader *self);
+
+G_GNUC_INTERNAL SoupMessage *uhm_trace_reader_next_message (UhmTraceReader *self);
+
+G_END_DECLS
+
+#endif /* !UHM_TRACE_READER_H */
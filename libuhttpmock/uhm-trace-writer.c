@@ -0,0 +1,225 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffered trace file writing.
+ *
+ * Lines of a trace are accumulated in memory and written out in large blocks: whenever the caller reaches a message boundary, or when the
+ * buffer grows too large (e.g. because a message has a huge body). Optionally, the blocks are written out by a worker thread, so that
+ * appending lines never blocks on disk I/O. In that case, write errors are reported by the next call to the writer after they happen.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "uhm-trace-writer.h"
+
+/* Initial size of the buffer. */
+#define BUFFER_SIZE (64 * 1024)
+
+/* Maximum size the buffer may grow to before it's written out, even if the caller hasn't reached a message boundary. */
+#define MAX_BUFFER_SIZE (1024 * 1024)
+
+struct _UhmTraceWriter {
+	GOutputStream *output_stream;  /* owned */
+	GByteArray *buffer;  /* owned; data which hasn't been written yet */
+	GThreadPool *thread_pool;  /* owned; NULL if writing synchronously */
+
+	GMutex error_lock;
+	GError *error;  /* owned; first error from writing in the worker thread; protected by error_lock */
+};
+
+static void write_bytes_thread_cb (gpointer data, gpointer user_data);
+
+/* Creates a new UhmTraceWriter which writes to @output_stream. If @write_in_thread is TRUE, writes happen in a worker thread. */
+UhmTraceWriter *
+uhm_trace_writer_new (GOutputStream *output_stream, gboolean write_in_thread)
+{
+	UhmTraceWriter *self;
+
+	g_return_val_if_fail (G_IS_OUTPUT_STREAM (output_stream), NULL);
+
+	self = g_slice_new0 (UhmTraceWriter);
+	self->output_stream = g_object_ref (output_stream);
+	self->buffer = g_byte_array_sized_new (BUFFER_SIZE);
+	g_mutex_init (&self->error_lock);
+
+	if (write_in_thread == TRUE) {
+		/* A single, exclusive, thread guarantees the blocks are written in order. */
+		self->thread_pool = g_thread_pool_new (write_bytes_thread_cb, self, 1, TRUE, NULL);
+	}
+
+	return self;
+}
+
+/* Frees the writer, discarding any data which hasn't been flushed. The output stream is closed when its last reference is dropped. */
+void
+uhm_trace_writer_free (UhmTraceWriter *self)
+{
+	g_return_if_fail (self != NULL);
+
+	if (self->thread_pool != NULL) {
+		g_thread_pool_free (self->thread_pool, FALSE, TRUE);
+	}
+
+	g_clear_error (&self->error);
+	g_mutex_clear (&self->error_lock);
+	g_byte_array_unref (self->buffer);
+	g_object_unref (self->output_stream);
+
+	g_slice_free (UhmTraceWriter, self);
+}
+
+static void
+write_bytes_thread_cb (gpointer data, gpointer user_data)
+{
+	GBytes *bytes = data;
+	UhmTraceWriter *self = user_data;
+	gconstpointer block;
+	gsize length;
+	gboolean failed;
+	GError *child_error = NULL;
+
+	/* Don't write anything more after an error, so the trace file isn't left with a hole in it. */
+	g_mutex_lock (&self->error_lock);
+	failed = (self->error != NULL);
+	g_mutex_unlock (&self->error_lock);
+
+	if (failed == FALSE) {
+		block = g_bytes_get_data (bytes, &length);
+
+		if (g_output_stream_write_all (self->output_stream, block, length, NULL, NULL, &child_error) == FALSE) {
+			g_mutex_lock (&self->error_lock);
+			self->error = child_error;
+			g_mutex_unlock (&self->error_lock);
+		}
+	}
+
+	g_bytes_unref (bytes);
+}
+
+/* Report any error from a previous write in the worker thread. */
+static gboolean
+propagate_thread_error (UhmTraceWriter *self, GError **error)
+{
+	gboolean success = TRUE;
+
+	if (self->thread_pool == NULL) {
+		return TRUE;
+	}
+
+	g_mutex_lock (&self->error_lock);
+
+	if (self->error != NULL) {
+		g_propagate_error (error, g_error_copy (self->error));
+		success = FALSE;
+	}
+
+	g_mutex_unlock (&self->error_lock);
+
+	return success;
+}
+
+/* Appends a line to the trace, formed from @direction, a space, the @length bytes of @data (which may contain nul bytes) and a newline.
+ * The data is buffered, so errors writing it may be reported by a later call. */
+gboolean
+uhm_trace_writer_append_line (UhmTraceWriter *self, gchar direction, const gchar *data, gsize length, GError **error)
+{
+	const gchar prefix[2] = { direction, ' ' };
+
+	g_return_val_if_fail (self != NULL, FALSE);
+	g_return_val_if_fail (data != NULL || length == 0, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	g_byte_array_append (self->buffer, (const guint8 *) prefix, sizeof (prefix));
+	g_byte_array_append (self->buffer, (const guint8 *) data, length);
+	g_byte_array_append (self->buffer, (const guint8 *) "\n", 1);
+
+	if (self->buffer->len >= MAX_BUFFER_SIZE) {
+		return uhm_trace_writer_flush (self, error);
+	}
+
+	return propagate_thread_error (self, error);
+}
+
+/* Writes out all buffered data, either synchronously or by handing it to the worker thread. */
+gboolean
+uhm_trace_writer_flush (UhmTraceWriter *self, GError **error)
+{
+	g_return_val_if_fail (self != NULL, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	if (self->buffer->len == 0) {
+		return propagate_thread_error (self, error);
+	}
+
+	if (self->thread_pool != NULL) {
+		GBytes *bytes;
+
+		/* Hand the buffer over to the worker thread and start a new one. */
+		bytes = g_byte_array_free_to_bytes (self->buffer);
+		self->buffer = g_byte_array_sized_new (BUFFER_SIZE);
+
+		g_thread_pool_push (self->thread_pool, bytes, NULL);
+
+		return propagate_thread_error (self, error);
+	} else {
+		gboolean success;
+
+		success = g_output_stream_write_all (self->output_stream, self->buffer->data, self->buffer->len, NULL, NULL, error);
+		g_byte_array_set_size (self->buffer, 0);
+
+		return success;
+	}
+}
+
+/* Writes out all buffered data, waits for the worker thread (if any) to finish writing, and closes the output stream. */
+gboolean
+uhm_trace_writer_close (UhmTraceWriter *self, GError **error)
+{
+	GError *child_error = NULL;
+
+	g_return_val_if_fail (self != NULL, FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	uhm_trace_writer_flush (self, &child_error);
+
+	if (self->thread_pool != NULL) {
+		g_thread_pool_free (self->thread_pool, FALSE, TRUE);
+		self->thread_pool = NULL;
+
+		/* Pick up any errors from the final writes. */
+		if (child_error == NULL && self->error != NULL) {
+			child_error = g_error_copy (self->error);
+		}
+	}
+
+	if (child_error == NULL) {
+		g_output_stream_close (self->output_stream, NULL, &child_error);
+	}
+
+	if (child_error != NULL) {
+		g_propagate_error (error, child_error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
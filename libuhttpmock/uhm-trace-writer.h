@@ -0,0 +1,42 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UHM_TRACE_WRITER_H
+#define UHM_TRACE_WRITER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Private API for buffered writing of trace files. This is not installed. */
+
+typedef struct _UhmTraceWriter UhmTraceWriter;
+
+G_GNUC_INTERNAL UhmTraceWriter *uhm_trace_writer_new (GOutputStream *output_stream, gboolean write_in_thread);
+G_GNUC_INTERNAL void uhm_trace_writer_free (UhmTraceWriter *self);
+
+G_GNUC_INTERNAL gboolean uhm_trace_writer_append_line (UhmTraceWriter *self, gchar direction, const gchar *data, gsize length,
+                                                       GError **error);
+G_GNUC_INTERNAL gboolean uhm_trace_writer_flush (UhmTraceWriter *self, GError **error);
+G_GNUC_INTERNAL gboolean uhm_trace_writer_close (UhmTraceWriter *self, GError **error);
+
+G_END_DECLS
+
+#endif /* !UHM_TRACE_WRITER_H */
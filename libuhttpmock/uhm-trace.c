@@ -0,0 +1,1399 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Trace file loading and parsing.
+ *
+ * A trace file is loaded into memory in one go — by mapping it if it's a local file, or by reading it otherwise — and is then parsed
+ * in place, one request–response pair at a time. Message bodies are not copied out of the loaded trace: they are appended to the
+ * parsed #SoupMessages as #SoupBuffers which reference the loaded data, so even very large traces can be replayed without
+ * duplicating their contents. The only exception is the start of multi-line bodies in the text format, up to a small limit, which is
+ * gathered into a single buffer so that it isn't split into a chunk per line.
+ *
+ * Two formats are supported: the text format written by uhm_server_received_message_chunk() (lines prefixed by “> ” or “< ”, with each
+ * half of a message terminated by a “  ” line), and a compiled binary format produced by uhm_trace_compile(), which is faster to parse
+ * and can hold arbitrary bodies. Files in the binary format are identified by their magic number; anything else is treated as text.
+ *
+ * The binary format is laid out as follows, with all integers stored little-endian:
+ *
+ *   File header:
+ *     8 bytes   magic “UHMTRACE”
+ *     u32       format version (currently 1)
+ *     u32       reserved (0)
+ *   Messages, each:
+ *     string    request method
+ *     string    request URI (path and query only)
+ *     u32       request HTTP version (a #SoupHTTPVersion)
+ *     headers   request headers
+ *     blob      request body
+ *     u32       response HTTP version
+ *     u32       response status code
+ *     string    response reason phrase
+ *     headers   response headers
+ *     blob      response body
+ *   Offset index:
+ *     u64 × n   offset of each message from the start of the file
+ *     u64       number of messages, n
+ *     u64       offset of the index from the start of the file
+ *     8 bytes   magic “UHMINDEX”
+ *
+ * where a string is a u32 length followed by that many bytes and a nul terminator (not included in the length), headers are a u32
+ * count followed by that many pairs of name and value strings, and a blob is a u64 length followed by that many bytes. Strings are
+ * nul-terminated so that they can be passed to libsoup without being copied.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#include "uhm-trace.h"
+
+#define BINARY_MAGIC "UHMTRACE"
+#define BINARY_INDEX_MAGIC "UHMINDEX"
+#define BINARY_MAGIC_LENGTH 8
+#define BINARY_VERSION 1
+#define BINARY_HEADER_LENGTH (BINARY_MAGIC_LENGTH + 4 /* version */ + 4 /* reserved */)
+#define BINARY_FOOTER_LENGTH (8 /* number of messages */ + 8 /* index offset */ + BINARY_MAGIC_LENGTH)
+
+struct _UhmTrace {
+	volatile gint ref_count;
+
+	GBytes *bytes;  /* owned */
+	SoupBuffer *buffer;  /* owned; wraps bytes so that message bodies can be sub-buffers of it */
+
+	gboolean is_binary;
+	gsize data_start;  /* offset of the first message */
+	gsize data_end;  /* offset of the end of the last message; for binary traces, this is the offset of the index */
+	guint64 n_messages;  /* number of messages in the index; only valid for binary traces */
+};
+
+static inline guint32
+read_uint32_unchecked (const gchar *p)
+{
+	guint32 value;
+
+	memcpy (&value, p, sizeof (value));
+
+	return GUINT32_FROM_LE (value);
+}
+
+static inline guint64
+read_uint64_unchecked (const gchar *p)
+{
+	guint64 value;
+
+	memcpy (&value, p, sizeof (value));
+
+	return GUINT64_FROM_LE (value);
+}
+
+/* Check the header and footer of a binary trace and extract the location of its messages. */
+static gboolean
+load_binary_header (UhmTrace *self, GError **error)
+{
+	const gchar *data = self->buffer->data;
+	gsize length = self->buffer->length;
+	guint32 version;
+	guint64 n_messages, index_offset;
+
+	version = read_uint32_unchecked (data + BINARY_MAGIC_LENGTH);
+
+	if (version != BINARY_VERSION) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+		             "Unsupported binary trace format version %u.", version);
+		return FALSE;
+	}
+
+	if (length < BINARY_HEADER_LENGTH + BINARY_FOOTER_LENGTH ||
+	    memcmp (data + length - BINARY_MAGIC_LENGTH, BINARY_INDEX_MAGIC, BINARY_MAGIC_LENGTH) != 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Binary trace is truncated.");
+		return FALSE;
+	}
+
+	n_messages = read_uint64_unchecked (data + length - BINARY_FOOTER_LENGTH);
+	index_offset = read_uint64_unchecked (data + length - BINARY_FOOTER_LENGTH + 8);
+
+	if (index_offset < BINARY_HEADER_LENGTH || index_offset > length - BINARY_FOOTER_LENGTH ||
+	    n_messages != (length - BINARY_FOOTER_LENGTH - index_offset) / 8 ||
+	    (length - BINARY_FOOTER_LENGTH - index_offset) % 8 != 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Binary trace has a corrupt offset index.");
+		return FALSE;
+	}
+
+	self->is_binary = TRUE;
+	self->data_start = BINARY_HEADER_LENGTH;
+	self->data_end = index_offset;
+	self->n_messages = n_messages;
+
+	return TRUE;
+}
+
+/* Creates a new UhmTrace for parsing the given trace file contents, detecting whether they're in the text or binary format. Unref the
+ * result with uhm_trace_unref(). Returns NULL and sets @error if the contents are in an unsupported version of the binary format, or are
+ * a corrupt binary trace. */
+UhmTrace *
+uhm_trace_new_from_bytes (GBytes *bytes, GError **error)
+{
+	UhmTrace *self;
+	gconstpointer data;
+	gsize length;
+
+	g_return_val_if_fail (bytes != NULL, NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	self = g_slice_new0 (UhmTrace);
+	self->ref_count = 1;
+	self->bytes = g_bytes_ref (bytes);
+
+	data = g_bytes_get_data (bytes, &length);
+	self->buffer = soup_buffer_new_with_owner (data, length, g_bytes_ref (bytes), (GDestroyNotify) g_bytes_unref);
+
+	self->is_binary = FALSE;
+	self->data_start = 0;
+	self->data_end = length;
+
+	if (length >= BINARY_HEADER_LENGTH && memcmp (data, BINARY_MAGIC, BINARY_MAGIC_LENGTH) == 0 &&
+	    load_binary_header (self, error) == FALSE) {
+		uhm_trace_unref (self);
+		return NULL;
+	}
+
+	return self;
+}
+
+/* Loads the given trace file into memory, ready to be parsed. Local files are mapped rather than read, so their contents are only paged in
+ * as they are parsed, and are shared with the page cache. Returns NULL and sets @error on failure. */
+UhmTrace *
+uhm_trace_new_from_file (GFile *trace_file, GCancellable *cancellable, GError **error)
+{
+	UhmTrace *self;
+	GBytes *bytes = NULL;
+	gchar *path;
+
+	g_return_val_if_fail (G_IS_FILE (trace_file), NULL);
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error) == TRUE) {
+		return NULL;
+	}
+
+	path = g_file_get_path (trace_file);
+
+	if (path != NULL) {
+		GMappedFile *mapped_file;
+
+		mapped_file = g_mapped_file_new (path, FALSE, NULL);
+
+		if (mapped_file != NULL) {
+			bytes = g_mapped_file_get_bytes (mapped_file);
+			g_mapped_file_unref (mapped_file);
+		}
+
+		g_free (path);
+	}
+
+	/* Fall back to reading the file if it isn't local or couldn't be mapped. This also reports any errors accessing the file as a
+	 * G_IO_ERROR, which is what our callers document. */
+	if (bytes == NULL) {
+		gchar *contents;
+		gsize length;
+
+		if (g_file_load_contents (trace_file, cancellable, &contents, &length, NULL, error) == FALSE) {
+			return NULL;
+		}
+
+		bytes = g_bytes_new_take (contents, length);
+	}
+
+	self = uhm_trace_new_from_bytes (bytes, error);
+	g_bytes_unref (bytes);
+
+	return self;
+}
+
+UhmTrace *
+uhm_trace_ref (UhmTrace *self)
+{
+	g_return_val_if_fail (self != NULL, NULL);
+
+	g_atomic_int_inc (&self->ref_count);
+
+	return self;
+}
+
+/* Messages parsed from the trace hold their own references to the trace data, so remain valid after the UhmTrace is freed. */
+void
+uhm_trace_unref (UhmTrace *self)
+{
+	g_return_if_fail (self != NULL);
+
+	if (g_atomic_int_dec_and_test (&self->ref_count) == TRUE) {
+		soup_buffer_free (self->buffer);
+		g_bytes_unref (self->bytes);
+
+		g_slice_free (UhmTrace, self);
+	}
+}
+
+/* Returns the length of the line starting at @line, excluding its terminating newline (if it has one). */
+static inline gsize
+line_length (const gchar *line, const gchar *end)
+{
+	const gchar *newline;
+
+	newline = memchr (line, '\n', end - line);
+
+	return (newline != NULL) ? (gsize) (newline - line) : (gsize) (end - line);
+}
+
+/* Returns a pointer to the start of the line following the one starting at @line, of length @length. */
+static inline const gchar *
+skip_line (const gchar *line, gsize length, const gchar *end)
+{
+	return (line + length < end) ? line + length + 1 : end;
+}
+
+/* Returns TRUE iff the given line is a message terminator line: “  ”. */
+static inline gboolean
+is_terminator_line (const gchar *line, gsize length)
+{
+	return (length == 2 && line[0] == ' ' && line[1] == ' ');
+}
+
+/* Returns TRUE iff the given line starts with the given message direction prefix: “> ” or “< ”. */
+static inline gboolean
+has_direction_prefix (const gchar *line, gsize length, gchar message_direction)
+{
+	return (length >= 2 && line[0] == message_direction && line[1] == ' ');
+}
+
+/* If the text at *_p starts with @literal, advance *_p past it and return TRUE; otherwise return FALSE. */
+static inline gboolean
+consume_literal (const gchar **_p, const gchar *end, const gchar *literal)
+{
+	gsize literal_length = strlen (literal);
+
+	if ((gsize) (end - *_p) < literal_length || memcmp (*_p, literal, literal_length) != 0) {
+		return FALSE;
+	}
+
+	*_p += literal_length;
+
+	return TRUE;
+}
+
+/* Whether @c may appear in an HTTP token, such as a request method (RFC 7230, §3.2.6). */
+static inline gboolean
+is_token_char (gchar c)
+{
+	return g_ascii_isalnum (c) || (c != '\0' && strchr ("!#$%&'*+-.^_`|~", c) != NULL);
+}
+
+/* Request methods which libsoup defines constants for, and which are hence likely to appear in traces. Each is interned on first use. */
+static const struct {
+	const gchar *name;
+	gsize length;
+} known_methods[] = {
+#define METHOD(M) { M, sizeof (M) - 1 }
+	METHOD ("GET"),
+	METHOD ("POST"),
+	METHOD ("PUT"),
+	METHOD ("DELETE"),
+	METHOD ("HEAD"),
+	METHOD ("OPTIONS"),
+	METHOD ("TRACE"),
+	METHOD ("CONNECT"),
+	METHOD ("PROPFIND"),
+	METHOD ("PROPPATCH"),
+	METHOD ("MKCOL"),
+	METHOD ("COPY"),
+	METHOD ("MOVE"),
+	METHOD ("LOCK"),
+	METHOD ("UNLOCK"),
+#undef METHOD
+};
+
+/* Returns the interned request method for the @length bytes at @token, which must all be token characters. Known methods are found by a
+ * linear scan of known_methods[], which is short and compares lengths before contents, so it avoids taking the global lock which interning a
+ * string needs. Any other method is copied and interned afresh, which does take the lock. */
+static const gchar *
+intern_method (const gchar *token, gsize length)
+{
+	static const gchar *interned_known_methods[G_N_ELEMENTS (known_methods)];
+	static gsize initialised = 0;
+	const gchar *method;
+	gchar *copy;
+	guint i;
+
+	if (g_once_init_enter (&initialised)) {
+		for (i = 0; i < G_N_ELEMENTS (known_methods); i++) {
+			interned_known_methods[i] = g_intern_static_string (known_methods[i].name);
+		}
+
+		g_once_init_leave (&initialised, 1);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (known_methods); i++) {
+		if (known_methods[i].length == length && memcmp (known_methods[i].name, token, length) == 0) {
+			return interned_known_methods[i];
+		}
+	}
+
+	/* Extension methods, such as PATCH or REPORT. */
+	copy = g_strndup (token, length);
+	method = g_intern_string (copy);
+	g_free (copy);
+
+	return method;
+}
+
+/* If the text at *_p starts with a request method, advance *_p past it and return the interned method; otherwise return NULL. */
+static const gchar *
+consume_method (const gchar **_p, const gchar *end)
+{
+	const gchar *start = *_p, *p = *_p;
+
+	while (p < end && is_token_char (*p) == TRUE) {
+		p++;
+	}
+
+	if (p == start) {
+		return NULL;
+	}
+
+	*_p = p;
+
+	return intern_method (start, p - start);
+}
+
+/* Wrap the @length bytes at @data, which lie within @owner, in a new buffer without copying them. The new buffer holds a reference to the
+ * #GBytes which owns @owner's data, rather than being a sub-buffer of @owner: #SoupBuffer reference counts aren't atomic, but #GBytes
+ * ones are, and message bodies are shared with responses which may be sent and freed by several server threads at once. */
+static SoupBuffer *
+new_body_buffer (SoupBuffer *owner, const gchar *data, gsize length)
+{
+	GBytes *bytes = soup_buffer_get_owner (owner);
+
+	return soup_buffer_new_with_owner (data, length, g_bytes_ref (bytes), (GDestroyNotify) g_bytes_unref);
+}
+
+/* Append a single body line, and the newline which follows it, to @message_body. If @owner is non-%NULL, the line is referenced from it
+ * rather than copied. */
+static void
+append_body_line (SoupMessageBody *message_body, const gchar *line, gsize length, gboolean has_newline, SoupBuffer *owner)
+{
+	if (owner != NULL) {
+		SoupBuffer *buffer;
+
+		buffer = new_body_buffer (owner, line, (has_newline == TRUE) ? length + 1 : length);
+		soup_message_body_append_buffer (message_body, buffer);
+		soup_buffer_free (buffer);
+	} else {
+		soup_message_body_append (message_body, SOUP_MEMORY_COPY, line, (has_newline == TRUE) ? length + 1 : length);
+	}
+
+	/* The last line of the file may not have a trailing newline, but body lines always need one. */
+	if (has_newline == FALSE) {
+		soup_message_body_append (message_body, SOUP_MEMORY_STATIC, "\n", 1);
+	}
+}
+
+/* Size of the buffer used to nul-terminate headers on the stack. Longer headers are copied to the heap. */
+#define HEADER_BUFFER_SIZE 1024
+
+/* Append a header, with the @name_length bytes at @name as its name and the @value_length bytes at @value as its value, to
+ * @message_headers. libsoup copies both, so they only need to be nul-terminated for long enough to append them, which is normally done in
+ * a buffer on the stack rather than by allocating memory for each header. */
+static void
+append_header (SoupMessageHeaders *message_headers, const gchar *name, gsize name_length, const gchar *value, gsize value_length)
+{
+	gchar stack_buffer[HEADER_BUFFER_SIZE];
+	gchar *buffer;
+	gsize buffer_length = name_length + 1 + value_length + 1;
+
+	buffer = (buffer_length <= sizeof (stack_buffer)) ? stack_buffer : g_malloc (buffer_length);
+
+	memcpy (buffer, name, name_length);
+	buffer[name_length] = '\0';
+	memcpy (buffer + name_length + 1, value, value_length);
+	buffer[buffer_length - 1] = '\0';
+
+	soup_message_headers_append (message_headers, buffer, buffer + name_length + 1);
+
+	if (buffer != stack_buffer) {
+		g_free (buffer);
+	}
+}
+
+/* Maximum size of the start of a multi-line body to gather into a single buffer. See parse_headers_and_body(). */
+#define MAX_GATHERED_BODY_SIZE (64 * 1024)
+
+/* Append the body lines gathered in @body to @message_body as a single chunk. This takes ownership of @body. */
+static void
+append_gathered_body (SoupMessageBody *message_body, GByteArray *body)
+{
+	gsize length = body->len;
+
+	soup_message_body_append_take (message_body, g_byte_array_free (body, FALSE), length);
+}
+
+static gboolean
+parse_headers_and_body (SoupMessageHeaders *message_headers, SoupMessageBody *message_body, const gchar message_direction,
+                        const gchar **_trace, const gchar *end, SoupBuffer *owner)
+{
+	const gchar *trace = *_trace;
+	const gchar *line, *colon;
+	gsize length;
+	const gchar *first_line = NULL;
+	gsize first_length = 0;
+	gboolean first_has_newline = FALSE;
+	GByteArray *body = NULL;
+	enum {
+		BODY_EMPTY,
+		BODY_ONE_LINE,  /* the first line is in first_line, and may be referenced from the trace */
+		BODY_GATHERING,  /* all the lines so far have been copied into body */
+		BODY_REFERENCING,  /* the lines so far have been appended to message_body; later ones are referenced from the trace */
+	} body_state = BODY_EMPTY;
+
+	/* Parse headers. */
+	while (TRUE) {
+		if (trace >= end) {
+			/* No body. */
+			goto done;
+		}
+
+		line = trace;
+		length = line_length (line, end);
+		trace = skip_line (line, length, end);
+
+		if (is_terminator_line (line, length) == TRUE) {
+			/* No body. */
+			goto done;
+		} else if (has_direction_prefix (line, length, message_direction) == FALSE) {
+			g_warning ("Unrecognised start sequence ‘%.*s’.", (gint) MIN (length, 2), line);
+			goto error;
+		}
+
+		line += 2;
+		length -= 2;
+
+		if (length == 0) {
+			/* Reached the end of the headers. */
+			break;
+		}
+
+		colon = memchr (line, ':', length);
+		if (colon == NULL || colon + 1 >= line + length || *(colon + 1) != ' ') {
+			g_warning ("Missing spacer ‘: ’.");
+			goto error;
+		}
+
+		append_header (message_headers, line, colon - line, colon + 2, (line + length) - (colon + 2));
+	}
+
+	/* Parse the body. Its lines are interleaved with direction prefixes in the trace, so a body of more than one line can't be referenced
+	 * from the trace as a whole. Rather than appending each line as a separate chunk, the start of such a body is gathered into a single
+	 * buffer, so small bodies are sent as one chunk. Single-line bodies, which are the most common, and the remainder of large bodies are
+	 * still referenced without copying. */
+	while (trace < end) {
+		line = trace;
+		length = line_length (line, end);
+		trace = skip_line (line, length, end);
+
+		if (is_terminator_line (line, length) == TRUE) {
+			/* End of the body. */
+			break;
+		} else if (has_direction_prefix (line, length, message_direction) == FALSE) {
+			g_warning ("Unrecognised start sequence ‘%.*s’.", (gint) MIN (length, 2), line);
+			goto error;
+		}
+
+		line += 2;
+		length -= 2;
+
+		switch (body_state) {
+			case BODY_EMPTY:
+				first_line = line;
+				first_length = length;
+				first_has_newline = (line + length < end);
+				body_state = BODY_ONE_LINE;
+				break;
+			case BODY_ONE_LINE:
+				if (first_length + 1 + length + 1 > MAX_GATHERED_BODY_SIZE) {
+					/* The body is large from the start, so don't gather any of it. */
+					append_body_line (message_body, first_line, first_length, first_has_newline, owner);
+					append_body_line (message_body, line, length, line + length < end, owner);
+					body_state = BODY_REFERENCING;
+					break;
+				}
+
+				body = g_byte_array_sized_new (MIN (MAX (2 * (first_length + length + 2), 256), MAX_GATHERED_BODY_SIZE));
+				g_byte_array_append (body, (const guint8 *) first_line, first_length);
+				g_byte_array_append (body, (const guint8 *) "\n", 1);
+				body_state = BODY_GATHERING;
+				/* Fall through. */
+			case BODY_GATHERING:
+				if (body->len + length + 1 <= MAX_GATHERED_BODY_SIZE) {
+					/* Body lines always need a trailing newline, even if it's missing from the last line of the file. */
+					g_byte_array_append (body, (const guint8 *) line, length);
+					g_byte_array_append (body, (const guint8 *) "\n", 1);
+					break;
+				}
+
+				/* The body is large, so stop gathering it, to avoid copying all of it. */
+				append_gathered_body (message_body, body);
+				body = NULL;
+				body_state = BODY_REFERENCING;
+				/* Fall through. */
+			case BODY_REFERENCING:
+				append_body_line (message_body, line, length, line + length < end, owner);
+				break;
+			default:
+				g_assert_not_reached ();
+		}
+	}
+
+	if (body_state == BODY_ONE_LINE) {
+		append_body_line (message_body, first_line, first_length, first_has_newline, owner);
+	} else if (body_state == BODY_GATHERING) {
+		append_gathered_body (message_body, body);
+		body = NULL;
+	}
+
+done:
+	/* Done. Update the output trace pointer. */
+	soup_message_body_complete (message_body);
+	*_trace = trace;
+
+	return TRUE;
+
+error:
+	if (body != NULL) {
+		g_byte_array_unref (body);
+	}
+
+	return FALSE;
+}
+
+/* Parses a single request–response pair from the trace data between @trace and @end. base_uri is the base URI for the server,
+ * e.g. https://127.0.0.1:1431. If @owner is non-%NULL, it must contain the trace data, and message bodies will reference it rather than
+ * copying from it. */
+static SoupMessage *
+parse_message (const gchar *trace, const gchar *end, SoupURI *base_uri, SoupBuffer *owner)
+{
+	SoupMessage *message = NULL;
+	const gchar *line, *line_end, *p, *i, *j, *method;
+	gchar *uri_string = NULL, *response_message;
+	SoupHTTPVersion http_version;
+	guint response_status;
+	SoupURI *uri;
+	gsize length;
+
+	/* The traces look somewhat like this:
+	 * > POST /unauth HTTP/1.1
+	 * > Soup-Debug-Timestamp: 1200171744
+	 * > Soup-Debug: SoupSessionAsync 1 (0x612190), SoupMessage 1 (0x617000), SoupSocket 1 (0x612220)
+	 * > Host: localhost
+	 * > Content-Type: text/plain
+	 * > Connection: close
+	 * >
+	 * > This is a test.
+	 *
+	 * < HTTP/1.1 201 Created
+	 * < Soup-Debug-Timestamp: 1200171744
+	 * < Soup-Debug: SoupMessage 1 (0x617000)
+	 * < Date: Sun, 12 Jan 2008 21:02:24 GMT
+	 * < Content-Length: 0
+	 *
+	 * This function parses a single request–response pair.
+	 */
+
+	/* Parse the method, URI and HTTP version first. */
+	line = trace;
+	length = line_length (line, end);
+	trace = skip_line (line, length, end);
+
+	if (has_direction_prefix (line, length, '>') == FALSE) {
+		g_warning ("Unrecognised start sequence ‘%.*s’.", (gint) MIN (length, 2), line);
+		goto error;
+	}
+
+	p = line + 2;
+	line_end = line + length;
+
+	/* Parse “POST /unauth HTTP/1.1”. Any method is accepted. */
+	method = consume_method (&p, line_end);
+
+	if (method == NULL) {
+		g_warning ("Unknown method ‘%.*s’.", (gint) (line_end - p), p);
+		goto error;
+	}
+
+	if (p >= line_end || *p != ' ') {
+		g_warning ("Unrecognised spacer ‘%.*s’.", (gint) MIN (line_end - p, 1), p);
+		goto error;
+	}
+	p++;
+
+	i = memchr (p, ' ', line_end - p);
+	if (i == NULL) {
+		g_warning ("Missing spacer ‘ ’.");
+		goto error;
+	}
+
+	uri_string = g_strndup (p, i - p);
+	p = i + 1;
+
+	if (consume_literal (&p, line_end, "HTTP/1.1") == TRUE) {
+		http_version = SOUP_HTTP_1_1;
+	} else if (consume_literal (&p, line_end, "HTTP/1.0") == TRUE) {
+		http_version = SOUP_HTTP_1_0;
+	} else {
+		g_warning ("Unrecognised HTTP version ‘%.*s’.", (gint) (line_end - p), p);
+		http_version = SOUP_HTTP_1_1;
+	}
+
+	if (p != line_end) {
+		g_warning ("Unrecognised spacer ‘%c’.", *p);
+		goto error;
+	}
+
+	/* Build the message. */
+	uri = soup_uri_new_with_base (base_uri, uri_string);
+	message = soup_message_new_from_uri (method, uri);
+	soup_uri_free (uri);
+
+	if (message == NULL) {
+		g_warning ("Invalid URI ‘%s’.", uri_string);
+		goto error;
+	}
+
+	soup_message_set_http_version (message, http_version);
+	g_clear_pointer (&uri_string, g_free);
+
+	/* Parse the request headers and body. */
+	if (parse_headers_and_body (message->request_headers, message->request_body, '>', &trace, end, owner) == FALSE) {
+		goto error;
+	}
+
+	/* Parse the response, starting with “HTTP/1.1 201 Created”. */
+	line = trace;
+	length = line_length (line, end);
+	trace = skip_line (line, length, end);
+
+	if (has_direction_prefix (line, length, '<') == FALSE) {
+		g_warning ("Unrecognised start sequence ‘%.*s’.", (gint) MIN (length, 2), line);
+		goto error;
+	}
+
+	p = line + 2;
+	line_end = line + length;
+
+	if (consume_literal (&p, line_end, "HTTP/1.1") == TRUE) {
+		http_version = SOUP_HTTP_1_1;
+	} else if (consume_literal (&p, line_end, "HTTP/1.0") == TRUE) {
+		http_version = SOUP_HTTP_1_0;
+	} else {
+		g_warning ("Unrecognised HTTP version ‘%.*s’.", (gint) (line_end - p), p);
+	}
+
+	if (p >= line_end || *p != ' ') {
+		g_warning ("Unrecognised spacer ‘%.*s’.", (gint) MIN (line_end - p, 1), p);
+		goto error;
+	}
+	p++;
+
+	i = memchr (p, ' ', line_end - p);
+	if (i == NULL) {
+		g_warning ("Missing spacer ‘ ’.");
+		goto error;
+	}
+
+	response_status = g_ascii_strtoull (p, (gchar **) &j, 10);
+	if (j != i) {
+		g_warning ("Invalid status ‘%.*s’.", (gint) (line_end - p), p);
+		goto error;
+	}
+
+	response_message = g_strndup (i + 1, line_end - (i + 1));
+	soup_message_set_status_full (message, response_status, response_message);
+	g_free (response_message);
+
+	/* Parse the response headers and body. */
+	if (parse_headers_and_body (message->response_headers, message->response_body, '<', &trace, end, owner) == FALSE) {
+		goto error;
+	}
+
+	return message;
+
+error:
+	g_free (uri_string);
+	g_clear_object (&message);
+
+	return NULL;
+}
+
+/* Finds the end of the request–response pair starting at @start. Each half of the pair is ended by a terminator line (or by the end
+ * of the data). */
+static const gchar *
+find_message_end (const gchar *start, const gchar *end)
+{
+	const gchar *trace = start;
+	guint n_terminators = 0;
+
+	while (trace < end && n_terminators < 2) {
+		gsize length = line_length (trace, end);
+
+		if (is_terminator_line (trace, length) == TRUE) {
+			n_terminators++;
+		}
+
+		trace = skip_line (trace, length, end);
+	}
+
+	return trace;
+}
+
+typedef struct {
+	const gchar *p;
+	const gchar *end;
+} BinaryReader;
+
+static gboolean
+binary_reader_read_uint32 (BinaryReader *reader, guint32 *value)
+{
+	if ((gsize) (reader->end - reader->p) < 4) {
+		return FALSE;
+	}
+
+	*value = read_uint32_unchecked (reader->p);
+	reader->p += 4;
+
+	return TRUE;
+}
+
+static gboolean
+binary_reader_read_uint64 (BinaryReader *reader, guint64 *value)
+{
+	if ((gsize) (reader->end - reader->p) < 8) {
+		return FALSE;
+	}
+
+	*value = read_uint64_unchecked (reader->p);
+	reader->p += 8;
+
+	return TRUE;
+}
+
+/* Reads a nul-terminated string, returning a pointer to it within the trace data. */
+static gboolean
+binary_reader_read_string (BinaryReader *reader, const gchar **str)
+{
+	guint32 length;
+
+	if (binary_reader_read_uint32 (reader, &length) == FALSE ||
+	    (gsize) (reader->end - reader->p) <= length || reader->p[length] != '\0') {
+		return FALSE;
+	}
+
+	*str = reader->p;
+	reader->p += length + 1;
+
+	return TRUE;
+}
+
+static gboolean
+binary_reader_read_blob (BinaryReader *reader, const gchar **data, gsize *length)
+{
+	guint64 _length;
+
+	if (binary_reader_read_uint64 (reader, &_length) == FALSE || (guint64) (reader->end - reader->p) < _length) {
+		return FALSE;
+	}
+
+	*data = reader->p;
+	*length = _length;
+	reader->p += _length;
+
+	return TRUE;
+}
+
+static gboolean
+parse_binary_headers_and_body (SoupMessageHeaders *message_headers, SoupMessageBody *message_body, BinaryReader *reader, SoupBuffer *owner)
+{
+	const gchar *body;
+	gsize body_length;
+	guint32 n_headers, i;
+
+	if (binary_reader_read_uint32 (reader, &n_headers) == FALSE) {
+		return FALSE;
+	}
+
+	for (i = 0; i < n_headers; i++) {
+		const gchar *header_name, *header_value;
+
+		if (binary_reader_read_string (reader, &header_name) == FALSE || binary_reader_read_string (reader, &header_value) == FALSE) {
+			return FALSE;
+		}
+
+		soup_message_headers_append (message_headers, header_name, header_value);
+	}
+
+	if (binary_reader_read_blob (reader, &body, &body_length) == FALSE) {
+		return FALSE;
+	}
+
+	if (body_length > 0) {
+		SoupBuffer *buffer;
+
+		buffer = new_body_buffer (owner, body, body_length);
+		soup_message_body_append_buffer (message_body, buffer);
+		soup_buffer_free (buffer);
+	}
+
+	soup_message_body_complete (message_body);
+
+	return TRUE;
+}
+
+/* Parses a single request–response pair from a binary trace, starting at *@offset, and updates *@offset to point to the following pair.
+ * Message bodies reference @self's data. */
+static SoupMessage *
+parse_binary_message (UhmTrace *self, gsize *offset, SoupURI *base_uri)
+{
+	BinaryReader reader;
+	SoupMessage *message = NULL;
+	const gchar *method, *uri_string, *reason_phrase;
+	guint32 http_version, status_code;
+	SoupURI *uri;
+
+	reader.p = self->buffer->data + *offset;
+	reader.end = self->buffer->data + self->data_end;
+
+	/* The HTTP version is used as a SoupHTTPVersion as-is, so reject anything else rather than sending a made-up version in responses. */
+	if (binary_reader_read_string (&reader, &method) == FALSE || binary_reader_read_string (&reader, &uri_string) == FALSE ||
+	    binary_reader_read_uint32 (&reader, &http_version) == FALSE ||
+	    (http_version != SOUP_HTTP_1_0 && http_version != SOUP_HTTP_1_1)) {
+		goto error;
+	}
+
+	uri = soup_uri_new_with_base (base_uri, uri_string);
+	message = soup_message_new_from_uri (method, uri);
+	soup_uri_free (uri);
+
+	if (message == NULL) {
+		g_warning ("Invalid URI ‘%s’.", uri_string);
+		goto error;
+	}
+
+	soup_message_set_http_version (message, http_version);
+
+	/* As with text traces, the response's HTTP version is parsed but unused. */
+	if (parse_binary_headers_and_body (message->request_headers, message->request_body, &reader, self->buffer) == FALSE ||
+	    binary_reader_read_uint32 (&reader, &http_version) == FALSE ||
+	    binary_reader_read_uint32 (&reader, &status_code) == FALSE ||
+	    binary_reader_read_string (&reader, &reason_phrase) == FALSE) {
+		goto error;
+	}
+
+	soup_message_set_status_full (message, status_code, reason_phrase);
+
+	if (parse_binary_headers_and_body (message->response_headers, message->response_body, &reader, self->buffer) == FALSE) {
+		goto error;
+	}
+
+	*offset = reader.p - (const gchar *) self->buffer->data;
+
+	return message;
+
+error:
+	g_warning ("Truncated or corrupt message in binary trace at offset %" G_GSIZE_FORMAT ".", *offset);
+
+	/* Skip the rest of the trace. */
+	*offset = self->data_end;
+	g_clear_object (&message);
+
+	return NULL;
+}
+
+/* Returns TRUE iff the given message from a trace file should be ignored and not used by the mock server. */
+static gboolean
+should_ignore_soup_message (SoupMessage *message)
+{
+	switch (message->status_code) {
+		case SOUP_STATUS_NONE:
+		case SOUP_STATUS_CANCELLED:
+		case SOUP_STATUS_CANT_RESOLVE:
+		case SOUP_STATUS_CANT_RESOLVE_PROXY:
+		case SOUP_STATUS_CANT_CONNECT:
+		case SOUP_STATUS_CANT_CONNECT_PROXY:
+		case SOUP_STATUS_SSL_FAILED:
+		case SOUP_STATUS_IO_ERROR:
+		case SOUP_STATUS_MALFORMED:
+		case SOUP_STATUS_TRY_AGAIN:
+		case SOUP_STATUS_TOO_MANY_REDIRECTS:
+		case SOUP_STATUS_TLS_FAILED:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/* Parses the next request–response pair from the trace, as for uhm_trace_next_message(). If parsing fails, *@parse_failed is set to TRUE
+ * (otherwise it's left unchanged). */
+static SoupMessage *
+next_message (UhmTrace *self, gsize *offset, SoupURI *base_uri, gboolean *parse_failed)
+{
+	const gchar *data, *start, *message_end;
+	SoupMessage *message;
+
+	data = self->buffer->data;
+
+	/* An offset of 0 always means the start of the trace. */
+	if (*offset < self->data_start) {
+		*offset = self->data_start;
+	}
+
+	while (TRUE) {
+		if (*offset >= self->data_end) {
+			/* Reached the end of the file. */
+			return NULL;
+		}
+
+		if (self->is_binary == TRUE) {
+			message = parse_binary_message (self, offset, base_uri);
+		} else {
+			start = data + *offset;
+			message_end = find_message_end (start, data + self->data_end);
+			*offset = message_end - data;
+
+			message = parse_message (start, message_end, base_uri, self->buffer);
+		}
+
+		if (message == NULL) {
+			*parse_failed = TRUE;
+			return NULL;
+		} else if (should_ignore_soup_message (message) == FALSE) {
+			return message;
+		}
+
+		g_object_unref (message);
+	}
+}
+
+/* Parses the next request–response pair from the trace, starting at *@offset, skipping any messages which should be ignored (such as
+ * cancelled messages). *@offset is updated to point to the following request–response pair. Returns NULL if the end of the trace has
+ * been reached or the trace could not be parsed. */
+SoupMessage *
+uhm_trace_next_message (UhmTrace *self, gsize *offset, SoupURI *base_uri)
+{
+	gboolean parse_failed = FALSE;
+
+	g_return_val_if_fail (self != NULL, NULL);
+	g_return_val_if_fail (offset != NULL, NULL);
+
+	return next_message (self, offset, base_uri, &parse_failed);
+}
+
+/* Minimum number of messages for each thread to parse when loading a whole trace in parallel. Below this, starting threads costs more than
+ * it saves. */
+#define MIN_MESSAGES_PER_THREAD 128
+
+/* Finds the offsets of the request–response pairs in the trace from @offset onwards, without parsing them. The returned array holds the
+ * offset of each pair, followed by the offset of the end of the last one. For binary traces, the offsets are read from the index; NULL is
+ * returned if the index is inconsistent with @offset, in which case the messages must be found by parsing them. */
+static GArray/*<gsize>*/ *
+find_message_offsets (UhmTrace *self, gsize offset)
+{
+	const gchar *data = self->buffer->data;
+	GArray *offsets;
+
+	if (offset < self->data_start) {
+		offset = self->data_start;
+	}
+
+	offsets = g_array_new (FALSE, FALSE, sizeof (gsize));
+
+	if (self->is_binary == TRUE) {
+		const gchar *index_data = data + self->data_end;
+		guint64 i, message_offset, previous_offset = 0;
+
+		for (i = 0; i < self->n_messages; i++) {
+			message_offset = read_uint64_unchecked (index_data + i * 8);
+
+			/* The index is checked to be in order, but the messages themselves are only checked as they're parsed. */
+			if (message_offset < self->data_start || message_offset >= self->data_end || (i > 0 && message_offset <= previous_offset)) {
+				goto invalid;
+			}
+
+			if (message_offset >= offset) {
+				gsize _message_offset = message_offset;
+				g_array_append_val (offsets, _message_offset);
+			}
+
+			previous_offset = message_offset;
+		}
+
+		if ((offsets->len == 0 && offset < self->data_end) || (offsets->len > 0 && g_array_index (offsets, gsize, 0) != offset)) {
+			goto invalid;
+		}
+	} else {
+		while (offset < self->data_end) {
+			g_array_append_val (offsets, offset);
+			offset = find_message_end (data + offset, data + self->data_end) - data;
+		}
+	}
+
+	g_array_append_val (offsets, self->data_end);
+
+	return offsets;
+
+invalid:
+	g_array_unref (offsets);
+
+	return NULL;
+}
+
+/* A range of consecutive messages in a trace, to be parsed by one thread when loading the whole trace in parallel. */
+typedef struct {
+	const gsize *offsets;  /* unowned; offsets of the messages in the range, followed by the offset of the end of the last one */
+	guint n_messages;
+	SoupURI *base_uri;  /* unowned */
+	GCancellable *cancellable;  /* unowned */
+
+	GPtrArray/*<SoupMessage>*/ *messages;  /* owned; the parsed messages which shouldn't be ignored, in order */
+	gboolean parse_failed;  /* TRUE if parsing stopped at a message which couldn't be parsed */
+	gboolean offsets_invalid;  /* TRUE if a binary trace's index didn't match the messages as parsed */
+	gsize end_offset;  /* offset following the last message parsed, as uhm_trace_next_message() would set it */
+} MessageRange;
+
+static void
+parse_message_range_thread_cb (gpointer data, gpointer user_data)
+{
+	MessageRange *range = data;
+	UhmTrace *self = user_data;
+	guint i;
+
+	for (i = 0; i < range->n_messages && g_cancellable_is_cancelled (range->cancellable) == FALSE; i++) {
+		SoupMessage *message;
+		gsize offset = range->offsets[i];
+
+		if (self->is_binary == TRUE) {
+			message = parse_binary_message (self, &offset, range->base_uri);
+
+			if (message != NULL && offset != range->offsets[i + 1]) {
+				range->offsets_invalid = TRUE;
+				g_object_unref (message);
+				break;
+			}
+		} else {
+			message = parse_message (self->buffer->data + offset, self->buffer->data + range->offsets[i + 1], range->base_uri, self->buffer);
+			offset = range->offsets[i + 1];
+		}
+
+		range->end_offset = offset;
+
+		if (message == NULL) {
+			range->parse_failed = TRUE;
+			break;
+		} else if (should_ignore_soup_message (message) == FALSE) {
+			g_ptr_array_add (range->messages, message);
+		} else {
+			g_object_unref (message);
+		}
+	}
+}
+
+static GPtrArray *
+load_all_sequentially (UhmTrace *self, gsize *offset, SoupURI *base_uri, GCancellable *cancellable, GError **error)
+{
+	GPtrArray *messages;
+	SoupMessage *message;
+
+	if (self->is_binary == TRUE && self->n_messages <= G_MAXUINT) {
+		messages = g_ptr_array_new_full (self->n_messages, g_object_unref);
+	} else {
+		messages = g_ptr_array_new_with_free_func (g_object_unref);
+	}
+
+	while ((message = uhm_trace_next_message (self, offset, base_uri)) != NULL) {
+		g_ptr_array_add (messages, message);
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error) == TRUE) {
+			g_ptr_array_unref (messages);
+			return NULL;
+		}
+	}
+
+	return messages;
+}
+
+/* Parses all remaining request–response pairs in the trace, starting at *@offset, as for uhm_trace_next_message(). Returns the messages
+ * in order, or NULL if cancelled.
+ *
+ * The pairs are independent of each other, so large traces are parsed in parallel: the offsets of the pairs are found first (from the index,
+ * for binary traces), then consecutive ranges of them are parsed by a pool of threads. The result is the same as parsing them sequentially,
+ * including stopping at the first pair which can't be parsed. */
+GPtrArray *
+uhm_trace_load_all (UhmTrace *self, gsize *offset, SoupURI *base_uri, GCancellable *cancellable, GError **error)
+{
+	GArray *offsets;
+	MessageRange *ranges;
+	GThreadPool *thread_pool;
+	GPtrArray *messages;
+	guint n_messages, n_threads, i, j;
+	gboolean parse_failed = FALSE, offsets_invalid = FALSE;
+
+	g_return_val_if_fail (self != NULL, NULL);
+	g_return_val_if_fail (offset != NULL, NULL);
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
+	g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+	offsets = find_message_offsets (self, *offset);
+
+	if (offsets == NULL) {
+		return load_all_sequentially (self, offset, base_uri, cancellable, error);
+	}
+
+	n_messages = offsets->len - 1;
+	n_threads = MIN (g_get_num_processors (), n_messages / MIN_MESSAGES_PER_THREAD);
+
+	if (n_threads < 2) {
+		g_array_unref (offsets);
+		return load_all_sequentially (self, offset, base_uri, cancellable, error);
+	}
+
+	/* Split the messages into a range for each thread, of roughly equal sizes. */
+	ranges = g_new0 (MessageRange, n_threads);
+	thread_pool = g_thread_pool_new (parse_message_range_thread_cb, self, n_threads, FALSE, NULL);
+
+	for (i = 0, j = 0; i < n_threads; i++) {
+		MessageRange *range = &ranges[i];
+		guint range_end = (guint) (((guint64) n_messages * (i + 1)) / n_threads);
+
+		range->offsets = &g_array_index (offsets, gsize, j);
+		range->n_messages = range_end - j;
+		range->base_uri = base_uri;
+		range->cancellable = cancellable;
+		range->messages = g_ptr_array_new_full (range->n_messages, g_object_unref);
+		range->end_offset = range->offsets[0];
+
+		g_thread_pool_push (thread_pool, range, NULL);
+
+		j = range_end;
+	}
+
+	/* Wait for all the ranges to be parsed. */
+	g_thread_pool_free (thread_pool, FALSE, TRUE);
+
+	for (i = 0; i < n_threads; i++) {
+		offsets_invalid = offsets_invalid || ranges[i].offsets_invalid;
+	}
+
+	/* Concatenate the ranges, stopping after the first one which contains a message which couldn't be parsed, as parsing sequentially
+	 * would. If the index of a binary trace turned out to be wrong, the messages must be found by parsing them sequentially after all. */
+	messages = g_ptr_array_new_full (n_messages, g_object_unref);
+
+	for (i = 0; i < n_threads; i++) {
+		MessageRange *range = &ranges[i];
+
+		if (parse_failed == FALSE && offsets_invalid == FALSE) {
+			for (j = 0; j < range->messages->len; j++) {
+				g_ptr_array_add (messages, g_object_ref (g_ptr_array_index (range->messages, j)));
+			}
+
+			*offset = range->end_offset;
+			parse_failed = range->parse_failed;
+		}
+
+		g_ptr_array_unref (range->messages);
+	}
+
+	g_free (ranges);
+	g_array_unref (offsets);
+
+	if (g_cancellable_set_error_if_cancelled (cancellable, error) == TRUE) {
+		g_ptr_array_unref (messages);
+		return NULL;
+	} else if (offsets_invalid == TRUE) {
+		g_ptr_array_unref (messages);
+		return load_all_sequentially (self, offset, base_uri, cancellable, error);
+	}
+
+	return messages;
+}
+
+/* Parses a single request–response pair from @data, which need not be nul-terminated. Unlike messages returned by
+ * uhm_trace_next_message(), the message does not reference @data once this function returns. */
+SoupMessage *
+uhm_trace_message_new_from_data (const gchar *data, gsize length, SoupURI *base_uri)
+{
+	g_return_val_if_fail (data != NULL || length == 0, NULL);
+
+	return parse_message (data, data + length, base_uri, NULL);
+}
+
+static void
+byte_array_append_uint32 (GByteArray *array, guint32 value)
+{
+	value = GUINT32_TO_LE (value);
+	g_byte_array_append (array, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+byte_array_append_uint64 (GByteArray *array, guint64 value)
+{
+	value = GUINT64_TO_LE (value);
+	g_byte_array_append (array, (const guint8 *) &value, sizeof (value));
+}
+
+static void
+byte_array_append_string (GByteArray *array, const gchar *str)
+{
+	gsize length = strlen (str);
+
+	byte_array_append_uint32 (array, length);
+	g_byte_array_append (array, (const guint8 *) str, length + 1);
+}
+
+static void
+append_header_cb (const gchar *name, const gchar *value, gpointer user_data)
+{
+	GByteArray *array = user_data;
+
+	byte_array_append_string (array, name);
+	byte_array_append_string (array, value);
+}
+
+static void
+byte_array_append_headers_and_body (GByteArray *array, SoupMessageHeaders *message_headers, SoupMessageBody *message_body)
+{
+	SoupBuffer *body;
+	guint n_headers = 0;
+	SoupMessageHeadersIter iter;
+	const gchar *name, *value;
+
+	soup_message_headers_iter_init (&iter, message_headers);
+	while (soup_message_headers_iter_next (&iter, &name, &value) == TRUE) {
+		n_headers++;
+	}
+
+	byte_array_append_uint32 (array, n_headers);
+	soup_message_headers_foreach (message_headers, append_header_cb, array);
+
+	body = soup_message_body_flatten (message_body);
+	byte_array_append_uint64 (array, body->length);
+	g_byte_array_append (array, (const guint8 *) body->data, body->length);
+	soup_buffer_free (body);
+}
+
+/* Serialises a single request–response pair in the binary format. */
+static void
+byte_array_append_message (GByteArray *array, SoupMessage *message)
+{
+	gchar *uri_string;
+
+	uri_string = soup_uri_to_string (soup_message_get_uri (message), TRUE);
+
+	byte_array_append_string (array, message->method);
+	byte_array_append_string (array, uri_string);
+	byte_array_append_uint32 (array, soup_message_get_http_version (message));
+	byte_array_append_headers_and_body (array, message->request_headers, message->request_body);
+
+	byte_array_append_uint32 (array, soup_message_get_http_version (message));
+	byte_array_append_uint32 (array, message->status_code);
+	byte_array_append_string (array, (message->reason_phrase != NULL) ? message->reason_phrase : "");
+	byte_array_append_headers_and_body (array, message->response_headers, message->response_body);
+
+	g_free (uri_string);
+}
+
+/* Writes all the messages in @self to @output_stream in the binary trace format, skipping any which should be ignored. @self may itself be
+ * in either format. Returns FALSE and sets @error if @self could not be parsed, or on failure to write. */
+gboolean
+uhm_trace_compile (UhmTrace *self, GOutputStream *output_stream, GCancellable *cancellable, GError **error)
+{
+	GByteArray *array;
+	GArray *offsets;
+	SoupURI *base_uri;
+	SoupMessage *message;
+	gsize offset = 0, i;
+	guint64 written = 0;
+	gboolean parse_failed = FALSE, success = FALSE;
+
+	g_return_val_if_fail (self != NULL, FALSE);
+	g_return_val_if_fail (G_IS_OUTPUT_STREAM (output_stream), FALSE);
+	g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+	array = g_byte_array_new ();
+	offsets = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+	/* URIs are stored relative to the server, so the base URI used for parsing is arbitrary. */
+	base_uri = soup_uri_new ("https://localhost/");
+
+	/* Header. */
+	g_byte_array_append (array, (const guint8 *) BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+	byte_array_append_uint32 (array, BINARY_VERSION);
+	byte_array_append_uint32 (array, 0);
+
+	/* Messages. Each is written out as soon as it's serialised, so that memory usage doesn't grow with the size of the trace. */
+	while ((message = next_message (self, &offset, base_uri, &parse_failed)) != NULL) {
+		guint64 message_offset = written + array->len;
+
+		g_array_append_val (offsets, message_offset);
+		byte_array_append_message (array, message);
+		g_object_unref (message);
+
+		if (g_output_stream_write_all (output_stream, array->data, array->len, NULL, cancellable, error) == FALSE) {
+			goto done;
+		}
+
+		written += array->len;
+		g_byte_array_set_size (array, 0);
+	}
+
+	if (parse_failed == TRUE) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+		             "Invalid message in trace before offset %" G_GSIZE_FORMAT ".", offset);
+		goto done;
+	}
+
+	/* Offset index. */
+	for (i = 0; i < offsets->len; i++) {
+		byte_array_append_uint64 (array, g_array_index (offsets, guint64, i));
+	}
+
+	byte_array_append_uint64 (array, offsets->len);
+	byte_array_append_uint64 (array, written);
+	g_byte_array_append (array, (const guint8 *) BINARY_INDEX_MAGIC, BINARY_MAGIC_LENGTH);
+
+	success = g_output_stream_write_all (output_stream, array->data, array->len, NULL, cancellable, error);
+
+done:
+	soup_uri_free (base_uri);
+	g_array_unref (offsets);
+	g_byte_array_unref (array);
+
+	return success;
+}
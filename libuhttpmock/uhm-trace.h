@@ -0,0 +1,47 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * uhttpmock
+ * Copyright (C) Philip Withnall 2013 <philip@tecnocode.co.uk>
+ *
+ * uhttpmock is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * uhttpmock is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with uhttpmock.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UHM_TRACE_H
+#define UHM_TRACE_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+/* Private API for loading and parsing trace files. This is not installed. */
+
+typedef struct _UhmTrace UhmTrace;
+
+G_GNUC_INTERNAL UhmTrace *uhm_trace_new_from_file (GFile *trace_file, GCancellable *cancellable, GError **error);
+G_GNUC_INTERNAL UhmTrace *uhm_trace_new_from_bytes (GBytes *bytes, GError **error);
+G_GNUC_INTERNAL UhmTrace *uhm_trace_ref (UhmTrace *self);
+G_GNUC_INTERNAL void uhm_trace_unref (UhmTrace *self);
+
+G_GNUC_INTERNAL SoupMessage *uhm_trace_next_message (UhmTrace *self, gsize *offset, SoupURI *base_uri);
+G_GNUC_INTERNAL GPtrArray *uhm_trace_load_all (UhmTrace *self, gsize *offset, SoupURI *base_uri, GCancellable *cancellable, GError **error);
+
+G_GNUC_INTERNAL SoupMessage *uhm_trace_message_new_from_data (const gchar *data, gsize length, SoupURI *base_uri);
+
+G_GNUC_INTERNAL gboolean uhm_trace_compile (UhmTrace *self, GOutputStream *output_stream, GCancellable *cancellable, GError **error);
+
+G_END_DECLS
+
+#endif /* !UHM_TRACE_H */